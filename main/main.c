@@ -4,128 +4,620 @@
 #include <sys/time.h>
 
 
+#include "sdkconfig.h"
 #include "nvs_flash.h"
 #include "wifi_util.h"
-#include "blufi_util.h"
 #include "sensor_util.h"
 #include "nvs_util.h"
 #include "mqtt_util.h"
+#include "config_util.h"
+#include "uplink_queue.h"
+#include "dlog_util.h"
+#include "diag_util.h"
+#include "link_util.h"
+#include "time_util.h"
+#include "ota_util.h"
+#include "phase_util.h"
+#include "aggregate_util.h"
+#include "counter_util.h"
+#include "image_util.h"
+#include "energy_util.h"
+#if CONFIG_SENSE_PIPELINE
+#include "pipeline_util.h"
+#endif
+#if CONFIG_STORAGE_BENCHMARK
+#include "storage_bench.h"
+#endif
 #include "esp_log.h"
-
+#if CONFIG_UPLINK_TRANSPORT_ESPNOW || CONFIG_ESPNOW_GATEWAY
+#include "espnow_util.h"
+#include "espnow_proto.h"
+#endif
+#if CONFIG_UPLINK_TRANSPORT_BLE_ADV
+#include "bleadv_util.h"
+#endif
+
+#if !CONFIG_SIM_STUB_BACKENDS && !CONFIG_APP_ROLE_UPLINK
+#include "blufi_util.h"
 #include "esp_blufi_api.h"
 #include "esp_blufi.h"
+#endif
 #include "esp_sleep.h"
+#include "esp_system.h"
 #include "esp_mac.h"
+#include "esp_timer.h"
+#include "esp_rtc_time.h"
+#include "esp_pm.h"
 
 #include "driver/gpio.h"
 
 extern struct wifi_info wifi_inf;
 
-//Remove so RTC Slow Memory stays off during deep sleep
-//static RTC_DATA_ATTR struct timeval sleep_enter_time;
+/* RTC time at deep sleep entry and the programmed sleep, to measure the wake to app_main latency */
+static RTC_DATA_ATTR uint64_t sleep_enter_rtc_us;
+static RTC_DATA_ATTR uint64_t sleep_duration_us;
 
 static const char *TAG = "TESTING";
 
 const static char* LOG_TOPIC = "sensor/log";
 
+/* Only waited for by a node without a saved configuration */
+#define CONFIG_WAIT_MS  2000
+#define WIFI_WAIT_MS    10000
+#define MQTT_WAIT_MS    5000
+#define SNTP_WAIT_MS    3000
+/* Longest wait for PUBACKs before deep sleep, unacked readings stay queued */
+#define FLUSH_WAIT_MS   3000
+/* Longest wait for the reading of the pipeline, the infiltration capture alone can take 20 s */
+#define PIPELINE_WAIT_MS    60000
+//Deep sleep used to reboot into a freshly written update, the first boot then runs as a timer wake
+#define OTA_REBOOT_SLEEP_SEC    1
+
+//Set to 1 to run the 20 second phase power benchmark on timer wakes instead of the sensor cycle
+#define POWER_BENCHMARK 0
+
 extern bool config_done;
 
-void app_main(void)
+static bool ota_reboot;
+
+//Lowest CPU frequency used while idle, the crystal frequency
+#define PM_MIN_FREQ_MHZ 40
+
+static void pm_init(void)
 {
-    nvs_init();
+#if CONFIG_PM_ENABLE
+    /* Waits (warm-ups, network) drop to the crystal clock and light sleep between ticks,
+       drivers hold esp_pm locks while they need the full clock or no light sleep */
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = PM_MIN_FREQ_MHZ,
+        .light_sleep_enable = true,
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Power management not enabled: %s", esp_err_to_name(err));
+    }
+#endif
+}
 
+#if POWER_BENCHMARK
+static void run_power_benchmark(void)
+{
     struct timeval now, start;
-    //gettimeofday(&now, NULL);
-    //int sleep_time_ms = (now.tv_sec - sleep_enter_time.tv_sec) * 1000 + (now.tv_usec - sleep_enter_time.tv_usec) / 1000;
 
-    //TODO get MAC adress from the microcontroller
+    ESP_LOGI(TAG, "Waiting 20 seconds");
+    vTaskDelay(20000 / portTICK_PERIOD_MS);
+    ESP_LOGI(TAG, "Waiting 20 seconds");
 
-    switch(esp_sleep_get_wakeup_cause()) 
+    ESP_LOGI(TAG, "GPIO 8 set to 1");
+    gpio_set_direction(GPIO_NUM_8, GPIO_MODE_OUTPUT);
+    gpio_set_level(GPIO_NUM_8, 1);
+
+    ESP_LOGI(TAG, "GPIO 8 on hold");
+    gpio_hold_en(GPIO_NUM_8);
+
+    ESP_LOGI(TAG, "Enter light sleep for 20 secs");
+    esp_sleep_enable_timer_wakeup(20 * 1000000);
+    esp_light_sleep_start();
+
+    ESP_LOGI(TAG, "Wakeup from light sleep");
+
+    ESP_LOGI(TAG, "GPIO 8 not on hold");
+    gpio_hold_dis(GPIO_NUM_8);
+    ESP_LOGI(TAG, "GPIO 8 set to 0");
+    gpio_set_level(GPIO_NUM_8, 0);
+
+    //sensors_init();
+
+    ESP_LOGI(TAG, "WIFI Initialized");
+    initialise_wifi();
+    vTaskDelay(20000 / portTICK_PERIOD_MS);
+
+    ESP_LOGI(TAG, "MQTT Initialized");
+    mqtt_client_init();
+    vTaskDelay(20000 / portTICK_PERIOD_MS);
+
+    if (mqtt_wait_connected(CONFIG_WAIT_MS) && mqtt_wait_config(CONFIG_WAIT_MS)) {
+        ESP_LOGI(TAG, "Remote configuration received");
+    }
+
+    char log_message[60];
+    sprintf(log_message, "00:00:00:00:00:00 4 30 7.0 30 7.0 30 7.0 30 7.0");
+
+
+    gettimeofday(&start, NULL);
+    gettimeofday(&now, NULL);
+    int m_sent = 0;
+
+    ESP_LOGI(TAG, "Sending Messages");
+    while((now.tv_sec - start.tv_sec) < 20)
     {
-        case ESP_SLEEP_WAKEUP_TIMER:
-            //printf("Wake up from timer. Time spent in deep sleep: %dms\n", sleep_time_ms);
+        mqtt_send_data(LOG_TOPIC, log_message);
+        m_sent++;
+        gettimeofday(&now, NULL);
+    }
+    int i = (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_usec - start.tv_usec);
+    ESP_LOGI(TAG, "Messages Done");
+    ESP_LOGI(TAG, "%d Messages sent", m_sent);
+
+    ESP_LOGI(TAG, "%d us Time Spent", i);
+}
+#else
 
-            ESP_LOGI(TAG, "Waiting 20 seconds");
-            vTaskDelay(20000 / portTICK_PERIOD_MS);
-            ESP_LOGI(TAG, "Waiting 20 seconds");
+static void uplink_failed(void)
+{
+    uplink_backoff_failure();
+    if (uplink_queue_persist() != ESP_OK) {
+        ESP_LOGE(TAG, "Could not persist the uplink queue");
+    }
+}
 
-            ESP_LOGI(TAG, "GPIO 8 set to 1");
-            gpio_set_direction(GPIO_NUM_8, GPIO_MODE_OUTPUT);
-            gpio_set_level(GPIO_NUM_8, 1);
+/* Records are encoded into UPLINK_ENTRY_LEN buffers, the pipeline blocks and the queue entries */
+_Static_assert(UPLINK_RECORD_MAX < UPLINK_ENTRY_LEN, "worst case record does not fit an uplink entry");
+#if CONFIG_UPLINK_TRANSPORT_ESPNOW
+/* One frame per record, behind the frame header and LOG_TOPIC */
+_Static_assert(UPLINK_RECORD_MAX <= ESPNOW_FRAME_MAX - ESPNOW_HEADER_LEN - 1 - (int)(sizeof("sensor/log") - 1),
+               "worst case record does not fit an ESP-NOW frame");
+#endif
 
-            ESP_LOGI(TAG, "GPIO 8 on hold");
-            gpio_hold_en(GPIO_NUM_8);
+/* Clock at the start of the wake, the pipeline encodes while the uplink may step it with a time sync */
+static int64_t wake_epoch_ms;
+static int wake_uncertainty_ms;
 
-            ESP_LOGI(TAG, "Enter light sleep for 20 secs");
-            esp_sleep_enable_timer_wakeup(20 * 1000000);
-            esp_light_sleep_start();
+static void snapshot_clock(void)
+{
+    time_now(&wake_epoch_ms, &wake_uncertainty_ms);
+}
 
-            ESP_LOGI(TAG, "Wakeup from light sleep");
+/* Folds the reading into the aggregate window, writes the record when the window closed and returns its length */
+static int encode_window(const struct sensor_reading* reading, char* buf, size_t len)
+{
+    /* Wakes inside the window only update the aggregate, no record is queued */
+    if (!aggregate_add(reading)) {
+        return 0;
+    }
+    int n = 0;
+#if MQTT_RECORD_HAS_ID
+    n = snprintf(buf, len, "%s ", mqtt_device_id());
+#endif
+    if (n < (int)len) {
+        n += snprintf(buf + n, len - n, "%d %lld %d", aggregate_count(), wake_epoch_ms, wake_uncertainty_ms);
+    }
+    if (n < (int)len) {
+        n += aggregate_format(buf + n, len - n);
+    }
+    if (n < (int)len) {
+        n += energy_format(buf + n, len - n);
+    }
+    aggregate_reset();
+    counters_reading();
+    if (n >= (int)len) {
+        /* Only a value far out of its sensor range gets here, a cut record would be parsed wrong */
+        DLOGW("Record of %d characters dropped, %d fit", n, (int)len - 1);
+        return 0;
+    }
+    return n;
+}
 
-            ESP_LOGI(TAG, "GPIO 8 not on hold");
-            gpio_hold_dis(GPIO_NUM_8);
-            ESP_LOGI(TAG, "GPIO 8 set to 0");
-            gpio_set_level(GPIO_NUM_8, 0);
+static int encode_reading(const struct sensor_reading* reading, char* buf, size_t len)
+{
+    /* A config update from the MQTT task during the connect would mix old and new deadbands */
+    sensor_config_lock();
+    int n = encode_window(reading, buf, len);
+    sensor_config_unlock();
+    return n;
+}
+
+#if CONFIG_UPLINK_TRANSPORT_MQTT
+/* Wi-Fi, time sync and the broker session, false when this wake gives up on the uplink */
+static bool uplink_connect(bool verify_image)
+{
+    PHASE("wifi");
+    DLOGI("WIFI Initialized");
+    int64_t wifi_start = esp_timer_get_time();
+    initialise_wifi();
+    bool connected = wifi_wait_connected(WIFI_WAIT_MS);
+    link_record_result(connected, (esp_timer_get_time() - wifi_start) / 1000, wifi_get_retry_count());
+    if (!connected) {
+        DLOGW("WIFI connection failed");
+        uplink_failed();
+        return false;
+    }
 
-            //sensors_init();
+    if (time_sync_needed()) {
+        time_sync(SNTP_WAIT_MS);
+    }
 
-            ESP_LOGI(TAG, "WIFI Initialized");
-            initialise_wifi();
-            vTaskDelay(20000 / portTICK_PERIOD_MS);
+    PHASE("mqtt");
+    DLOGI("MQTT Initialized");
+    mqtt_client_init();
+    if (!mqtt_wait_connected(MQTT_WAIT_MS)) {
+        DLOGW("MQTT connection failed");
+        uplink_failed();
+        if (verify_image) {
+            ota_reject();
+        }
+        return false;
+    }
 
-            ESP_LOGI(TAG, "MQTT Initialized");
-            mqtt_client_init();
-            vTaskDelay(20000 / portTICK_PERIOD_MS);
+    /* Retained updates come right after the subscription and are applied whenever they arrive,
+       a configured node sends on and picks them up during the uplink or on the next one */
+    if (!sensor_config_saved()) {
+        if (mqtt_wait_config(CONFIG_WAIT_MS)) {
+            DLOGI("Remote configuration received");
+        }
+        /* No retained config, an empty one or the defaults: saved as is so later uplinks do not wait */
+        sensor_config_persist(&sensor_cfg);
+    }
+    return true;
+}
 
-            char log_message[60];
-            sprintf(log_message, "00:00:00:00:00:00 4 30 7.0 30 7.0 30 7.0 30 7.0");
+/* Sends the queue, then record when it is not NULL and not queued yet, and closes the connection */
+static void uplink_send(const char* record)
+{
+    PHASE("replay");
+    bool replayed = uplink_queue_replay(mqtt_send_data, LOG_TOPIC);
+    int record_id = -1;
+    if (replayed && record != NULL) {
+        record_id = mqtt_send_data(LOG_TOPIC, record);
+    }
 
+    if (dlog_fault_pending()) {
+        mqtt_upload_dlog();
+    }
 
-            gettimeofday(&start, NULL);
-            gettimeofday(&now, NULL);
-            int m_sent = 0;
+    if (diag_due()) {
+        mqtt_send_diag();
+    }
 
-            ESP_LOGI(TAG, "Sending Messages");
-            while((now.tv_sec - start.tv_sec) < 20)
-            {
-                mqtt_send_data(LOG_TOPIC, log_message);
-                m_sent++;
-                gettimeofday(&now, NULL);
-            }
-            int i = (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_usec - start.tv_usec);
-            ESP_LOGI(TAG, "Messages Done");
-            ESP_LOGI(TAG, "%d Messages sent", m_sent);
+    /* A reading only leaves the queue once its PUBACK arrived */
+    PHASE("flush");
+    bool flushed = mqtt_flush(FLUSH_WAIT_MS);
+    int left = uplink_queue_settle(mqtt_delivered);
+    if (record != NULL && (record_id < 0 || !mqtt_delivered(record_id))) {
+        uplink_queue_push(record, sensor_cfg.batch_high);
+        left++;
+    }
+    if (replayed && flushed && left == 0) {
+        uplink_backoff_success();
+        ota_confirm();
+    } else {
+        DLOGW("%d readings not delivered", left);
+        uplink_failed();
+    }
+
+    if (ota_requested() && ota_apply() == ESP_OK) {
+        ota_reboot = true;
+    }
+
+    /* DISCONNECT and a clean station stop, deep sleep follows right away */
+    mqtt_stop();
+    wifi_stop();
+}
+#endif
+
+#if CONFIG_SENSE_PIPELINE
+static void run_sensor_cycle(void)
+{
+    enum wake_action action = WAKE_SAMPLE_ONLY;
+    bool connected = false;
+
+    energy_update();
+    counters_wake();
+    snapshot_clock();
+    pipeline_start(encode_reading);
+
+    /* A wake that closes the window by count has a record coming, it connects while the sensors are read.
+       In the alarm-only tier only the reading tells whether to uplink. */
+    bool record_due = !energy_alarm_only() && counters_wb_readings() >= sensor_cfg.wb_reading;
+    bool verify_image = ota_pending_verify();
+    int batch_low = energy_batch_low(sensor_cfg.batch_low);
+    if (record_due) {
+        action = uplink_policy(1, batch_low, verify_image);
+        connected = action == WAKE_UPLINK && uplink_connect(verify_image);
+    }
+
+    PHASE("pipeline");
+    struct pipe_block* block = pipeline_take(PIPELINE_WAIT_MS);
+    const char* record = NULL;
+    if (block == NULL) {
+        DLOGW("No reading from the pipeline");
+    } else if (block->len > 0) {
+        record = block->data;
+    }
+
+    /* Otherwise only a deadband alarm closes the window, the decision waits for the reading */
+    if (!record_due) {
+        bool alarm = false;
+        if (record != NULL) {
+            uplink_queue_push(record, sensor_cfg.batch_high);
+            record = NULL;
+            alarm = aggregate_alarm();
+        }
+        action = uplink_policy(0, batch_low, verify_image || (alarm && energy_alarm_only()));
+        connected = action == WAKE_UPLINK && uplink_connect(verify_image);
+    }
+
+    if (connected) {
+        uplink_send(record);
+    } else if (record != NULL) {
+        uplink_queue_push(record, sensor_cfg.batch_high);
+        /* A failed connection persisted the queue before the record was encoded */
+        if (action == WAKE_UPLINK) {
+            uplink_queue_persist();
+        }
+    }
+    if (action == WAKE_SAMPLE_ONLY) {
+        DLOGI("%d readings queued, waiting for %d", uplink_queue_count(), batch_low);
+    }
+
+    if (block != NULL) {
+        pipeline_release(block);
+    }
+    PHASE(NULL);
+}
+#else
+static void run_sensor_cycle(void)
+{
+    char message[UPLINK_ENTRY_LEN];
+    struct sensor_reading reading;
+
+    bool alarm = false;
+
+    PHASE("sensors");
+    energy_update();
+    sensors_init();
+    sensors_read(&reading);
+    counters_wake();
+    snapshot_clock();
+
+    if (encode_reading(&reading, message, sizeof(message)) > 0) {
+        uplink_queue_push(message, sensor_cfg.batch_high);
+        alarm = aggregate_alarm();
+    }
+
+    /* A new image has to prove it can uplink on its first boot, or it is rolled back */
+    bool verify_image = ota_pending_verify();
+
+    /* In the alarm-only tier routine windows stay queued, an alarm still goes out right away */
+    int batch_low = energy_batch_low(sensor_cfg.batch_low);
+    enum wake_action action = uplink_policy(0, batch_low, verify_image || (alarm && energy_alarm_only()));
+    if (action != WAKE_UPLINK) {
+        if (action == WAKE_SAMPLE_ONLY) {
+            DLOGI("%d readings queued, waiting for %d", uplink_queue_count(), batch_low);
+        }
+        PHASE(NULL);
+        return;
+    }
+
+#if CONFIG_UPLINK_TRANSPORT_ESPNOW
+    /* Records go to the gateway, no association, DHCP or broker session */
+    PHASE("espnow");
+    if (!espnow_node_start()) {
+        DLOGW("ESP-NOW not paired or not started");
+        uplink_failed();
+        PHASE(NULL);
+        return;
+    }
+
+    PHASE("replay");
+    /* Every record espnow_send_data() sent was acked by the gateway */
+    bool replayed = uplink_queue_replay(espnow_send_data, LOG_TOPIC);
+    uplink_queue_settle(NULL);
+    if (replayed) {
+        uplink_backoff_success();
+        ota_confirm();
+    } else {
+        uplink_failed();
+    }
+    espnow_node_stop();
+#elif CONFIG_UPLINK_TRANSPORT_BLE_ADV
+    /* Broadcast to whatever listens, no association and no connection */
+    PHASE("ble_adv");
+    if (!bleadv_start()) {
+        uplink_failed();
+        PHASE(NULL);
+        return;
+    }
+
+    PHASE("replay");
+    /* Nothing is acked, a record counts as delivered once it was advertised */
+    bool replayed = uplink_queue_replay(bleadv_send_data, LOG_TOPIC);
+    uplink_queue_settle(NULL);
+    if (replayed) {
+        uplink_backoff_success();
+        ota_confirm();
+    } else {
+        uplink_failed();
+    }
+    bleadv_stop();
+#else
+    if (uplink_connect(verify_image)) {
+        uplink_send(NULL);
+    }
+#endif
+    PHASE(NULL);
+}
+#endif
+#endif
+
+#if !CONFIG_SIM_STUB_BACKENDS && !CONFIG_APP_ROLE_UPLINK
+/* Starts BluFi and Wi-Fi, then waits until the phone sent the station configuration */
+static bool run_provisioning(void)
+{
+#if CONFIG_BLUFI_CRYPTO_BENCHMARK
+    blufi_crypto_benchmark();
+#endif
+    esp_err_t err = esp_blufi_host_and_cb_init();
+    if (err) 
+    {
+        BLUFI_ERROR("%s initialise failed: %s\n", __func__, esp_err_to_name(err));
+        return false;
+    }
+    BLUFI_INFO("BLUFI VERSION %04x\n", esp_blufi_get_version());
+    ESP_LOGI(TAG, "Bluetooth Initiated");
+    vTaskDelay(20000 / portTICK_PERIOD_MS);
+    initialise_wifi();
+    ESP_LOGI(TAG, "Waiting Configuration");
+    while(config_done == false)
+    {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    ESP_LOGI(TAG, "Bluetooth Terminated");
+    return true;
+}
+
+#if !CONFIG_ESPNOW_GATEWAY && !CONFIG_STORAGE_BENCHMARK
+/* An OTA rollback, a panic, a watchdog or a brownout restarts a provisioned node, it goes back
+   to its timer wakes instead of waiting for BluFi on battery. Power-on and the reset pin still provision. */
+static bool resume_after_reset(void)
+{
+    wifi_config_t saved;
+    esp_reset_reason_t reason = esp_reset_reason();
+
+    return reason != ESP_RST_POWERON && reason != ESP_RST_EXT && get_saved_wifi(&saved) == ESP_OK;
+}
+#endif
+#endif
+
+#if CONFIG_ESPNOW_GATEWAY
+//Wait before restarting a gateway that lost its uplink
+#define GATEWAY_RESTART_MS  30000
+
+static void gateway_restart(void)
+{
+    vTaskDelay(GATEWAY_RESTART_MS / portTICK_PERIOD_MS);
+    esp_restart();
+}
 
-            ESP_LOGI(TAG, "%d us Time Spent", i);
-                
+/* Mains powered, provisioned once over BluFi and then relays ESP-NOW nodes without sleeping */
+static void run_gateway(void)
+{
+    wifi_config_t saved;
+
+    if (get_saved_wifi(&saved) != ESP_OK) {
+        if (!run_provisioning()) {
+            return;
+        }
+    } else {
+        initialise_wifi();
+    }
+    if (!wifi_wait_connected(WIFI_WAIT_MS)) {
+        ESP_LOGE(TAG, "Gateway Wi-Fi connection failed");
+        gateway_restart();
+    }
+    time_sync(SNTP_WAIT_MS);
 
+    mqtt_client_init();
+    if (!mqtt_wait_connected(MQTT_WAIT_MS)) {
+        ESP_LOGE(TAG, "Gateway MQTT connection failed");
+        gateway_restart();
+    }
+    espnow_gateway_run(mqtt_send_data, mqtt_delivered);
+}
+#endif
+
+void app_main(void)
+{
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && sleep_enter_rtc_us != 0) {
+        int64_t boot_us = esp_rtc_get_time_us() - (sleep_enter_rtc_us + sleep_duration_us);
+        /* esp_timer starts with the app, what comes before is the ROM, the bootloader and the image load */
+        int64_t startup_us = esp_timer_get_time();
+        ESP_LOGI(TAG, "Boot time: %lld us, load %lld us, startup %lld us, image %s", boot_us, boot_us - startup_us,
+                    startup_us, IMAGE_ROLE);
+    }
+
+    dlog_init();
+    pm_init();
+    nvs_init();
+    sensor_config_load(&sensor_cfg);
+    counters_init();
+    uplink_queue_init();
+    time_init();
+
+#if CONFIG_STORAGE_BENCHMARK
+    /* The recovery of every backend is measured on the timer wake after the patterns */
+    if (!storage_bench_run()) {
+        esp_sleep_enable_timer_wakeup(BENCH_SLEEP_US);
+        esp_deep_sleep_start();
+    }
+    printf("Storage benchmark done\n");
+    return;
+#elif CONFIG_SIM_STUB_BACKENDS
+    /* No deep sleep in QEMU, the timer wake path runs in a loop and keeps its RTC state */
+    printf("BOOT_TO_APP_MAIN %lld\n", esp_timer_get_time());
+    for (int cycle = 0; cycle < CONFIG_SIM_CYCLES; cycle++) {
+        printf("SIM CYCLE %d\n", cycle);
+        run_sensor_cycle();
+        diag_sample();
+        time_init();
+    }
+    printf("SIM DONE\n");
+    return;
+#elif CONFIG_ESPNOW_GATEWAY
+    run_gateway();
+#else
+    switch(esp_sleep_get_wakeup_cause()) 
+    {
+        case ESP_SLEEP_WAKEUP_TIMER:
+#if POWER_BENCHMARK
+            run_power_benchmark();
+#else
+            run_sensor_cycle();
+#endif
             break;
         case ESP_SLEEP_WAKEUP_UNDEFINED:
         default:
             printf("Not a deep sleep reset\n");
-            
-            esp_err_t err = esp_blufi_host_and_cb_init();
-            if (err) 
-            {
-                BLUFI_ERROR("%s initialise failed: %s\n", __func__, esp_err_to_name(err));
+#if CONFIG_APP_ROLE_UPLINK
+            /* Other resets load the full image from otadata, it runs provisioning */
+            esp_restart();
+#else
+            if (resume_after_reset()) {
+                printf("Provisioned, resuming the wake cycle\n");
+                run_sensor_cycle();
+                break;
+            }
+            if (!run_provisioning()) {
                 return;
             }
-            BLUFI_INFO("BLUFI VERSION %04x\n", esp_blufi_get_version());
-            ESP_LOGI(TAG, "Bluetooth Initiated");
-            vTaskDelay(20000 / portTICK_PERIOD_MS);
-            initialise_wifi();
-            ESP_LOGI(TAG, "Waiting Configuration");
-            while(config_done == false)
-            {
-                vTaskDelay(10 / portTICK_PERIOD_MS);
+            if (wifi_wait_connected(WIFI_WAIT_MS)) {
+                time_sync(SNTP_WAIT_MS);
             }
-            ESP_LOGI(TAG, "Bluetooth Terminated");
             //esp_blufi_host_deinit();
+#endif
     }
 
-    const int wakeup_time_sec = 20;
+    diag_sample();
+
+    const int wakeup_time_sec = ota_reboot ? OTA_REBOOT_SLEEP_SEC : energy_sleep_interval(sensor_cfg.sleep_interval);
     printf("Enabling timer wakeup, %ds\n", wakeup_time_sec);
-    esp_sleep_enable_timer_wakeup(wakeup_time_sec * 1000000);
+    sleep_duration_us = (uint64_t)wakeup_time_sec * 1000000;
+    esp_sleep_enable_timer_wakeup(sleep_duration_us);
+
+#if CONFIG_APP_ROLE_FULL
+    image_select_uplink();
+#endif
 
     esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_OFF);
     //esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_SLOW_MEM, ESP_PD_OPTION_OFF);
@@ -133,10 +625,11 @@ void app_main(void)
 
 
     printf("Entering deep sleep\n");
-    //gettimeofday(&sleep_enter_time, NULL);
 
     vTaskDelay(10 / portTICK_PERIOD_MS);
+    sleep_enter_rtc_us = esp_rtc_get_time_us();
 
     esp_deep_sleep_start();
-    
+#endif
+
 }
\ No newline at end of file
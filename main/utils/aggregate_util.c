@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "esp_attr.h"
+
+#include "aggregate_util.h"
+#include "config_util.h"
+#include "counter_util.h"
+#include "dlog_util.h"
+
+#define AGGREGATE_MAGIC 0x41474753
+
+enum aggregate_channel {
+#if CONFIG_SENSOR_PH
+    AGG_PH,
+#endif
+#if CONFIG_SENSOR_INFILTRATION
+    AGG_INFILTRATION,
+#endif
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+    AGG_INF_SLOPE,
+    AGG_INF_TTT,
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+    AGG_TEMP,
+    AGG_HUM,
+#endif
+#if CONFIG_SENSOR_WATER_LEVEL
+    AGG_WATER_LEVEL,
+#endif
+    AGG_CHANNELS
+};
+
+/* Payload key and decimals of the min/max, the mean and variance get one more.
+   The water level is a switch, its mean is the share of samples that saw water and is enough. */
+static const struct {
+    const char* key;
+    int decimals;
+    bool mean_only;
+    //SENSOR_BIT_* the channel is read with
+    unsigned sensor;
+} channels[AGG_CHANNELS] = {
+#if CONFIG_SENSOR_PH
+    [AGG_PH] = {"ph", 1, false, SENSOR_BIT_PH},
+#endif
+#if CONFIG_SENSOR_INFILTRATION
+    [AGG_INFILTRATION] = {"inf", 0, false, SENSOR_BIT_INFILTRATION},
+#endif
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+    [AGG_INF_SLOPE] = {"isl", 1, true, SENSOR_BIT_INFILTRATION},
+    [AGG_INF_TTT] = {"itt", 0, true, SENSOR_BIT_INFILTRATION},
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+    [AGG_TEMP] = {"t", 0, false, SENSOR_BIT_HUM_TEMP},
+    [AGG_HUM] = {"h", 0, false, SENSOR_BIT_HUM_TEMP},
+#endif
+#if CONFIG_SENSOR_WATER_LEVEL
+    [AGG_WATER_LEVEL] = {"wl", 0, true, SENSOR_BIT_WATER_LEVEL},
+#endif
+};
+
+/* Channels count their own samples, a sensor left out of a wake (sensors_select) adds none */
+struct aggregate_stat {
+    int count;
+    float min;
+    float max;
+    float mean;
+    //Sum of squared differences from the mean (Welford)
+    float m2;
+};
+
+struct aggregate_window {
+    uint32_t magic;
+    int count;
+    struct aggregate_stat stat[AGG_CHANNELS];
+    //Means of the last registered window, the reference for the deadbands
+    float last[AGG_CHANNELS];
+    //Channels with a mean in last
+    uint32_t has_last;
+};
+
+static RTC_DATA_ATTR struct aggregate_window window;
+static bool alarm_seen;
+
+static void reading_values(const struct sensor_reading* reading, float* values)
+{
+#if CONFIG_SENSOR_PH
+    values[AGG_PH] = reading->ph;
+#endif
+#if CONFIG_SENSOR_INFILTRATION
+    values[AGG_INFILTRATION] = reading->infiltration;
+#endif
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+    values[AGG_INF_SLOPE] = reading->infiltration_slope;
+    values[AGG_INF_TTT] = reading->infiltration_ttt_ms;
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+    values[AGG_TEMP] = reading->temp;
+    values[AGG_HUM] = reading->hum;
+#endif
+#if CONFIG_SENSOR_WATER_LEVEL
+    values[AGG_WATER_LEVEL] = reading->water_level;
+#endif
+}
+
+static float deadband(int channel)
+{
+    switch (channel) {
+#if CONFIG_SENSOR_PH
+    case AGG_PH: return sensor_cfg.ph_deadband;
+#endif
+#if CONFIG_SENSOR_INFILTRATION
+    case AGG_INFILTRATION: return sensor_cfg.infiltration_deadband;
+#endif
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+    /* The curve features are only reported, the settling value above raises the alarms */
+    case AGG_INF_SLOPE:
+    case AGG_INF_TTT:
+        return INFINITY;
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+    case AGG_TEMP: return sensor_cfg.temp_deadband;
+    case AGG_HUM: return sensor_cfg.hum_deadband;
+#endif
+    default: return 0;
+    }
+}
+
+bool aggregate_add(const struct sensor_reading* reading)
+{
+    float values[AGG_CHANNELS];
+    bool alarm = false;
+
+    if (window.magic != AGGREGATE_MAGIC) {
+        memset(&window, 0, sizeof(window));
+        window.magic = AGGREGATE_MAGIC;
+    }
+
+    reading_values(reading, values);
+    window.count++;
+
+    for (int i = 0; i < AGG_CHANNELS; i++) {
+        struct aggregate_stat* stat = &window.stat[i];
+        float x = values[i];
+
+        if (!(reading->sensors & channels[i].sensor)) {
+            continue;
+        }
+        stat->count++;
+        if (stat->count == 1) {
+            stat->min = stat->max = stat->mean = x;
+            stat->m2 = 0;
+        } else {
+            if (x < stat->min) stat->min = x;
+            if (x > stat->max) stat->max = x;
+            float delta = x - stat->mean;
+            stat->mean += delta / stat->count;
+            stat->m2 += delta * (x - stat->mean);
+        }
+
+        if ((window.has_last & (1u << i)) && fabsf(x - window.last[i]) > deadband(i)) {
+            DLOGI("Channel %d out of its deadband", i);
+            alarm = true;
+        }
+    }
+
+    alarm_seen = alarm;
+    return alarm || counters_wb_readings() >= sensor_cfg.wb_reading;
+}
+
+bool aggregate_alarm(void)
+{
+    return alarm_seen;
+}
+
+int aggregate_count(void)
+{
+    return window.magic == AGGREGATE_MAGIC ? window.count : 0;
+}
+
+int aggregate_format(char* buf, size_t len)
+{
+    int n = 0;
+
+    for (int i = 0; i < AGG_CHANNELS && n < (int)len; i++) {
+        const struct aggregate_stat* stat = &window.stat[i];
+        int d = channels[i].decimals;
+
+        if (stat->count == 0) {
+            continue;
+        }
+        if (channels[i].mean_only) {
+            n += snprintf(buf + n, len - n, " %s=%.*f", channels[i].key, d + 1, stat->mean);
+        } else {
+            n += snprintf(buf + n, len - n, " %s=%.*f/%.*f/%.*f/%.*f", channels[i].key, d + 1, stat->mean,
+                            d, stat->min, d, stat->max, d + 1, stat->m2 / stat->count);
+        }
+    }
+    return n;
+}
+
+void aggregate_reset(void)
+{
+    if (aggregate_count() == 0) {
+        return;
+    }
+    for (int i = 0; i < AGG_CHANNELS; i++) {
+        if (window.stat[i].count > 0) {
+            window.last[i] = window.stat[i].mean;
+            window.has_last |= 1u << i;
+        }
+        window.stat[i].count = 0;
+    }
+    window.count = 0;
+}
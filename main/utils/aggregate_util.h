@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "sensor_util.h"
+
+/*
+ * The wakes between two registered readings (sensor_cfg.wb_reading) still sample the
+ * sensors. The samples are folded into a running min, max, mean and variance per sensor
+ * kept in RTC memory, and only one aggregate record per window is queued for uplink.
+ */
+
+/*
+ * @brief Add a reading to the current window
+ *
+ * @return true when the window is complete, because wb_reading wakes were counted
+ *         (counters_wake) or a sample moved further than its deadband from the last
+ *         registered mean.
+ */
+bool aggregate_add(const struct sensor_reading* reading);
+
+/* Whether the last aggregate_add() saw a sample out of its deadband */
+bool aggregate_alarm(void);
+
+/* Samples in the current window */
+int aggregate_count(void);
+
+/*
+ * Longest aggregate_format() output per channel, with the values in the range of their
+ * sensor: pH -9..99 (variance below 1000), infiltration 0..100 %, slope within
+ * +-9999 %/s, time to threshold up to 10000 ms, DHT11 -1..255.
+ */
+#if CONFIG_SENSOR_PH
+#define AGG_PH_FORMAT_MAX       26  //" ph=24.60/-7.7/24.6/256.00"
+#else
+#define AGG_PH_FORMAT_MAX       0
+#endif
+#if CONFIG_SENSOR_INFILTRATION
+#define AGG_INF_FORMAT_MAX      25  //" inf=100.0/100/100/2500.0"
+#else
+#define AGG_INF_FORMAT_MAX      0
+#endif
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+#define AGG_CAPTURE_FORMAT_MAX  25  //" isl=-9999.00 itt=10000.0"
+#else
+#define AGG_CAPTURE_FORMAT_MAX  0
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+#define AGG_HUM_TEMP_FORMAT_MAX 48  //" t=255.0/255/255/16384.0 h=255.0/255/255/16384.0"
+#else
+#define AGG_HUM_TEMP_FORMAT_MAX 0
+#endif
+#if CONFIG_SENSOR_WATER_LEVEL
+#define AGG_WL_FORMAT_MAX       7   //" wl=1.0"
+#else
+#define AGG_WL_FORMAT_MAX       0
+#endif
+
+#define AGGREGATE_FORMAT_MAX    (AGG_PH_FORMAT_MAX + AGG_INF_FORMAT_MAX + AGG_CAPTURE_FORMAT_MAX + \
+                                 AGG_HUM_TEMP_FORMAT_MAX + AGG_WL_FORMAT_MAX)
+
+/*
+ * @brief Append " key=mean/min/max/var" for every sensor sampled in the window (" wl=mean" for the water level)
+ *
+ * @return number of characters written, len or more when the output did not fit and was cut.
+ */
+int aggregate_format(char* buf, size_t len);
+
+/* Registers the window means as the alarm reference and starts a new window */
+void aggregate_reset(void);
@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "bleadv_proto.h"
+
+static void put_header(uint8_t* packet, int len, uint8_t flags, uint16_t seq, int index, int count)
+{
+    packet[0] = len - 1;
+    packet[1] = 0xff;
+    packet[2] = BLEADV_COMPANY_ID & 0xff;
+    packet[3] = BLEADV_COMPANY_ID >> 8;
+    packet[4] = BLEADV_MAGIC;
+    packet[5] = BLEADV_VERSION;
+    packet[6] = flags;
+    packet[7] = seq & 0xff;
+    packet[8] = seq >> 8;
+    packet[9] = index << 4 | count;
+}
+
+int bleadv_broadcast(const struct bleadv_ops* ops, uint16_t seq, const char* data, int packet_max, int repeats)
+{
+    uint8_t packet[BLEADV_PACKET_MAX];
+    uint8_t tag[BLEADV_TAG_LEN];
+    int len = strlen(data);
+    int tag_len = ops->tag != NULL ? BLEADV_TAG_LEN : 0;
+    uint8_t flags = tag_len > 0 ? BLEADV_FLAG_TAGGED : 0;
+
+    if (packet_max > BLEADV_PACKET_MAX) {
+        packet_max = BLEADV_PACKET_MAX;
+    }
+    int chunk_max = packet_max - BLEADV_HEADER_LEN;
+    if (chunk_max <= tag_len) {
+        return -1;
+    }
+    /* The tag only takes room from the last fragment */
+    int count = (len + tag_len + chunk_max - 1) / chunk_max;
+    if (count == 0) {
+        count = 1;
+    }
+    if (count > BLEADV_FRAGMENTS_MAX) {
+        return -1;
+    }
+    if (tag_len > 0) {
+        ops->tag(ops->ctx, seq, (const uint8_t*)data, len, tag);
+    }
+
+    int offset = 0;
+    for (int i = 0; i < count; i++) {
+        int chunk = len - offset < chunk_max ? len - offset : chunk_max;
+        int n = BLEADV_HEADER_LEN + chunk;
+
+        memcpy(packet + BLEADV_HEADER_LEN, data + offset, chunk);
+        offset += chunk;
+        if (i == count - 1) {
+            memcpy(packet + n, tag, tag_len);
+            n += tag_len;
+        }
+        put_header(packet, n, flags, seq, i, count);
+        if (ops->advertise(ops->ctx, packet, n, repeats) != 0) {
+            return -1;
+        }
+    }
+    return count;
+}
+
+bool bleadv_receive(struct bleadv_reassembly* r, const struct bleadv_ops* ops, const uint8_t* packet, int len,
+                    char* data, int data_size, bool* authentic)
+{
+    *authentic = false;
+    if (len < BLEADV_HEADER_LEN || len > BLEADV_PACKET_MAX || packet[0] != len - 1 || packet[1] != 0xff
+            || (packet[2] | packet[3] << 8) != BLEADV_COMPANY_ID || packet[4] != BLEADV_MAGIC
+            || packet[5] != BLEADV_VERSION) {
+        return false;
+    }
+    uint8_t flags = packet[6];
+    uint16_t seq = packet[7] | packet[8] << 8;
+    int index = packet[9] >> 4;
+    int count = packet[9] & 0x0f;
+    if (count == 0 || index >= count) {
+        return false;
+    }
+    if (r->has_last && seq == r->last_seq) {
+        return false;
+    }
+
+    if (!r->active || r->seq != seq || r->count != count || r->flags != flags) {
+        /* A new record, whatever was missing from the previous one is lost */
+        r->active = true;
+        r->seq = seq;
+        r->count = count;
+        r->flags = flags;
+        r->received = 0;
+    }
+    if (r->received & (1u << index)) {
+        return false;
+    }
+    r->len[index] = len - BLEADV_HEADER_LEN;
+    memcpy(r->chunk[index], packet + BLEADV_HEADER_LEN, r->len[index]);
+    r->received |= 1u << index;
+    if (r->received != (1u << count) - 1) {
+        return false;
+    }
+
+    int tag_len = flags & BLEADV_FLAG_TAGGED ? BLEADV_TAG_LEN : 0;
+    int total = -tag_len;
+    for (int i = 0; i < count; i++) {
+        total += r->len[i];
+    }
+    r->active = false;
+    if (total < 0 || total >= data_size) {
+        return false;
+    }
+
+    uint8_t tag[BLEADV_TAG_LEN];
+    int pos = 0;
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < r->len[i]; j++, pos++) {
+            if (pos < total) {
+                data[pos] = r->chunk[i][j];
+            } else {
+                tag[pos - total] = r->chunk[i][j];
+            }
+        }
+    }
+    data[total] = '\0';
+    r->has_last = true;
+    r->last_seq = seq;
+
+    if (tag_len > 0 && ops != NULL && ops->tag != NULL) {
+        uint8_t expected[BLEADV_TAG_LEN];
+        ops->tag(ops->ctx, seq, (const uint8_t*)data, total, expected);
+        *authentic = memcmp(tag, expected, BLEADV_TAG_LEN) == 0;
+    }
+    return true;
+}
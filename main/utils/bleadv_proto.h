@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Records broadcast in BLE extended advertising packets, no connection and no ack. Kept
+ * free of ESP-IDF calls, the controller is reached through struct bleadv_ops so
+ * tools/bleadv_mock.c runs the protocol on the host against a lossy mock listener.
+ *
+ * A record is split into fragments, each one the whole advertising data of a packet, a
+ * single manufacturer specific AD structure:
+ *
+ *     len 0xff company(le16) 'B' version flags seq(le16) index<<4|count chunk [tag]
+ *
+ * The authentication tag is only in the last fragment and covers the sequence number and
+ * the whole record. Each packet is advertised several times, the listener drops repeats
+ * by sequence number.
+ */
+
+//Espressif Systems, Bluetooth SIG company identifier
+#define BLEADV_COMPANY_ID       0x02e5
+#define BLEADV_MAGIC            'B'
+#define BLEADV_VERSION          1
+//AD length and type, company, magic, version, flags, seq and fragment
+#define BLEADV_HEADER_LEN       10
+#define BLEADV_TAG_LEN          8
+#define BLEADV_FRAGMENTS_MAX    15
+/* Advertising data of one packet, fits an AUX_ADV_IND on its own without AUX_CHAIN_IND */
+#define BLEADV_PACKET_MAX       240
+
+#define BLEADV_FLAG_TAGGED      0x01
+
+struct bleadv_ops {
+    /* Advertises one packet repeats times, returns 0 once the controller is done with it */
+    int (*advertise)(void* ctx, const uint8_t* packet, int len, int repeats);
+    /* Authentication tag over the sequence number and the record, NULL to broadcast untagged */
+    void (*tag)(void* ctx, uint16_t seq, const uint8_t* data, int len, uint8_t tag[BLEADV_TAG_LEN]);
+    void* ctx;
+};
+
+/* Listener side state of one node */
+struct bleadv_reassembly {
+    bool active;
+    uint16_t seq;
+    uint8_t count;
+    uint16_t received;
+    uint8_t flags;
+    uint8_t len[BLEADV_FRAGMENTS_MAX];
+    uint8_t chunk[BLEADV_FRAGMENTS_MAX][BLEADV_PACKET_MAX];
+    //Last record handed out, its repeats are dropped
+    bool has_last;
+    uint16_t last_seq;
+};
+
+/*
+ * @brief Split a record into packets of at most packet_max bytes and advertise them in order
+ *
+ * @return number of packets, -1 when the record does not fit BLEADV_FRAGMENTS_MAX packets
+ *         or the controller failed.
+ */
+int bleadv_broadcast(const struct bleadv_ops* ops, uint16_t seq, const char* data, int packet_max, int repeats);
+
+/*
+ * @brief Feed one received packet to the listener
+ *
+ * @param ops Only tag is used, to check the tag of tagged records.
+ * @param authentic Set when the record carried a tag and it matched.
+ *
+ * @return true when the packet completed a record not handed out yet, copied NUL terminated into data.
+ */
+bool bleadv_receive(struct bleadv_reassembly* r, const struct bleadv_ops* ops, const uint8_t* packet, int len,
+                    char* data, int data_size, bool* authentic);
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_random.h"
+#include "nvs_flash.h"
+#include "mbedtls/md.h"
+
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "host/ble_hs.h"
+
+#include "bleadv_util.h"
+#include "bleadv_proto.h"
+#include "dlog_util.h"
+#include "nvs_util.h"
+
+static const char *TAG = "BLEADV_UTIL";
+
+#define BLEADV_SEQ_MAGIC    0x424c5351
+#define BLEADV_INSTANCE     0
+//Longest wait for the host to sync with the controller
+#define BLEADV_SYNC_MS      1000
+//Slack on top of the advertising events of a packet before it counts as failed
+#define BLEADV_MARGIN_MS    200
+
+/* Fragments shrink to what the host lets an advertising set carry */
+#if defined(CONFIG_BT_NIMBLE_EXT_ADV_MAX_SIZE) && CONFIG_BT_NIMBLE_EXT_ADV_MAX_SIZE < BLEADV_PACKET_MAX
+#define BLEADV_NODE_PACKET_MAX  CONFIG_BT_NIMBLE_EXT_ADV_MAX_SIZE
+#else
+#define BLEADV_NODE_PACKET_MAX  BLEADV_PACKET_MAX
+#endif
+
+/* One sequence number per record, nothing is acked so it moves on with every broadcast */
+static RTC_DATA_ATTR struct {
+    uint32_t magic;
+    uint16_t seq;
+} node_state;
+
+static SemaphoreHandle_t synced;
+static StaticSemaphore_t synced_buf;
+static SemaphoreHandle_t adv_done;
+static StaticSemaphore_t adv_done_buf;
+
+static uint8_t key[BLEADV_KEY_LEN];
+static uint8_t own_mac[6];
+
+static void on_sync(void)
+{
+    xSemaphoreGive(synced);
+}
+
+static void on_reset(int reason)
+{
+    ESP_LOGW(TAG, "Host reset, reason %d", reason);
+}
+
+static int adv_event(struct ble_gap_event* event, void* arg)
+{
+    if (event->type == BLE_GAP_EVENT_ADV_COMPLETE) {
+        xSemaphoreGive(adv_done);
+    }
+    return 0;
+}
+
+static void host_task(void* param)
+{
+    /* Returns once nimble_port_stop() is called */
+    nimble_port_run();
+    nimble_port_freertos_deinit();
+}
+
+/* HMAC-SHA256 over the public address, the sequence number and the record */
+static void node_tag(void* ctx, uint16_t seq, const uint8_t* data, int len, uint8_t tag[BLEADV_TAG_LEN])
+{
+    uint8_t seq_le[2] = {seq & 0xff, seq >> 8};
+    uint8_t hmac[32];
+    mbedtls_md_context_t md;
+
+    mbedtls_md_init(&md);
+    mbedtls_md_setup(&md, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+    mbedtls_md_hmac_starts(&md, key, sizeof(key));
+    mbedtls_md_hmac_update(&md, own_mac, sizeof(own_mac));
+    mbedtls_md_hmac_update(&md, seq_le, sizeof(seq_le));
+    mbedtls_md_hmac_update(&md, data, len);
+    mbedtls_md_hmac_finish(&md, hmac);
+    mbedtls_md_free(&md);
+    memcpy(tag, hmac, BLEADV_TAG_LEN);
+}
+
+static int node_advertise(void* ctx, const uint8_t* packet, int len, int repeats)
+{
+    struct os_mbuf* data = os_msys_get_pkthdr(len, 0);
+
+    if (data == NULL) {
+        return -1;
+    }
+    if (os_mbuf_append(data, packet, len) != 0) {
+        os_mbuf_free_chain(data);
+        return -1;
+    }
+    /* Takes the mbuf, also when it fails */
+    int rc = ble_gap_ext_adv_set_data(BLEADV_INSTANCE, data);
+    if (rc == 0) {
+        xSemaphoreTake(adv_done, 0);
+        rc = ble_gap_ext_adv_start(BLEADV_INSTANCE, 0, repeats);
+    }
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Advertising failed: %d", rc);
+        return -1;
+    }
+
+    int wait_ms = repeats * CONFIG_BLE_ADV_INTERVAL_MS + BLEADV_MARGIN_MS;
+    if (xSemaphoreTake(adv_done, pdMS_TO_TICKS(wait_ms)) != pdTRUE) {
+        ble_gap_ext_adv_stop(BLEADV_INSTANCE);
+        return -1;
+    }
+    return 0;
+}
+
+static struct bleadv_ops node_ops = {
+    .advertise = node_advertise,
+};
+
+esp_err_t bleadv_pair(const uint8_t* data, int len)
+{
+    char text[48];
+    uint8_t k[BLEADV_KEY_LEN];
+
+    if (len <= 0 || len >= (int)sizeof(text)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    memcpy(text, data, len);
+    text[len] = '\0';
+    if (strncmp(text, "bleadv ", 7) != 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    const char* hex = text + 7;
+    bool remove = strcmp(hex, "none") == 0;
+    if (!remove) {
+        if (strlen(hex) != 2 * BLEADV_KEY_LEN || strspn(hex, "0123456789abcdefABCDEF") != 2 * BLEADV_KEY_LEN) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        for (int i = 0; i < BLEADV_KEY_LEN; i++) {
+            unsigned int byte;
+            sscanf(hex + 2 * i, "%2x", &byte);
+            k[i] = byte;
+        }
+    }
+
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    if (remove) {
+        err = nvs_erase_key(my_handle, BLEADV_KEY_KEY);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    } else {
+        err = nvs_set_blob(my_handle, BLEADV_KEY_KEY, k, sizeof(k));
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(my_handle);
+    }
+    nvs_close(my_handle);
+
+    ESP_LOGI(TAG, "Advertising key %s", remove ? "removed" : "saved");
+    return err;
+}
+
+static esp_err_t load_key(void)
+{
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    size_t required_size = sizeof(key);
+    err = nvs_get_blob(my_handle, BLEADV_KEY_KEY, key, &required_size);
+    nvs_close(my_handle);
+    return err;
+}
+
+bool bleadv_start(void)
+{
+    if (node_state.magic != BLEADV_SEQ_MAGIC) {
+        /* A node that lost RTC memory starts elsewhere in the sequence space than where the listener last saw it */
+        node_state.magic = BLEADV_SEQ_MAGIC;
+        node_state.seq = esp_random();
+    }
+    node_ops.tag = load_key() == ESP_OK ? node_tag : NULL;
+    esp_read_mac(own_mac, ESP_MAC_BT);
+
+    if (synced == NULL) {
+        synced = xSemaphoreCreateBinaryStatic(&synced_buf);
+        adv_done = xSemaphoreCreateBinaryStatic(&adv_done_buf);
+    }
+    esp_err_t err = nimble_port_init();
+    if (err != ESP_OK) {
+        DLOGW("NimBLE init failed: %d", err);
+        return false;
+    }
+    ble_hs_cfg.sync_cb = on_sync;
+    ble_hs_cfg.reset_cb = on_reset;
+    nimble_port_freertos_init(host_task);
+    if (xSemaphoreTake(synced, pdMS_TO_TICKS(BLEADV_SYNC_MS)) != pdTRUE) {
+        DLOGW("BLE host did not sync");
+        bleadv_stop();
+        return false;
+    }
+
+    /* Non-connectable and non-scannable, a listener only has to scan */
+    struct ble_gap_ext_adv_params params;
+    memset(&params, 0, sizeof(params));
+    params.own_addr_type = BLE_OWN_ADDR_PUBLIC;
+    params.primary_phy = BLE_HCI_LE_PHY_1M;
+    params.secondary_phy = BLE_HCI_LE_PHY_1M;
+    params.itvl_min = BLE_GAP_ADV_ITVL_MS(CONFIG_BLE_ADV_INTERVAL_MS);
+    params.itvl_max = params.itvl_min;
+    //No preference, the controller default
+    params.tx_power = 127;
+    params.sid = BLEADV_INSTANCE;
+    int rc = ble_gap_ext_adv_configure(BLEADV_INSTANCE, &params, NULL, adv_event, NULL);
+    if (rc != 0) {
+        DLOGW("Advertising set not configured: %d", rc);
+        bleadv_stop();
+        return false;
+    }
+    return true;
+}
+
+void bleadv_stop(void)
+{
+    if (nimble_port_stop() == 0) {
+        nimble_port_deinit();
+    }
+}
+
+int bleadv_send_data(const char* topic, const char* data)
+{
+    int packets = bleadv_broadcast(&node_ops, node_state.seq, data, BLEADV_NODE_PACKET_MAX, CONFIG_BLE_ADV_REPEATS);
+    if (packets < 0) {
+        DLOGW("Record %d not advertised", node_state.seq);
+        return -1;
+    }
+    if (packets > 1) {
+        ESP_LOGI(TAG, "Record %d advertised in %d packets", node_state.seq, packets);
+    }
+    return node_state.seq++;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+//NVS key of the authentication key
+#define BLEADV_KEY_KEY          "bleadv_key"
+#define BLEADV_KEY_LEN          16
+
+/*
+ * @brief Save the key sent as BluFi custom data: "bleadv <32 hex digits>"
+ *
+ * Records are tagged with a truncated HMAC-SHA256 once a key is saved, "bleadv none"
+ * removes it and they go out untagged again.
+ *
+ * @return ESP_ERR_NOT_SUPPORTED when the data is not a BLE advertising key.
+ */
+esp_err_t bleadv_pair(const uint8_t* data, int len);
+
+/* Brings up the controller and the NimBLE host and configures a non-connectable advertising set */
+bool bleadv_start(void);
+void bleadv_stop(void);
+
+/* Same contract as mqtt_send_data, the topic is not broadcast. Returns the sequence number once advertised, or -1 */
+int bleadv_send_data(const char* topic, const char* data);
@@ -1,6 +1,7 @@
 
 
 #include <stdio.h>
+#include <string.h>
 #include "esp_err.h"
 #include "esp_blufi_api.h"
 #include "esp_log.h"
@@ -20,6 +21,13 @@
 #include "blufi_util.h"
 #include "wifi_util.h"
 #include "nvs_util.h"
+#include "ota_util.h"
+#if CONFIG_UPLINK_TRANSPORT_ESPNOW
+#include "espnow_util.h"
+#endif
+#if CONFIG_UPLINK_TRANSPORT_BLE_ADV
+#include "bleadv_util.h"
+#endif
 
 #define WIFI_LIST_NUM   10 //Is this used anywhere?
 
@@ -141,6 +149,31 @@ static void blufi_event_callback(esp_blufi_cb_event_t event, esp_blufi_cb_param_
     case ESP_BLUFI_EVENT_RECV_CUSTOM_DATA:
         BLUFI_INFO("Recv Custom Data %" PRIu32 "\n", param->custom_data.data_len);
         esp_log_buffer_hex("Custom Data", param->custom_data.data, param->custom_data.data_len);
+        {
+            esp_err_t ota_err = ota_pair(param->custom_data.data, param->custom_data.data_len);
+            if (ota_err != ESP_ERR_NOT_SUPPORTED) {
+                const char* reply = ota_err == ESP_OK ? "ota keyed" : "ota rejected";
+                esp_blufi_send_custom_data((uint8_t*)reply, strlen(reply));
+            }
+        }
+#if CONFIG_UPLINK_TRANSPORT_ESPNOW
+        {
+            esp_err_t pair_err = espnow_pair(param->custom_data.data, param->custom_data.data_len);
+            if (pair_err != ESP_ERR_NOT_SUPPORTED) {
+                const char* reply = pair_err == ESP_OK ? "espnow paired" : "espnow rejected";
+                esp_blufi_send_custom_data((uint8_t*)reply, strlen(reply));
+            }
+        }
+#endif
+#if CONFIG_UPLINK_TRANSPORT_BLE_ADV
+        {
+            esp_err_t key_err = bleadv_pair(param->custom_data.data, param->custom_data.data_len);
+            if (key_err != ESP_ERR_NOT_SUPPORTED) {
+                const char* reply = key_err == ESP_OK ? "bleadv keyed" : "bleadv rejected";
+                esp_blufi_send_custom_data((uint8_t*)reply, strlen(reply));
+            }
+        }
+#endif
         break;
 	case ESP_BLUFI_EVENT_RECV_USERNAME:
         /* Not handle currently */
@@ -19,6 +19,14 @@
 #include "mbedtls/dhm.h"
 #include "mbedtls/md5.h"
 #include "esp_crc.h"
+#include "esp_timer.h"
+
+/* With CONFIG_MBEDTLS_HARDWARE_AES mbedtls runs AES on the accelerator */
+#if CONFIG_MBEDTLS_HARDWARE_AES
+#define BLUFI_AES_IMPL      "hardware"
+#else
+#define BLUFI_AES_IMPL      "software"
+#endif
 
 /*
    The SEC_TYPE_xxx is for self-defined packet data type in the procedure of "BLUFI negotiate key"
@@ -49,6 +57,31 @@ struct blufi_security {
 };
 static struct blufi_security *blufi_sec;
 
+#if CONFIG_STATIC_ALLOCATION
+//Length fields plus p, g and the public key of the phone, same group size as ours
+#define BLUFI_DH_PARAM_MAX  (3 * (2 + DH_SELF_PUB_KEY_LEN))
+
+static struct blufi_security blufi_sec_storage;
+static uint8_t dh_param_storage[BLUFI_DH_PARAM_MAX];
+#endif
+
+static uint8_t* dh_param_alloc(int len)
+{
+#if CONFIG_STATIC_ALLOCATION
+    return len <= (int)sizeof(dh_param_storage) ? dh_param_storage : NULL;
+#else
+    return (uint8_t *)malloc(len);
+#endif
+}
+
+static void dh_param_free(void)
+{
+#if !CONFIG_STATIC_ALLOCATION
+    free(blufi_sec->dh_param);
+#endif
+    blufi_sec->dh_param = NULL;
+}
+
 static int myrand( void *rng_state, unsigned char *output, size_t len )
 {
     esp_fill_random(output, len);
@@ -72,10 +105,9 @@ void blufi_dh_negotiate_data_handler(uint8_t *data, int len, uint8_t **output_da
     case SEC_TYPE_DH_PARAM_LEN:
         blufi_sec->dh_param_len = ((data[1]<<8)|data[2]);
         if (blufi_sec->dh_param) {
-            free(blufi_sec->dh_param);
-            blufi_sec->dh_param = NULL;
+            dh_param_free();
         }
-        blufi_sec->dh_param = (uint8_t *)malloc(blufi_sec->dh_param_len);
+        blufi_sec->dh_param = dh_param_alloc(blufi_sec->dh_param_len);
         if (blufi_sec->dh_param == NULL) {
             btc_blufi_report_error(ESP_BLUFI_DH_MALLOC_ERROR);
             BLUFI_ERROR("%s, malloc failed\n", __func__);
@@ -96,8 +128,7 @@ void blufi_dh_negotiate_data_handler(uint8_t *data, int len, uint8_t **output_da
             btc_blufi_report_error(ESP_BLUFI_READ_PARAM_ERROR);
             return;
         }
-        free(blufi_sec->dh_param);
-        blufi_sec->dh_param = NULL;
+        dh_param_free();
 
         const int dhm_len = mbedtls_dhm_get_len(&blufi_sec->dhm);
         err = mbedtls_dhm_make_public(&blufi_sec->dhm, dhm_len, blufi_sec->self_public_key, dhm_len, myrand, NULL);
@@ -144,52 +175,106 @@ void blufi_dh_negotiate_data_handler(uint8_t *data, int len, uint8_t **output_da
     }
 }
 
-int blufi_aes_encrypt(uint8_t iv8, uint8_t *crypt_data, int crypt_len)
+/*
+   The key is set once per connection when the DH negotiation ends. The IV is all zeros
+   except for its first byte, the sequence number, so only that byte changes per frame.
+ */
+static int blufi_aes_crypt(int mode, uint8_t iv8, uint8_t *crypt_data, int crypt_len)
 {
-    int err;
     size_t iv_offset = 0;
     uint8_t iv0[16];
 
     memcpy(iv0, blufi_sec->iv, sizeof(blufi_sec->iv));
     iv0[0] = iv8;   /* set iv8 as the iv0[0] */
 
-    err = mbedtls_aes_crypt_cfb128(&blufi_sec->aes, MBEDTLS_AES_ENCRYPT, crypt_len, &iv_offset, iv0, crypt_data, crypt_data);
-    if (err) {
+    if (mbedtls_aes_crypt_cfb128(&blufi_sec->aes, mode, crypt_len, &iv_offset, iv0, crypt_data, crypt_data)) {
         return -1;
     }
 
     return crypt_len;
 }
 
+int blufi_aes_encrypt(uint8_t iv8, uint8_t *crypt_data, int crypt_len)
+{
+    return blufi_aes_crypt(MBEDTLS_AES_ENCRYPT, iv8, crypt_data, crypt_len);
+}
+
 int blufi_aes_decrypt(uint8_t iv8, uint8_t *crypt_data, int crypt_len)
 {
-    int err;
-    size_t iv_offset = 0;
-    uint8_t iv0[16];
+    return blufi_aes_crypt(MBEDTLS_AES_DECRYPT, iv8, crypt_data, crypt_len);
+}
 
-    memcpy(iv0, blufi_sec->iv, sizeof(blufi_sec->iv));
-    iv0[0] = iv8;   /* set iv8 as the iv0[0] */
+uint16_t blufi_crc_checksum(uint8_t iv8, uint8_t *data, int len)
+{
+    /* This iv8 ignore, not used. esp_crc16_be runs the table driven CRC in ROM */
+    return esp_crc16_be(0, data, len);
+}
 
-    err = mbedtls_aes_crypt_cfb128(&blufi_sec->aes, MBEDTLS_AES_DECRYPT, crypt_len, &iv_offset, iv0, crypt_data, crypt_data);
-    if (err) {
-        return -1;
-    }
+#if CONFIG_BLUFI_CRYPTO_BENCHMARK
+/* Frame payloads from a short command up to a fragment filling the largest BLE MTU */
+static const int bench_frame_sizes[] = {16, 64, 128, 244, 512};
+#define BENCH_FRAME_COUNT   (sizeof(bench_frame_sizes) / sizeof(bench_frame_sizes[0]))
+#define BENCH_MAX_FRAME     512
+#define BENCH_ROUNDS        500
 
-    return crypt_len;
+static void bench_report(const char *op, int frame_len, int64_t elapsed_us)
+{
+    int64_t ns_per_frame = elapsed_us * 1000 / BENCH_ROUNDS;
+    int64_t kbytes_per_s = elapsed_us > 0 ? (int64_t)frame_len * BENCH_ROUNDS * 1000 / elapsed_us : 0;
+    printf("BLUFI_BENCH %s %d %lld %lld\n", op, frame_len, ns_per_frame, kbytes_per_s);
 }
 
-uint16_t blufi_crc_checksum(uint8_t iv8, uint8_t *data, int len)
+/* Uses its own security context, run it before BluFi starts */
+void blufi_crypto_benchmark(void)
 {
-    /* This iv8 ignore, not used */
-    return esp_crc16_be(0, data, len);
+    static uint8_t frame[BENCH_MAX_FRAME];
+    uint16_t crc = 0;
+
+    if (blufi_security_init() != ESP_OK) {
+        return;
+    }
+    esp_fill_random(blufi_sec->psk, PSK_LEN);
+    esp_fill_random(frame, sizeof(frame));
+    mbedtls_aes_setkey_enc(&blufi_sec->aes, blufi_sec->psk, 128);
+
+    printf("BLUFI_BENCH op frame_bytes ns_per_frame kB_per_s (" BLUFI_AES_IMPL " AES)\n");
+    for (int i = 0; i < (int)BENCH_FRAME_COUNT; i++) {
+        int len = bench_frame_sizes[i];
+        int64_t start = esp_timer_get_time();
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            blufi_aes_encrypt(r, frame, len);
+        }
+        bench_report("encrypt", len, esp_timer_get_time() - start);
+
+        start = esp_timer_get_time();
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            blufi_aes_decrypt(r, frame, len);
+        }
+        bench_report("decrypt", len, esp_timer_get_time() - start);
+
+        start = esp_timer_get_time();
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            crc ^= blufi_crc_checksum(r, frame, len);
+        }
+        bench_report("crc16", len, esp_timer_get_time() - start);
+    }
+
+    blufi_security_deinit();
+    /* Keeps the CRC loop from being optimized away */
+    BLUFI_INFO("Benchmark done %04x", crc);
 }
+#endif
 
 esp_err_t blufi_security_init(void)
 {
+#if CONFIG_STATIC_ALLOCATION
+    blufi_sec = &blufi_sec_storage;
+#else
     blufi_sec = (struct blufi_security *)malloc(sizeof(struct blufi_security));
     if (blufi_sec == NULL) {
         return ESP_FAIL;
     }
+#endif
 
     memset(blufi_sec, 0x0, sizeof(struct blufi_security));
 
@@ -206,14 +291,15 @@ void blufi_security_deinit(void)
         return;
     }
     if (blufi_sec->dh_param){
-        free(blufi_sec->dh_param);
-        blufi_sec->dh_param = NULL;
+        dh_param_free();
     }
     mbedtls_dhm_free(&blufi_sec->dhm);
     mbedtls_aes_free(&blufi_sec->aes);
 
     memset(blufi_sec, 0x0, sizeof(struct blufi_security));
 
+#if !CONFIG_STATIC_ALLOCATION
     free(blufi_sec);
+#endif
     blufi_sec =  NULL;
 }
@@ -1,7 +1,10 @@
 #pragma once
 
+#include "sdkconfig.h"
 #include "esp_wifi_types.h"
+#if CONFIG_BT_ENABLED
 #include "esp_blufi_api.h"
+#endif
 
 #define BLUFI_TAG "BLUFI"
 #define BLUFI_INFO(fmt, ...)   ESP_LOGI(BLUFI_TAG, fmt, ##__VA_ARGS__)
@@ -17,13 +20,17 @@ struct wifi_info
     int sta_ssid_len;
     wifi_sta_list_t sta_list;
     bool sta_is_connecting;
+#if CONFIG_BT_ENABLED
     esp_blufi_extra_info_t sta_conn_info;
+#endif
 };
 
 void blufi_dh_negotiate_data_handler(uint8_t *data, int len, uint8_t **output_data, int *output_len, bool *need_free);
 int blufi_aes_encrypt(uint8_t iv8, uint8_t *crypt_data, int crypt_len);
 int blufi_aes_decrypt(uint8_t iv8, uint8_t *crypt_data, int crypt_len);
 uint16_t blufi_crc_checksum(uint8_t iv8, uint8_t *data, int len);
+/* Prints "BLUFI_BENCH <op> <frame bytes> <ns per frame> <kB/s>" lines, compare with tools/blufi_bench.c */
+void blufi_crypto_benchmark(void);
 
 int blufi_security_init(void);
 void blufi_security_deinit(void);
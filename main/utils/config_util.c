@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "config_util.h"
+#include "nvs_util.h"
+
+static const char *TAG = "CONFIG_UTIL";
+
+#define CONFIG_UPDATE_MAX_LEN   256
+
+struct sensor_config sensor_cfg;
+
+/* A configuration is in NVS, set by the load and by every accepted update */
+static bool config_saved;
+
+/* Updates are written by the MQTT task while the encoder may be reading the deadbands */
+static SemaphoreHandle_t config_lock;
+static StaticSemaphore_t config_lock_buf;
+
+void sensor_config_default(struct sensor_config* sensor)
+{
+    memset(sensor, 0, sizeof(struct sensor_config));
+    sensor->readings = 24;
+    sensor->wb_reading = 1;
+    sensor->sleep_interval = 20;
+    sensor->ph_deadband = 0.5;
+    sensor->temp_deadband = 2;
+    sensor->hum_deadband = 10;
+    sensor->infiltration_deadband = 10;
+    sensor->batch_low = 4;
+    sensor->batch_high = MAX_SAVED_READINGS;
+    sensor->diag_interval = 24;
+}
+
+void sensor_config_lock(void)
+{
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+}
+
+void sensor_config_unlock(void)
+{
+    xSemaphoreGive(config_lock);
+}
+
+esp_err_t sensor_config_load(struct sensor_config* sensor)
+{
+    if (config_lock == NULL) {
+        config_lock = xSemaphoreCreateMutexStatic(&config_lock_buf);
+    }
+    /* Start from the defaults, they stay when no blob was saved and for fields an older blob lacks */
+    sensor_config_default(sensor);
+
+    esp_err_t err = get_saved_config(sensor);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Using default configuration (%s)", esp_err_to_name(err));
+    }
+    config_saved = err == ESP_OK;
+    return err;
+}
+
+bool sensor_config_saved(void)
+{
+    return config_saved;
+}
+
+esp_err_t sensor_config_persist(const struct sensor_config* sensor)
+{
+    if (config_saved) {
+        return ESP_OK;
+    }
+    sensor_config_lock();
+    struct sensor_config copy = *sensor;
+    sensor_config_unlock();
+    esp_err_t err = set_saved_config(&copy);
+    config_saved = err == ESP_OK;
+    return err;
+}
+
+static bool parse_int(const char* value, int min, int max, int* out)
+{
+    char* end;
+    long v = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || v < min || v > max) {
+        return false;
+    }
+    *out = (int)v;
+    return true;
+}
+
+static bool parse_float(const char* value, float min, float max, float* out)
+{
+    char* end;
+    float v = strtof(value, &end);
+    if (end == value || *end != '\0' || v < min || v > max) {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+static bool apply_key(struct sensor_config* sensor, const char* key, const char* value)
+{
+    if (strcmp(key, "sleep") == 0) {
+        return parse_int(value, 10, 86400, &sensor->sleep_interval);
+    } else if (strcmp(key, "readings") == 0) {
+        return parse_int(value, 1, 288, &sensor->readings);
+    } else if (strcmp(key, "wb") == 0) {
+        return parse_int(value, 1, 100, &sensor->wb_reading);
+    } else if (strcmp(key, "ph_db") == 0) {
+        return parse_float(value, 0, 14, &sensor->ph_deadband);
+    } else if (strcmp(key, "temp_db") == 0) {
+        return parse_int(value, 0, 100, &sensor->temp_deadband);
+    } else if (strcmp(key, "hum_db") == 0) {
+        return parse_int(value, 0, 100, &sensor->hum_deadband);
+    } else if (strcmp(key, "inf_db") == 0) {
+        return parse_int(value, 0, 100, &sensor->infiltration_deadband);
+    } else if (strcmp(key, "batch_low") == 0) {
+        return parse_int(value, 1, MAX_SAVED_READINGS, &sensor->batch_low);
+    } else if (strcmp(key, "batch_high") == 0) {
+        return parse_int(value, 1, MAX_SAVED_READINGS, &sensor->batch_high);
+    } else if (strcmp(key, "diag") == 0) {
+        return parse_int(value, 0, 10000, &sensor->diag_interval);
+    }
+    return false;
+}
+
+esp_err_t sensor_config_apply(struct sensor_config* sensor, const char* data, int len, char* status, size_t status_len)
+{
+    char buf[CONFIG_UPDATE_MAX_LEN];
+    const char* id = "-";
+
+    if (len <= 0 || len >= sizeof(buf)) {
+        snprintf(status, status_len, "config rejected length");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+
+    struct sensor_config update = *sensor;
+    char* save_ptr;
+
+    for (char* token = strtok_r(buf, " \r\n", &save_ptr); token != NULL; token = strtok_r(NULL, " \r\n", &save_ptr)) {
+        char* value = strchr(token, '=');
+        if (value == NULL) {
+            snprintf(status, status_len, "config %s rejected %s", id, token);
+            return ESP_ERR_INVALID_ARG;
+        }
+        *value++ = '\0';
+
+        /* The id is only echoed back so the backend can match acks to updates */
+        if (strcmp(token, "id") == 0) {
+            id = value;
+            continue;
+        }
+        if (!apply_key(&update, token, value)) {
+            snprintf(status, status_len, "config %s rejected %s", id, token);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    if (update.batch_low > update.batch_high) {
+        snprintf(status, status_len, "config %s rejected batch_low", id);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Retained updates are delivered on every connect, skip the flash write when nothing changed
+       and the configuration is already saved */
+    if (config_saved && memcmp(&update, sensor, sizeof(struct sensor_config)) == 0) {
+        snprintf(status, status_len, "config %s unchanged", id);
+        return ESP_OK;
+    }
+
+    esp_err_t err = set_saved_config(&update);
+    if (err != ESP_OK) {
+        snprintf(status, status_len, "config %s failed %s", id, esp_err_to_name(err));
+        return err;
+    }
+
+    config_saved = true;
+    sensor_config_lock();
+    *sensor = update;
+    sensor_config_unlock();
+    snprintf(status, status_len, "config %s applied", id);
+    ESP_LOGI(TAG, "sleep=%d readings=%d wb=%d batch=%d/%d", sensor->sleep_interval, sensor->readings,
+                sensor->wb_reading, sensor->batch_low, sensor->batch_high);
+    return ESP_OK;
+}
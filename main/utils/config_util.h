@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "nvs_util.h"
+
+/* Live sensor configuration, loaded at boot and updated from the MQTT config topic */
+extern struct sensor_config sensor_cfg;
+
+void sensor_config_default(struct sensor_config* sensor);
+esp_err_t sensor_config_load(struct sensor_config* sensor);
+
+/* Held around reads that need one consistent configuration while an update can land, from sensor_config_load() on */
+void sensor_config_lock(void);
+void sensor_config_unlock(void);
+
+/* True once a configuration is in NVS, the uplink only waits for the retained one until then */
+bool sensor_config_saved(void);
+/* Saves sensor unless a configuration is saved already, for nodes the broker has nothing for */
+esp_err_t sensor_config_persist(const struct sensor_config* sensor);
+
+/*
+ * @brief Apply a "key=value key=value" update to the sensor configuration
+ *
+ *  Every key is parsed and validated on a copy first, the copy is only saved
+ *  to NVS and written back to sensor if the whole update is valid.
+ *
+ * @param sensor Configuration to update.
+ * @param data Update payload, not null terminated.
+ * @param len Length of the update payload.
+ * @param status Buffer for the status message acked to the broker.
+ * @param status_len Size of the status buffer.
+ */
+esp_err_t sensor_config_apply(struct sensor_config* sensor, const char* data, int len, char* status, size_t status_len);
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_rom_crc.h"
+#include "nvs_flash.h"
+
+#include "counter_util.h"
+#include "config_util.h"
+#include "nvs_util.h"
+
+static const char *TAG = "COUNTER_UTIL";
+
+struct wake_counters {
+    //Readings registered on this day
+    int current_readings;
+    //Wakes since the last registered reading
+    int current_wb_readings;
+    //Wakes since the last checkpoint, not saved
+    int since_checkpoint;
+    uint32_t crc;
+};
+
+static RTC_DATA_ATTR struct wake_counters counters;
+
+static uint32_t counters_crc(const struct wake_counters* c)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)c, offsetof(struct wake_counters, crc));
+}
+
+static void seal(void)
+{
+    counters.crc = counters_crc(&counters);
+}
+
+static esp_err_t load_counters(struct wake_counters* c)
+{
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    size_t required_size = sizeof(struct wake_counters);
+    err = nvs_get_blob(my_handle, "wake_cnt", c, &required_size);
+    nvs_close(my_handle);
+
+    if (err == ESP_OK && (required_size != sizeof(struct wake_counters) || c->crc != counters_crc(c))) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    return err;
+}
+
+static void checkpoint_on_shutdown(void)
+{
+    counters_checkpoint();
+}
+
+void counters_init(void)
+{
+    if (counters.crc == counters_crc(&counters)) {
+        /* A brownout may be followed by a real power loss, save while RTC memory is still good */
+        if (esp_reset_reason() == ESP_RST_BROWNOUT) {
+            counters_checkpoint();
+        }
+    } else {
+        /* RTC memory was lost or corrupted, go back to the last checkpoint */
+        esp_err_t err = load_counters(&counters);
+        if (err != ESP_OK) {
+            memset(&counters, 0, sizeof(counters));
+        }
+        counters.since_checkpoint = 0;
+        seal();
+        ESP_LOGI(TAG, "Counters %s: %d readings, %d wakes", err == ESP_OK ? "restored" : "reset",
+                    counters.current_readings, counters.current_wb_readings);
+    }
+
+    esp_register_shutdown_handler(checkpoint_on_shutdown);
+}
+
+void counters_wake(void)
+{
+    counters.current_wb_readings++;
+    counters.since_checkpoint++;
+    seal();
+
+    if (counters.since_checkpoint >= COUNTERS_CHECKPOINT_CYCLES) {
+        counters_checkpoint();
+    }
+}
+
+void counters_reading(void)
+{
+    counters.current_wb_readings = 0;
+    counters.current_readings++;
+    /* A new day starts once the configured readings are done */
+    if (counters.current_readings >= sensor_cfg.readings) {
+        counters.current_readings = 0;
+    }
+    seal();
+}
+
+int counters_wb_readings(void)
+{
+    return counters.current_wb_readings;
+}
+
+int counters_readings(void)
+{
+    return counters.current_readings;
+}
+
+esp_err_t counters_checkpoint(void)
+{
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    counters.since_checkpoint = 0;
+    seal();
+    err = nvs_set_blob(my_handle, "wake_cnt", &counters, sizeof(struct wake_counters));
+    if (err == ESP_OK) {
+        err = nvs_commit(my_handle);
+    }
+    nvs_close(my_handle);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Checkpoint failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
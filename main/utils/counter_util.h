@@ -0,0 +1,25 @@
+#pragma once
+
+#include "esp_err.h"
+
+/* Wake cycles between two checkpoints of the counters to NVS */
+#define COUNTERS_CHECKPOINT_CYCLES  32
+
+/*
+ * The per-wake counters (readings done today, wakes since the last registered reading)
+ * live in RTC memory behind a CRC. NVS only gets a checkpoint every
+ * COUNTERS_CHECKPOINT_CYCLES wakes, before a restart or after a brownout, and the
+ * checkpoint is restored after a power on reset.
+ */
+void counters_init(void);
+
+/* Counts a wake, checkpoints when one is due */
+void counters_wake(void);
+
+/* A reading was registered, starts a new window */
+void counters_reading(void);
+
+int counters_wb_readings(void);
+int counters_readings(void);
+
+esp_err_t counters_checkpoint(void);
@@ -22,7 +22,10 @@
  * SOFTWARE.
 */
 
+#include "sdkconfig.h"
 #include "esp_timer.h"
+#include "esp_pm.h"
+#include "esp_err.h"
 #include "driver/gpio.h"
 #include "rom/ets_sys.h"
 #include "freertos/FreeRTOS.h"
@@ -34,6 +37,23 @@ static gpio_num_t dht_gpio;
 static int64_t last_read_time = -2000000;
 static struct dht11_reading last_read;
 
+static int64_t power_on_time;
+static int64_t settle_time;
+/* Created on the first background read and kept, it waits for a notification between reads */
+static TaskHandle_t read_task;
+static StaticTask_t read_task_tcb;
+static StackType_t read_task_stack[DHT11_TASK_STACK_SIZE];
+static volatile bool read_busy;
+static dht11_callback_t read_callback;
+static void *read_arg;
+
+#if CONFIG_PM_ENABLE
+/* Light sleep in the middle of the bit timing would corrupt the read */
+static esp_pm_lock_handle_t pm_lock;
+/* Bits are decoded by counting ets_delay_us loops, a frequency switch during the read skews them */
+static esp_pm_lock_handle_t cpu_lock;
+#endif
+
 static int _waitOrTimeout(uint16_t microSeconds, int level) {
     int micros_ticks = 0;
     while(gpio_get_level(dht_gpio) == level) { 
@@ -82,32 +102,39 @@ static struct dht11_reading _crcError() {
     return crcError;
 }
 
-void DHT11_init(gpio_num_t gpio_num) {
-    /* Wait 1 seconds to make the device pass its initial unstable status */
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
+void DHT11_init(gpio_num_t gpio_num, uint32_t settle_ms) {
+    /* The device needs settle_ms after power on to pass its initial unstable status,
+       reads wait only for what is left of it */
+    power_on_time = esp_timer_get_time();
+    settle_time = (int64_t)settle_ms * 1000;
     dht_gpio = gpio_num;
+#if CONFIG_PM_ENABLE
+    if(pm_lock == NULL)
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "dht11", &pm_lock));
+    if(cpu_lock == NULL)
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "dht11_cpu", &cpu_lock));
+#endif
 }
 
-struct dht11_reading DHT11_read() {
-    /* Tried to sense too son since last read (dht11 needs ~2 seconds to make a new read) */
-    if(esp_timer_get_time() - 2000000 < last_read_time) {
-        return last_read;
-    }
-
-    last_read_time = esp_timer_get_time();
+static void _waitSettled() {
+    int64_t remaining = settle_time - (esp_timer_get_time() - power_on_time);
+    if(remaining > 0)
+        vTaskDelay(remaining / 1000 / portTICK_PERIOD_MS + 1);
+}
 
+static struct dht11_reading _readBits() {
     uint8_t data[5] = {0,0,0,0,0};
 
     _sendStartSignal();
 
     if(_checkResponse() == DHT11_TIMEOUT_ERROR)
-        return last_read = _timeoutError();
+        return _timeoutError();
     
     /* Read response */
     for(int i = 0; i < 40; i++) {
         /* Initial data */
         if(_waitOrTimeout(60, 0) == DHT11_TIMEOUT_ERROR)
-            return last_read = _timeoutError();
+            return _timeoutError();
                 
         if(_waitOrTimeout(75, 1) > 28) {
             /* Bit received was a 1 */
@@ -116,11 +143,75 @@ struct dht11_reading DHT11_read() {
     }
 
     if(_checkCRC(data) != DHT11_CRC_ERROR) {
-        last_read.status = DHT11_OK;
-        last_read.temperature = data[2];
-        last_read.humidity = data[0];
-        return last_read;
+        struct dht11_reading reading = {DHT11_OK, data[2], data[0]};
+        return reading;
     } else {
-        return last_read = _crcError();
+        return _crcError();
+    }
+}
+
+static struct dht11_reading _readSensor() {
+#if CONFIG_PM_ENABLE
+    if(pm_lock != NULL) {
+        esp_pm_lock_acquire(pm_lock);
+        esp_pm_lock_acquire(cpu_lock);
+    }
+#endif
+    struct dht11_reading reading = _readBits();
+#if CONFIG_PM_ENABLE
+    if(pm_lock != NULL) {
+        esp_pm_lock_release(cpu_lock);
+        esp_pm_lock_release(pm_lock);
+    }
+#endif
+    return reading;
+}
+
+static struct dht11_reading _readWithRetries() {
+    struct dht11_reading reading = _readSensor();
+
+    for(int retry = 0; reading.status != DHT11_OK && retry < DHT11_MAX_RETRIES; retry++) {
+        vTaskDelay(DHT11_RETRY_DELAY_MS / portTICK_PERIOD_MS);
+        reading = _readSensor();
     }
+
+    last_read_time = esp_timer_get_time();
+    return last_read = reading;
+}
+
+struct dht11_reading DHT11_read() {
+    /* Tried to sense too son since last read (dht11 needs ~2 seconds to make a new read) */
+    if(esp_timer_get_time() - 2000000 < last_read_time) {
+        return last_read;
+    }
+
+    _waitSettled();
+    return _readWithRetries();
+}
+
+static void _readTask(void *param) {
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        _waitSettled();
+        struct dht11_reading reading = _readWithRetries();
+
+        dht11_callback_t callback = read_callback;
+        void *arg = read_arg;
+        read_busy = false;
+        callback(reading, arg);
+    }
+}
+
+int DHT11_start_read(dht11_callback_t callback, void *arg) {
+    if(read_busy)
+        return DHT11_BUSY_ERROR;
+
+    read_callback = callback;
+    read_arg = arg;
+    read_busy = true;
+    if(read_task == NULL)
+        read_task = xTaskCreateStatic(_readTask, "dht11", DHT11_TASK_STACK_SIZE, NULL, 5, read_task_stack,
+                                      &read_task_tcb);
+    xTaskNotifyGive(read_task);
+    return DHT11_OK;
 }
@@ -27,8 +27,16 @@
 
 #include "driver/gpio.h"
 
+/* Attempts after the first one when a read fails with a CRC or timeout error */
+#define DHT11_MAX_RETRIES       2
+/* The DHT11 needs about a second between two reads */
+#define DHT11_RETRY_DELAY_MS    1100
+/* Stack of the background read task, in bytes */
+#define DHT11_TASK_STACK_SIZE   2048
+
 enum dht11_status {
-    DHT11_CRC_ERROR = -2,
+    DHT11_BUSY_ERROR = -3,
+    DHT11_CRC_ERROR,
     DHT11_TIMEOUT_ERROR,
     DHT11_OK
 };
@@ -39,8 +47,18 @@ struct dht11_reading {
     int humidity;
 };
 
-void DHT11_init(gpio_num_t);
+typedef void (*dht11_callback_t)(struct dht11_reading reading, void *arg);
+
+/* Call right after powering the sensor, the reads wait until settle_ms went by since then */
+void DHT11_init(gpio_num_t, uint32_t settle_ms);
 
 struct dht11_reading DHT11_read();
 
+/*
+ * Starts a read in the background and returns immediately. Once the sensor has settled the
+ * read is done, retried up to DHT11_MAX_RETRIES times, and callback gets the temperature,
+ * humidity and status together. Returns DHT11_BUSY_ERROR if a read is already running.
+ */
+int DHT11_start_read(dht11_callback_t callback, void *arg);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "diag_util.h"
+#include "config_util.h"
+
+static const char *TAG = "DIAG";
+
+#define DIAG_MAGIC  0x44494147
+
+struct diag_window {
+    uint32_t magic;
+    int wakes;
+    size_t heap_min;
+    size_t largest_min;
+};
+
+static RTC_DATA_ATTR struct diag_window window;
+
+static void reset_window(void)
+{
+    window.magic = DIAG_MAGIC;
+    window.wakes = 0;
+    window.heap_min = SIZE_MAX;
+    window.largest_min = SIZE_MAX;
+}
+
+void diag_sample(void)
+{
+    if (window.magic != DIAG_MAGIC) {
+        reset_window();
+    }
+
+    size_t heap_min = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    if (heap_min < window.heap_min) window.heap_min = heap_min;
+    if (largest < window.largest_min) window.largest_min = largest;
+    window.wakes++;
+}
+
+bool diag_due(void)
+{
+    return sensor_cfg.diag_interval > 0 && window.magic == DIAG_MAGIC && window.wakes >= sensor_cfg.diag_interval;
+}
+
+int diag_format(char* buf, size_t len)
+{
+    int n;
+    /* Room kept for the closing "]}" so a long task list is cut between entries, never inside one */
+    int room = (int)len - 2;
+
+    diag_sample();
+
+    n = snprintf(buf, len, "{\"wakes\":%d,\"heap_free\":%u,\"heap_min\":%u,\"heap_largest\":%u,"
+                            "\"window_heap_min\":%u,\"window_largest_min\":%u,\"tasks\":[",
+                window.wakes,
+                (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+                (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+                (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+                (unsigned)window.heap_min, (unsigned)window.largest_min);
+    if (n >= room) {
+        ESP_LOGW(TAG, "Diagnostics do not fit %u bytes", (unsigned)len);
+        return 0;
+    }
+
+#if configUSE_TRACE_FACILITY
+    static TaskStatus_t tasks[DIAG_MAX_TASKS];
+    uint32_t total_runtime = 0;
+    UBaseType_t count = uxTaskGetSystemState(tasks, DIAG_MAX_TASKS, &total_runtime);
+
+    /* Percentages are per mille to keep one decimal without floats */
+    total_runtime /= 1000;
+    for (UBaseType_t i = 0; i < count; i++) {
+        uint32_t cpu = total_runtime ? tasks[i].ulRunTimeCounter / total_runtime : 0;
+        int m = snprintf(buf + n, room - n, "%s{\"name\":\"%s\",\"stack_hwm\":%u,\"cpu_pm\":%u}",
+                    i ? "," : "", tasks[i].pcTaskName, (unsigned)tasks[i].usStackHighWaterMark, (unsigned)cpu);
+        if (m >= room - n) {
+            ESP_LOGW(TAG, "Diagnostics cut after %u of %u tasks", (unsigned)i, (unsigned)count);
+            buf[n] = '\0';
+            break;
+        }
+        n += m;
+    }
+#endif
+
+    n += snprintf(buf + n, len - n, "]}");
+    return n;
+}
+
+void diag_published(void)
+{
+    reset_window();
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define DIAG_MAX_TASKS      24
+
+/*
+ * Heap, stack and task runtime telemetry. diag_sample() keeps the worst values seen
+ * since the last publish in RTC memory, so wakes without an uplink are covered too.
+ */
+void diag_sample(void);
+
+/* True when sensor_cfg.diag_interval wakes went by since the last publish */
+bool diag_due(void);
+
+/*
+ * @brief Format the diagnostics as one JSON line
+ *
+ * Tasks that do not fit are left out, the line stays valid JSON.
+ *
+ * @param buf Output buffer.
+ * @param len Size of the output buffer.
+ *
+ * @return Number of characters written, 0 if not even the heap figures fit.
+ */
+int diag_format(char* buf, size_t len);
+
+/* Starts a new window, once the formatted line was accepted for publishing */
+void diag_published(void);
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "dlog_util.h"
+
+#define DLOG_MAGIC          0x444c4f31  //"DLO1", bump when the record layout changes
+
+/*
+ * Record layout, in 32 bit words:
+ *  [0] level (bits 0-2), number of arguments (bits 3-5), ms since boot (bits 6-31)
+ *  [1] address of the format string in flash
+ *  [2..] arguments
+ */
+#define DLOG_HDR(level, nargs, ms)  (((level) & 0x7) | (((nargs) & 0x7) << 3) | ((uint32_t)(ms) << 6))
+#define DLOG_HDR_NARGS(hdr)         (((hdr) >> 3) & 0x7)
+
+struct dlog_ring {
+    uint32_t magic;
+    //Monotonic word indexes, the oldest record starts at tail
+    uint32_t head;
+    uint32_t tail;
+    uint32_t fault;
+    uint32_t words[DLOG_RING_WORDS];
+};
+
+_Static_assert(sizeof(struct dlog_ring) == DLOG_RING_BYTES, "DLOG_RING_BYTES out of date");
+
+static RTC_NOINIT_ATTR struct dlog_ring ring;
+static portMUX_TYPE dlog_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* DLOG_BOOT_FMT = "boot, reset reason %d";
+
+void dlog_init(void)
+{
+    if (ring.magic != DLOG_MAGIC || ring.head < ring.tail || ring.head - ring.tail > DLOG_RING_WORDS) {
+        memset(&ring, 0, sizeof(ring));
+        ring.magic = DLOG_MAGIC;
+    }
+
+    esp_reset_reason_t reason = esp_reset_reason();
+    switch (reason) {
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_BROWNOUT:
+        ring.fault = 1;
+        break;
+    default:
+        break;
+    }
+
+    if (reason != ESP_RST_DEEPSLEEP) {
+        dlog_write(DLOG_LEVEL_WARN, DLOG_BOOT_FMT, 1, reason);
+    }
+}
+
+void dlog_write(uint8_t level, const char* fmt, int nargs, ...)
+{
+    uint32_t record[2 + DLOG_MAX_ARGS];
+    va_list args;
+
+    record[0] = DLOG_HDR(level, nargs, esp_timer_get_time() / 1000);
+    record[1] = (uint32_t)fmt;
+
+    va_start(args, nargs);
+    for (int i = 0; i < nargs; i++) {
+        record[2 + i] = va_arg(args, uint32_t);
+    }
+    va_end(args);
+
+    int len = 2 + nargs;
+
+    portENTER_CRITICAL(&dlog_lock);
+    /* Drop the oldest records until the new one fits */
+    while (ring.head + len - ring.tail > DLOG_RING_WORDS) {
+        ring.tail += 2 + DLOG_HDR_NARGS(ring.words[ring.tail % DLOG_RING_WORDS]);
+    }
+    for (int i = 0; i < len; i++) {
+        ring.words[(ring.head + i) % DLOG_RING_WORDS] = record[i];
+    }
+    ring.head += len;
+    portEXIT_CRITICAL(&dlog_lock);
+}
+
+bool dlog_fault_pending(void)
+{
+    return ring.fault != 0;
+}
+
+void dlog_dump(void)
+{
+    const uint8_t* bytes = (const uint8_t*)&ring;
+
+    printf("DLOG BEGIN %d\n", (int)sizeof(ring));
+    for (int i = 0; i < sizeof(ring); i += 32) {
+        printf("DLOG ");
+        for (int j = i; j < i + 32 && j < sizeof(ring); j++) {
+            printf("%02x", bytes[j]);
+        }
+        printf("\n");
+    }
+    printf("DLOG END\n");
+}
+
+const void* dlog_buffer(int* size)
+{
+    *size = sizeof(ring);
+    return &ring;
+}
+
+void dlog_clear(void)
+{
+    portENTER_CRITICAL(&dlog_lock);
+    ring.tail = ring.head;
+    ring.fault = 0;
+    portEXIT_CRITICAL(&dlog_lock);
+}
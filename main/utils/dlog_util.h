@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Deferred logging: instead of formatting and printing over UART, a record holding the
+ * address of the format string and up to 4 integer arguments is stored in an RTC memory
+ * ring buffer. The buffer survives deep sleep and resets, and is only dumped on demand or
+ * after a fault. tools/dlog_decode.py rebuilds the text from the firmware ELF.
+ *
+ * Only integer arguments (%d, %u, %x, %c) are supported, %s and %f are not.
+ */
+
+#define DLOG_LEVEL_NONE     0
+#define DLOG_LEVEL_ERROR    1
+#define DLOG_LEVEL_WARN     2
+#define DLOG_LEVEL_INFO     3
+#define DLOG_LEVEL_DEBUG    4
+
+/* Records more verbose than this level are compiled out */
+#ifndef DLOG_LEVEL
+#define DLOG_LEVEL          DLOG_LEVEL_INFO
+#endif
+
+#define DLOG_MAX_ARGS       4
+
+#define DLOG_RING_WORDS     512
+/* RTC memory taken by the ring, its four header words and the records */
+#define DLOG_RING_BYTES     ((4 + DLOG_RING_WORDS) * 4)
+
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, N, ...) N
+#define DLOG_NARGS(...)     DLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+
+#define DLOG(level, fmt, ...) do {                                                  \
+        if ((level) <= DLOG_LEVEL) {                                                \
+            _Static_assert(DLOG_NARGS(__VA_ARGS__) <= DLOG_MAX_ARGS, "too many args"); \
+            dlog_write((level), (fmt), DLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__);     \
+        }                                                                           \
+    } while (0)
+
+#define DLOGE(fmt, ...)     DLOG(DLOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define DLOGW(fmt, ...)     DLOG(DLOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define DLOGI(fmt, ...)     DLOG(DLOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define DLOGD(fmt, ...)     DLOG(DLOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+/* Validates the ring buffer and records whether the last reset was a fault */
+void dlog_init(void);
+
+void dlog_write(uint8_t level, const char* fmt, int nargs, ...);
+
+/* True when the last reset was a panic, watchdog or brownout and the buffer was not uploaded yet */
+bool dlog_fault_pending(void);
+
+/* Prints the buffer over UART as hex lines that dlog_decode.py accepts */
+void dlog_dump(void);
+
+/*
+ * @brief Gives the raw ring buffer for upload
+ *
+ * @param size Size of the buffer in bytes.
+ *
+ * @return Pointer to the ring buffer.
+ */
+const void* dlog_buffer(int* size);
+
+/* Drops every record and clears the pending fault, call after a successful upload */
+void dlog_clear(void);
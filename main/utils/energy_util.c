@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_attr.h"
+
+#include "energy_util.h"
+#include "config_util.h"
+#include "counter_util.h"
+#include "sensor_util.h"
+#include "uplink_queue.h"
+#include "dlog_util.h"
+
+#define ENERGY_MAGIC    0x454e5247
+
+#if CONFIG_BATTERY_LOW_DROP_PH
+#define ENERGY_DROPPED_PH       SENSOR_BIT_PH
+#else
+#define ENERGY_DROPPED_PH       0
+#endif
+#if CONFIG_BATTERY_LOW_DROP_HUM_TEMP
+#define ENERGY_DROPPED_HUM_TEMP SENSOR_BIT_HUM_TEMP
+#else
+#define ENERGY_DROPPED_HUM_TEMP 0
+#endif
+/* Sensors read from ENERGY_LOW down, the others only while there is energy to spare */
+#define ENERGY_LOW_SENSORS      (SENSOR_BITS_ALL & ~ENERGY_DROPPED_PH & ~ENERGY_DROPPED_HUM_TEMP)
+
+struct energy_state {
+    uint32_t magic;
+    int tier;
+    //Last measurement, -1 before the first one
+    int vbat_mv;
+};
+
+static RTC_DATA_ATTR struct energy_state energy;
+
+static const struct energy_thresholds thresholds = {
+    .enter_mv = {
+        [ENERGY_SAVE] = CONFIG_BATTERY_SAVE_MV,
+        [ENERGY_LOW] = CONFIG_BATTERY_LOW_MV,
+        [ENERGY_ALARM_ONLY] = CONFIG_BATTERY_ALARM_ONLY_MV,
+    },
+    .hysteresis_mv = CONFIG_BATTERY_HYSTERESIS_MV,
+};
+
+static void energy_init(void)
+{
+    if (energy.magic == ENERGY_MAGIC) {
+        return;
+    }
+    memset(&energy, 0, sizeof(energy));
+    energy.magic = ENERGY_MAGIC;
+    energy.tier = ENERGY_NORMAL;
+    energy.vbat_mv = -1;
+}
+
+void energy_update(void)
+{
+    energy_init();
+
+    int mv = battery_read_mv();
+    if (mv < 0) {
+        DLOGW("Battery not measured, staying in tier %d", energy.tier);
+    } else {
+        enum energy_tier tier = energy_tier_next(energy.tier, mv, &thresholds);
+        if (tier != energy.tier) {
+            DLOGW("Energy tier %d -> %d at %d mV", energy.tier, tier, mv);
+            /* A brownout may follow, nothing should be left only in RTC memory */
+            if (tier == ENERGY_ALARM_ONLY) {
+                uplink_queue_persist();
+                counters_checkpoint();
+            }
+            energy.tier = tier;
+        }
+        energy.vbat_mv = mv;
+    }
+
+    sensors_select(energy.tier >= ENERGY_LOW ? ENERGY_LOW_SENSORS : SENSOR_BITS_ALL);
+}
+
+enum energy_tier energy_tier(void)
+{
+    return energy.magic == ENERGY_MAGIC ? energy.tier : ENERGY_NORMAL;
+}
+
+int energy_sleep_interval(int sleep_interval)
+{
+    return energy_tier_sleep(energy_tier(), sleep_interval);
+}
+
+int energy_batch_low(int batch_low)
+{
+    return energy_tier_batch(energy_tier(), batch_low, wake_queue_limit(sensor_cfg.batch_high, UPLINK_QUEUE_LEN));
+}
+
+bool energy_alarm_only(void)
+{
+    return energy_tier() == ENERGY_ALARM_ONLY;
+}
+
+int energy_format(char* buf, size_t len)
+{
+    return snprintf(buf, len, " vb=%d et=%d", energy.vbat_mv, energy_tier());
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "wake_policy.h"
+
+/*
+ * Energy tiers picked from the battery voltage (wake_policy.h). Each wake measures the
+ * battery before the sensors are powered and moves between tiers with hysteresis, the tier
+ * is kept in RTC memory. Lower tiers stretch the sleep interval, raise batch_low, leave out
+ * the non-critical sensors and finally only uplink deadband alarms. Without
+ * CONFIG_BATTERY_MONITOR every call keeps the configured behaviour.
+ */
+#if CONFIG_BATTERY_MONITOR
+/* Measures the battery, updates the tier and selects the sensors of this wake */
+void energy_update(void);
+
+enum energy_tier energy_tier(void);
+int energy_sleep_interval(int sleep_interval);
+int energy_batch_low(int batch_low);
+bool energy_alarm_only(void);
+
+/* Longest energy_format() output, the divider scales at most 3300 mV by 10: " vb=33000 et=3" */
+#define ENERGY_FORMAT_MAX       14
+
+/* Appends " vb=<mV> et=<tier>", returns the number of characters written, len or more when it was cut */
+int energy_format(char* buf, size_t len);
+#else
+#define ENERGY_FORMAT_MAX       0
+#define energy_update()
+#define energy_tier()                   ENERGY_NORMAL
+#define energy_sleep_interval(s)        (s)
+#define energy_batch_low(b)             (b)
+#define energy_alarm_only()             false
+#define energy_format(buf, len)         0
+#endif
@@ -0,0 +1,123 @@
+#include <string.h>
+
+#include "espnow_proto.h"
+
+static void put_header(uint8_t* frame, uint8_t type, uint16_t seq)
+{
+    frame[0] = ESPNOW_FRAME_MAGIC;
+    frame[1] = ESPNOW_FRAME_VERSION;
+    frame[2] = type;
+    frame[3] = seq & 0xff;
+    frame[4] = seq >> 8;
+}
+
+static bool check_header(const uint8_t* frame, int len, uint8_t type, uint16_t* seq)
+{
+    if (len < ESPNOW_HEADER_LEN || frame[0] != ESPNOW_FRAME_MAGIC || frame[1] != ESPNOW_FRAME_VERSION
+            || frame[2] != type) {
+        return false;
+    }
+    *seq = frame[3] | (frame[4] << 8);
+    return true;
+}
+
+int espnow_encode_data(uint16_t seq, const char* topic, const char* data, uint8_t* frame, int max_len)
+{
+    int topic_len = strlen(topic);
+    int data_len = strlen(data);
+    int len = ESPNOW_HEADER_LEN + 1 + topic_len + data_len;
+
+    if (topic_len > 255 || len > max_len || len > ESPNOW_FRAME_MAX) {
+        return -1;
+    }
+    put_header(frame, ESPNOW_FRAME_DATA, seq);
+    frame[ESPNOW_HEADER_LEN] = topic_len;
+    memcpy(frame + ESPNOW_HEADER_LEN + 1, topic, topic_len);
+    memcpy(frame + ESPNOW_HEADER_LEN + 1 + topic_len, data, data_len);
+    return len;
+}
+
+int espnow_encode_ack(uint16_t seq, uint8_t* frame, int max_len)
+{
+    if (max_len < ESPNOW_HEADER_LEN) {
+        return -1;
+    }
+    put_header(frame, ESPNOW_FRAME_ACK, seq);
+    return ESPNOW_HEADER_LEN;
+}
+
+bool espnow_decode_data(const uint8_t* frame, int len, uint16_t* seq, char* topic, int topic_size,
+                        char* data, int data_size)
+{
+    if (!check_header(frame, len, ESPNOW_FRAME_DATA, seq) || len < ESPNOW_HEADER_LEN + 1) {
+        return false;
+    }
+    int topic_len = frame[ESPNOW_HEADER_LEN];
+    int data_len = len - ESPNOW_HEADER_LEN - 1 - topic_len;
+    if (data_len < 0 || topic_len >= topic_size || data_len >= data_size) {
+        return false;
+    }
+    memcpy(topic, frame + ESPNOW_HEADER_LEN + 1, topic_len);
+    topic[topic_len] = '\0';
+    memcpy(data, frame + ESPNOW_HEADER_LEN + 1 + topic_len, data_len);
+    data[data_len] = '\0';
+    return true;
+}
+
+bool espnow_decode_ack(const uint8_t* frame, int len, uint16_t* seq)
+{
+    return check_header(frame, len, ESPNOW_FRAME_ACK, seq);
+}
+
+int espnow_send_reliable(const struct espnow_radio_ops* ops, uint16_t seq, const char* topic, const char* data,
+                         int retries, int ack_timeout_ms)
+{
+    uint8_t frame[ESPNOW_FRAME_MAX];
+    uint8_t ack[ESPNOW_FRAME_MAX];
+
+    int len = espnow_encode_data(seq, topic, data, frame, sizeof(frame));
+    if (len < 0) {
+        return -1;
+    }
+
+    for (int attempt = 1; attempt <= retries + 1; attempt++) {
+        if (ops->send(ops->ctx, frame, len) != 0) {
+            continue;
+        }
+        /* Acks of earlier records that arrive late are skipped */
+        int ack_len;
+        while ((ack_len = ops->receive(ops->ctx, ack, sizeof(ack), ack_timeout_ms)) >= 0) {
+            uint16_t ack_seq;
+            if (espnow_decode_ack(ack, ack_len, &ack_seq) && ack_seq == seq) {
+                return attempt;
+            }
+        }
+    }
+    return -1;
+}
+
+bool espnow_dedup_seen(const struct espnow_dedup* dedup, const uint8_t mac[6], uint16_t seq)
+{
+    for (int i = 0; i < dedup->count; i++) {
+        if (memcmp(dedup->mac[i], mac, 6) == 0) {
+            return dedup->seq[i] == seq;
+        }
+    }
+    return false;
+}
+
+void espnow_dedup_mark(struct espnow_dedup* dedup, const uint8_t mac[6], uint16_t seq)
+{
+    for (int i = 0; i < dedup->count; i++) {
+        if (memcmp(dedup->mac[i], mac, 6) == 0) {
+            dedup->seq[i] = seq;
+            return;
+        }
+    }
+
+    /* New node, replace the oldest entry once the table is full */
+    int slot = dedup->count < ESPNOW_DEDUP_PEERS ? dedup->count++ : dedup->next;
+    dedup->next = (slot + 1) % ESPNOW_DEDUP_PEERS;
+    memcpy(dedup->mac[slot], mac, 6);
+    dedup->seq[slot] = seq;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * ESP-NOW uplink frames between sensor nodes and the gateway. Kept free of ESP-IDF calls,
+ * the radio is reached through struct espnow_radio_ops so tools/espnow_mock.c runs the
+ * protocol on the host against a lossy mock radio.
+ *
+ * Data frame: 'E' version type seq(le16) topic_len topic data
+ * Ack frame:  'E' version type seq(le16)
+ */
+
+#define ESPNOW_FRAME_MAX        250
+#define ESPNOW_FRAME_MAGIC      'E'
+#define ESPNOW_FRAME_VERSION    1
+#define ESPNOW_HEADER_LEN       5
+/* Nodes the gateway remembers the last sequence number of */
+#define ESPNOW_DEDUP_PEERS      20
+
+enum espnow_frame_type {
+    ESPNOW_FRAME_DATA = 1,
+    ESPNOW_FRAME_ACK = 2,
+};
+
+struct espnow_radio_ops {
+    /* Sends a frame to the gateway, returns 0 once the radio took it */
+    int (*send)(void* ctx, const uint8_t* frame, int len);
+    /* Waits for a frame from the gateway, returns its length or -1 on timeout */
+    int (*receive)(void* ctx, uint8_t* frame, int max_len, int timeout_ms);
+    void* ctx;
+};
+
+struct espnow_dedup {
+    int count;
+    int next;
+    uint8_t mac[ESPNOW_DEDUP_PEERS][6];
+    uint16_t seq[ESPNOW_DEDUP_PEERS];
+};
+
+/* Return the frame length, or -1 when it does not fit */
+int espnow_encode_data(uint16_t seq, const char* topic, const char* data, uint8_t* frame, int max_len);
+int espnow_encode_ack(uint16_t seq, uint8_t* frame, int max_len);
+
+/* Copy the topic and data out of the frame NUL terminated, false for anything else than a valid data frame */
+bool espnow_decode_data(const uint8_t* frame, int len, uint16_t* seq, char* topic, int topic_size,
+                        char* data, int data_size);
+bool espnow_decode_ack(const uint8_t* frame, int len, uint16_t* seq);
+
+/*
+ * @brief Send one record and wait for the gateway to ack it
+ *
+ * A record keeps its sequence number until it is acked, so the gateway can drop
+ * the copies resent after a lost ack, even from a later wake.
+ *
+ * @return the number of sends it took, or -1 when no ack came after retries resends.
+ */
+int espnow_send_reliable(const struct espnow_radio_ops* ops, uint16_t seq, const char* topic, const char* data,
+                         int retries, int ack_timeout_ms);
+
+/* Gateway side, true when the sequence number was already taken from this node */
+bool espnow_dedup_seen(const struct espnow_dedup* dedup, const uint8_t mac[6], uint16_t seq);
+/* Record the sequence number once the record was taken, only then is it acked */
+void espnow_dedup_mark(struct espnow_dedup* dedup, const uint8_t mac[6], uint16_t seq);
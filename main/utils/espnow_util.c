@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_attr.h"
+#include "esp_event.h"
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_now.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+
+#include "espnow_util.h"
+#include "espnow_proto.h"
+#include "dlog_util.h"
+#include "link_util.h"
+#include "nvs_util.h"
+
+static const char *TAG = "ESPNOW_UTIL";
+
+#define ESPNOW_SEQ_MAGIC    0x454e5351
+
+struct espnow_peer {
+    uint8_t mac[6];
+    uint8_t channel;
+};
+
+struct espnow_rx {
+    uint8_t mac[6];
+    int len;
+    uint8_t frame[ESPNOW_FRAME_MAX];
+};
+
+#if CONFIG_UPLINK_TRANSPORT_ESPNOW
+/* Sequence number of the oldest unacked record, only advanced on an ack so a record
+   resent on a later wake keeps its number and the gateway can drop the copy */
+static RTC_DATA_ATTR struct {
+    uint32_t magic;
+    uint16_t seq;
+} node_state;
+
+static struct espnow_peer peer;
+#endif
+
+static QueueHandle_t rx_queue;
+static StaticQueue_t rx_queue_buf;
+static uint8_t rx_queue_storage[ESPNOW_RX_QUEUE_LEN * sizeof(struct espnow_rx)];
+
+static void on_receive(const uint8_t* mac, const uint8_t* data, int len)
+{
+    struct espnow_rx rx;
+
+    if (len <= 0 || len > ESPNOW_FRAME_MAX) {
+        return;
+    }
+    memcpy(rx.mac, mac, 6);
+    memcpy(rx.frame, data, len);
+    rx.len = len;
+    //Runs in the Wi-Fi task, drop the frame rather than block it
+    xQueueSend(rx_queue, &rx, 0);
+}
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+static void recv_cb(const esp_now_recv_info_t* info, const uint8_t* data, int len)
+{
+    on_receive(info->src_addr, data, len);
+}
+#else
+static void recv_cb(const uint8_t* mac, const uint8_t* data, int len)
+{
+    on_receive(mac, data, len);
+}
+#endif
+
+static esp_err_t add_peer(const uint8_t* mac, uint8_t channel)
+{
+    esp_now_peer_info_t info = {
+        .channel = channel,
+        .ifidx = WIFI_IF_STA,
+        .encrypt = false,
+    };
+
+    if (esp_now_is_peer_exist(mac)) {
+        return ESP_OK;
+    }
+    memcpy(info.peer_addr, mac, 6);
+    esp_err_t err = esp_now_add_peer(&info);
+    if (err == ESP_ERR_ESPNOW_FULL) {
+        /* A gateway can serve more nodes than the peer table holds, they only need a peer entry to be acked */
+        esp_now_peer_info_t oldest;
+        if (esp_now_fetch_peer(true, &oldest) == ESP_OK) {
+            esp_now_del_peer(oldest.peer_addr);
+            err = esp_now_add_peer(&info);
+        }
+    }
+    return err;
+}
+
+static esp_err_t now_init(void)
+{
+    if (rx_queue == NULL) {
+        rx_queue = xQueueCreateStatic(ESPNOW_RX_QUEUE_LEN, sizeof(struct espnow_rx), rx_queue_storage, &rx_queue_buf);
+    }
+    esp_err_t err = esp_now_init();
+    if (err == ESP_OK) {
+        err = esp_now_register_recv_cb(recv_cb);
+    }
+    return err;
+}
+
+#if CONFIG_UPLINK_TRANSPORT_ESPNOW
+esp_err_t espnow_pair(const uint8_t* data, int len)
+{
+    char text[48];
+    unsigned int mac[6];
+    int channel;
+    struct espnow_peer p;
+
+    if (len <= 0 || len >= (int)sizeof(text)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    memcpy(text, data, len);
+    text[len] = '\0';
+
+    if (sscanf(text, "espnow %x:%x:%x:%x:%x:%x %d", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5],
+                &channel) != 7) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (channel < 1 || channel > 14) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < 6; i++) {
+        p.mac[i] = mac[i];
+    }
+    p.channel = channel;
+
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    err = nvs_set_blob(my_handle, ESPNOW_PEER_KEY, &p, sizeof(p));
+    if (err == ESP_OK) {
+        err = nvs_commit(my_handle);
+    }
+    nvs_close(my_handle);
+
+    ESP_LOGI(TAG, "Paired with gateway " MACSTR " on channel %d", MAC2STR(p.mac), p.channel);
+    return err;
+}
+
+static esp_err_t load_peer(struct espnow_peer* p)
+{
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    size_t required_size = sizeof(struct espnow_peer);
+    err = nvs_get_blob(my_handle, ESPNOW_PEER_KEY, p, &required_size);
+    nvs_close(my_handle);
+    return err;
+}
+
+static int node_send(void* ctx, const uint8_t* frame, int len)
+{
+    return esp_now_send(peer.mac, frame, len) == ESP_OK ? 0 : -1;
+}
+
+static int node_receive(void* ctx, uint8_t* frame, int max_len, int timeout_ms)
+{
+    struct espnow_rx rx;
+
+    while (xQueueReceive(rx_queue, &rx, pdMS_TO_TICKS(timeout_ms)) == pdTRUE) {
+        if (memcmp(rx.mac, peer.mac, 6) == 0 && rx.len <= max_len) {
+            memcpy(frame, rx.frame, rx.len);
+            return rx.len;
+        }
+    }
+    return -1;
+}
+
+static const struct espnow_radio_ops node_ops = {
+    .send = node_send,
+    .receive = node_receive,
+};
+
+bool espnow_node_start(void)
+{
+    if (load_peer(&peer) != ESP_OK) {
+        return false;
+    }
+    if (node_state.magic != ESPNOW_SEQ_MAGIC) {
+        /* A node that lost RTC memory starts elsewhere in the sequence space than where the gateway last saw it */
+        node_state.magic = ESPNOW_SEQ_MAGIC;
+        node_state.seq = esp_random();
+    }
+
+    /* Station interface only for the radio, it never associates */
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_start());
+    link_apply_tx_power();
+    ESP_ERROR_CHECK(esp_wifi_set_channel(peer.channel, WIFI_SECOND_CHAN_NONE));
+
+    esp_err_t err = now_init();
+    if (err == ESP_OK) {
+        err = add_peer(peer.mac, peer.channel);
+    }
+    if (err != ESP_OK) {
+        DLOGW("ESP-NOW start failed: %d", err);
+        return false;
+    }
+    return true;
+}
+
+void espnow_node_stop(void)
+{
+    esp_now_deinit();
+    esp_wifi_stop();
+}
+
+int espnow_send_data(const char* topic, const char* data)
+{
+    int sends = espnow_send_reliable(&node_ops, node_state.seq, topic, data, CONFIG_ESPNOW_RETRIES,
+                                     CONFIG_ESPNOW_ACK_TIMEOUT_MS);
+    if (sends < 0) {
+        return -1;
+    }
+    if (sends > 1) {
+        ESP_LOGI(TAG, "Record %d acked after %d sends", node_state.seq, sends);
+    }
+    return node_state.seq++;
+}
+#endif
+
+#if CONFIG_ESPNOW_GATEWAY
+/* Records are acked to the nodes as soon as they are batched, they stay here until the broker acked them */
+struct gateway_batch {
+    char topic[ESPNOW_TOPIC_MAX];
+    char text[1024];
+    int len;
+    int count;
+    //-1 until handed to MQTT
+    int msg_id;
+    TickType_t sent_at;
+};
+
+struct gateway_uplink {
+    int (*forward)(const char* topic, const char* data);
+    bool (*delivered)(int msg_id);
+};
+
+//Being filled
+static struct gateway_batch open_batch;
+//Published, waiting for its PUBACK
+static struct gateway_batch sent_batch;
+static TickType_t batch_start;
+static int forward_failures;
+
+static void save_batch(nvs_handle_t handle, const char* key, const struct gateway_batch* b)
+{
+    if (b->count > 0) {
+        nvs_set_blob(handle, key, b, sizeof(*b));
+    } else {
+        nvs_erase_key(handle, key);
+    }
+}
+
+static void load_batch(nvs_handle_t handle, const char* key, struct gateway_batch* b)
+{
+    size_t size = sizeof(*b);
+    if (nvs_get_blob(handle, key, b, &size) != ESP_OK || size != sizeof(*b)) {
+        memset(b, 0, sizeof(*b));
+    }
+    b->msg_id = -1;
+    nvs_erase_key(handle, key);
+}
+
+/* Restarting to reconnect drops the MQTT outbox, the acked records are kept in NVS for the next start */
+static void gateway_restart(void)
+{
+    nvs_handle_t handle;
+
+    if (open_nvs("saved_params", &handle) == ESP_OK) {
+        save_batch(handle, ESPNOW_GATEWAY_SENT_KEY, &sent_batch);
+        save_batch(handle, ESPNOW_GATEWAY_OPEN_KEY, &open_batch);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+    ESP_LOGW(TAG, "Restarting with %d records undelivered", sent_batch.count + open_batch.count);
+    esp_restart();
+}
+
+static void restore_batches(void)
+{
+    nvs_handle_t handle;
+
+    if (open_nvs("saved_params", &handle) != ESP_OK) {
+        return;
+    }
+    load_batch(handle, ESPNOW_GATEWAY_SENT_KEY, &sent_batch);
+    load_batch(handle, ESPNOW_GATEWAY_OPEN_KEY, &open_batch);
+    nvs_commit(handle);
+    nvs_close(handle);
+    batch_start = xTaskGetTickCount();
+    if (sent_batch.count + open_batch.count > 0) {
+        ESP_LOGI(TAG, "Restored %d undelivered records", sent_batch.count + open_batch.count);
+    }
+}
+
+static void forward_failed(void)
+{
+    if (++forward_failures >= ESPNOW_GATEWAY_FORWARD_FAILURES) {
+        gateway_restart();
+    }
+}
+
+/* Publishes the sent batch or checks its PUBACK, true once it is delivered and the slot is free */
+static bool settle_sent(const struct gateway_uplink* uplink)
+{
+    if (sent_batch.count == 0) {
+        return true;
+    }
+    if (sent_batch.msg_id >= 0 && uplink->delivered(sent_batch.msg_id)) {
+        sent_batch.count = 0;
+        forward_failures = 0;
+        return true;
+    }
+    if (sent_batch.msg_id >= 0 && xTaskGetTickCount() - sent_batch.sent_at < pdMS_TO_TICKS(ESPNOW_GATEWAY_PUBACK_MS)) {
+        return false;
+    }
+
+    /* Never published, or the outbox gave up on it: published again, the broker may see it twice */
+    bool overdue = sent_batch.msg_id >= 0;
+    if (overdue) {
+        ESP_LOGW(TAG, "Batch of %d records not acked by the broker", sent_batch.count);
+    }
+    sent_batch.msg_id = uplink->forward(sent_batch.topic, sent_batch.text);
+    sent_batch.sent_at = xTaskGetTickCount();
+    if (sent_batch.msg_id < 0) {
+        ESP_LOGW(TAG, "Forwarding %d records failed", sent_batch.count);
+    }
+    if (overdue || sent_batch.msg_id < 0) {
+        forward_failed();
+    }
+    return false;
+}
+
+static void flush_batch(const struct gateway_uplink* uplink)
+{
+    if (!settle_sent(uplink)) {
+        /* Kept for the next flush, new records are dropped while it does not fit */
+        batch_start = xTaskGetTickCount();
+        return;
+    }
+    sent_batch = open_batch;
+    sent_batch.msg_id = -1;
+    open_batch.len = 0;
+    open_batch.count = 0;
+    settle_sent(uplink);
+}
+
+/* False when the record was dropped, it is not acked then so the node sends it again */
+static bool batch_add(const uint8_t* mac, const char* topic, const char* data, const struct gateway_uplink* uplink)
+{
+    if (open_batch.count > 0 && strcmp(topic, open_batch.topic) != 0) {
+        flush_batch(uplink);
+    }
+    //"\n" + 17 char MAC + " " + record + NUL
+    int needed = 1 + 17 + 1 + strlen(data) + 1;
+    if (open_batch.len + needed > (int)sizeof(open_batch.text)) {
+        flush_batch(uplink);
+    }
+    if (open_batch.count > 0 && (strcmp(topic, open_batch.topic) != 0
+                                 || open_batch.len + needed > (int)sizeof(open_batch.text))) {
+        ESP_LOGW(TAG, "Record from " MACSTR " dropped", MAC2STR(mac));
+        return false;
+    }
+
+    if (open_batch.count == 0) {
+        snprintf(open_batch.topic, sizeof(open_batch.topic), "%s", topic);
+        batch_start = xTaskGetTickCount();
+    }
+    open_batch.len += snprintf(open_batch.text + open_batch.len, sizeof(open_batch.text) - open_batch.len,
+                               "%s" MACSTR " %s", open_batch.count > 0 ? "\n" : "", MAC2STR(mac), data);
+    if (++open_batch.count >= CONFIG_ESPNOW_GATEWAY_BATCH_MAX) {
+        flush_batch(uplink);
+    }
+    return true;
+}
+
+void espnow_gateway_run(int (*forward)(const char* topic, const char* data), bool (*delivered)(int msg_id))
+{
+    static struct espnow_dedup dedup;
+    const struct gateway_uplink uplink = {
+        .forward = forward,
+        .delivered = delivered,
+    };
+    struct espnow_rx rx;
+    uint8_t mac[6];
+    uint8_t channel;
+    wifi_second_chan_t second;
+
+    ESP_ERROR_CHECK(now_init());
+    restore_batches();
+    esp_wifi_get_mac(WIFI_IF_STA, mac);
+    esp_wifi_get_channel(&channel, &second);
+    /* Sent to the nodes as BluFi custom data to pair them */
+    ESP_LOGI(TAG, "Gateway ready: espnow " MACSTR " %d", MAC2STR(mac), channel);
+
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        bool flush_due = false;
+        if (open_batch.count > 0) {
+            TickType_t age = xTaskGetTickCount() - batch_start;
+            TickType_t limit = pdMS_TO_TICKS(CONFIG_ESPNOW_GATEWAY_BATCH_MS);
+            wait = age < limit ? limit - age : 0;
+            flush_due = age >= limit;
+        }
+        if (sent_batch.count > 0 && wait > pdMS_TO_TICKS(ESPNOW_GATEWAY_POLL_MS)) {
+            wait = pdMS_TO_TICKS(ESPNOW_GATEWAY_POLL_MS);
+        }
+
+        if (xQueueReceive(rx_queue, &rx, wait) == pdTRUE) {
+            uint16_t seq;
+            char topic[ESPNOW_TOPIC_MAX];
+            char data[ESPNOW_FRAME_MAX];
+            uint8_t ack[ESPNOW_HEADER_LEN];
+
+            if (!espnow_decode_data(rx.frame, rx.len, &seq, topic, sizeof(topic), data, sizeof(data))) {
+                continue;
+            }
+            /* Resent frames are acked again, their first ack was lost */
+            if (!espnow_dedup_seen(&dedup, rx.mac, seq)) {
+                if (!batch_add(rx.mac, topic, data, &uplink)) {
+                    continue;
+                }
+                espnow_dedup_mark(&dedup, rx.mac, seq);
+            }
+            if (add_peer(rx.mac, 0) == ESP_OK) {
+                esp_now_send(rx.mac, ack, espnow_encode_ack(seq, ack, sizeof(ack)));
+            }
+        } else if (flush_due) {
+            flush_batch(&uplink);
+        } else {
+            settle_sent(&uplink);
+        }
+    }
+}
+#endif
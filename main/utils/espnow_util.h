@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+//NVS key of the gateway a node sends to
+#define ESPNOW_PEER_KEY         "espnow_peer"
+//Received frames waiting for the send path or the gateway loop
+#define ESPNOW_RX_QUEUE_LEN     8
+//Longest topic carried in a frame
+#define ESPNOW_TOPIC_MAX        32
+//Failed or unacked forwards in a row after which the gateway restarts to reconnect
+#define ESPNOW_GATEWAY_FORWARD_FAILURES 12
+//A published batch without PUBACK after this long is published again
+#define ESPNOW_GATEWAY_PUBACK_MS        10000
+//PUBACK check interval while a batch is waiting for it
+#define ESPNOW_GATEWAY_POLL_MS          500
+//NVS keys of the undelivered batches kept over a gateway restart
+#define ESPNOW_GATEWAY_SENT_KEY         "gw_sent"
+#define ESPNOW_GATEWAY_OPEN_KEY         "gw_open"
+
+/*
+ * @brief Save the gateway sent as BluFi custom data: "espnow aa:bb:cc:dd:ee:ff <channel>"
+ *
+ * @return ESP_ERR_NOT_SUPPORTED when the data is not an ESP-NOW pairing.
+ */
+esp_err_t espnow_pair(const uint8_t* data, int len);
+
+/* Starts the radio on the gateway channel without connecting to an access point, false if not paired */
+bool espnow_node_start(void);
+void espnow_node_stop(void);
+
+/* Same contract as mqtt_send_data, returns the sequence number or -1 if the gateway did not ack */
+int espnow_send_data(const char* topic, const char* data);
+
+/*
+ * @brief Receive records from the nodes and forward them, never returns
+ *
+ * Every data frame is acked, then records are batched per topic as "<node mac> <record>"
+ * lines and passed to forward every CONFIG_ESPNOW_GATEWAY_BATCH_MS or
+ * CONFIG_ESPNOW_GATEWAY_BATCH_MAX records. A batch is kept until delivered reports its
+ * PUBACK and saved to NVS when the gateway restarts. Wi-Fi has to be started already.
+ */
+void espnow_gateway_run(int (*forward)(const char* topic, const char* data), bool (*delivered)(int msg_id));
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_image_format.h"
+#include "bootloader_common.h"
+
+#include "image_util.h"
+
+static const char *TAG = "IMAGE_UTIL";
+
+bool image_select_uplink(void)
+{
+    static bool selected;
+
+    if (selected) {
+        return true;
+    }
+
+    const esp_partition_t* slot = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_2, NULL);
+    if (slot == NULL) {
+        ESP_LOGW(TAG, "No timer wake slot in the partition table");
+        return false;
+    }
+
+    /* The bootloader skips validation on deep sleep wakes, so check it once here */
+    esp_partition_pos_t pos = {
+        .offset = slot->address,
+        .size = slot->size,
+    };
+    esp_image_metadata_t metadata;
+    if (esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &metadata) != ESP_OK) {
+        ESP_LOGW(TAG, "No valid timer wake image in %s", slot->label);
+        return false;
+    }
+
+    /* Partition the bootloader loads straight away on deep sleep wakes */
+    bootloader_common_update_rtc_retain_mem(&pos, false);
+    ESP_LOGI(TAG, "Timer wakes boot %s, %u bytes", slot->label, (unsigned)metadata.image_len);
+    selected = true;
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+/*
+ * Split images (CONFIG_SPLIT_IMAGES): the full image runs provisioning and every reset
+ * that is not a deep sleep wake, the timer wake image in the ota_2 slot runs the sensor cycle.
+ */
+
+#if CONFIG_APP_ROLE_UPLINK
+#define IMAGE_ROLE  "uplink"
+#elif CONFIG_SPLIT_IMAGES
+#define IMAGE_ROLE  "full"
+#else
+#define IMAGE_ROLE  "single"
+#endif
+
+/*
+ * @brief Have the bootloader load the timer wake image on the next deep sleep wake
+ *
+ * Checks the image in the ota_2 slot first, the full image keeps handling timer
+ * wakes when it is missing or does not verify.
+ *
+ * @return true when the next wake boots the timer wake image.
+ */
+bool image_select_uplink(void);
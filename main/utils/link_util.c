@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+
+#include "link_util.h"
+
+static const char *TAG = "LINK_UTIL";
+
+#define LINK_MAGIC  0x4c494e4b
+
+struct link_setting {
+    int8_t tx_power;
+    uint8_t mode;
+};
+
+struct link_state {
+    uint32_t magic;
+    int8_t rssi[LINK_RSSI_HISTORY];
+    int rssi_count;
+    int rssi_next;
+    struct link_setting current;
+    //Setting and result before the last change, used to check the change was worth it
+    struct link_setting previous;
+    int previous_assoc_ms;
+    int previous_retries;
+    bool changed;
+    int hold_wakes;
+};
+
+static RTC_DATA_ATTR struct link_state link;
+
+static void link_init(void)
+{
+    if (link.magic == LINK_MAGIC) {
+        return;
+    }
+    memset(&link, 0, sizeof(link));
+    link.magic = LINK_MAGIC;
+    link.current.tx_power = LINK_TX_POWER_MAX;
+    link.current.mode = LINK_MODE_NORMAL;
+}
+
+void link_apply_protocol(void)
+{
+    uint8_t protocol;
+
+    link_init();
+    switch (link.current.mode) {
+    case LINK_MODE_11B:
+        protocol = WIFI_PROTOCOL_11B;
+        break;
+    case LINK_MODE_LR:
+        protocol = WIFI_PROTOCOL_11B | WIFI_PROTOCOL_LR;
+        break;
+    case LINK_MODE_NORMAL:
+    default:
+        protocol = WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N;
+        break;
+    }
+
+    esp_err_t err = esp_wifi_set_protocol(WIFI_IF_STA, protocol);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Could not set protocol 0x%x: %s", protocol, esp_err_to_name(err));
+    }
+}
+
+void link_apply_tx_power(void)
+{
+    link_init();
+    esp_err_t err = esp_wifi_set_max_tx_power(link.current.tx_power);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Could not set TX power %d: %s", link.current.tx_power, esp_err_to_name(err));
+    }
+}
+
+static int average_rssi(void)
+{
+    int sum = 0;
+    for (int i = 0; i < link.rssi_count; i++) {
+        sum += link.rssi[i];
+    }
+    return link.rssi_count ? sum / link.rssi_count : LINK_MARGINAL_RSSI;
+}
+
+static void change_setting(struct link_setting next, int assoc_ms, int retries)
+{
+    if (memcmp(&next, &link.current, sizeof(next)) == 0) {
+        return;
+    }
+    link.previous = link.current;
+    link.previous_assoc_ms = assoc_ms;
+    link.previous_retries = retries;
+    link.current = next;
+    link.changed = true;
+    ESP_LOGI(TAG, "TX power %d, mode %d", next.tx_power, next.mode);
+}
+
+/* Raise power first, then fall back to slower but more robust PHY modes */
+static struct link_setting escalate(struct link_setting s)
+{
+    if (s.tx_power < LINK_TX_POWER_MAX) {
+        s.tx_power = LINK_TX_POWER_MAX;
+    } else if (s.mode == LINK_MODE_NORMAL) {
+        s.mode = LINK_MODE_11B;
+    } else if (s.mode == LINK_MODE_11B && LINK_ALLOW_LR) {
+        s.mode = LINK_MODE_LR;
+    }
+    return s;
+}
+
+void link_record_result(bool connected, int assoc_ms, int retries)
+{
+    wifi_ap_record_t ap;
+
+    link_init();
+
+    if (!connected) {
+        /* Nothing to measure, make the next attempt as robust as possible */
+        change_setting(escalate(link.current), assoc_ms, retries);
+        return;
+    }
+
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        link.rssi[link.rssi_next] = ap.rssi;
+        link.rssi_next = (link.rssi_next + 1) % LINK_RSSI_HISTORY;
+        if (link.rssi_count < LINK_RSSI_HISTORY) link.rssi_count++;
+    }
+
+    /* The last change made association slower or needed more retries, go back */
+    if (link.changed && (retries > link.previous_retries || assoc_ms > link.previous_assoc_ms * 3 / 2)) {
+        ESP_LOGI(TAG, "Last change made the link worse (%d ms, %d retries), reverting", assoc_ms, retries);
+        link.current = link.previous;
+        link.changed = false;
+        link.hold_wakes = LINK_HOLD_WAKES;
+        return;
+    }
+    link.changed = false;
+
+    if (link.hold_wakes > 0) {
+        link.hold_wakes--;
+        return;
+    }
+
+    int rssi = average_rssi();
+    struct link_setting next = link.current;
+
+    if (rssi < LINK_MARGINAL_RSSI) {
+        next = escalate(next);
+    } else if (next.mode != LINK_MODE_NORMAL) {
+        if (rssi > LINK_RECOVERED_RSSI) {
+            next.mode = LINK_MODE_NORMAL;
+        }
+    } else if (rssi > LINK_HIGH_RSSI && next.tx_power - LINK_TX_POWER_STEP >= LINK_TX_POWER_MIN) {
+        next.tx_power -= LINK_TX_POWER_STEP;
+    }
+
+    ESP_LOGI(TAG, "RSSI avg %d, association %d ms, %d retries", rssi, assoc_ms, retries);
+    change_setting(next, assoc_ms, retries);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+
+#define LINK_RSSI_HISTORY       8
+
+//Average RSSI above which TX power is stepped down
+#define LINK_HIGH_RSSI          -55
+//Average RSSI below which the link is considered marginal
+#define LINK_MARGINAL_RSSI      -80
+//Average RSSI at which a marginal link goes back to the normal PHY mode
+#define LINK_RECOVERED_RSSI     -72
+
+//TX power limits in 0.25 dBm units, as taken by esp_wifi_set_max_tx_power
+#define LINK_TX_POWER_MIN       34
+#define LINK_TX_POWER_MAX       80
+#define LINK_TX_POWER_STEP      8
+
+//Wakes to keep a setting after it was reverted
+#define LINK_HOLD_WAKES         8
+
+//802.11 LR only works with Espressif access points
+#define LINK_ALLOW_LR           0
+
+enum link_mode {
+    LINK_MODE_NORMAL = 0,
+    LINK_MODE_11B,
+    LINK_MODE_LR,
+};
+
+/* Call after esp_wifi_init and before esp_wifi_start */
+void link_apply_protocol(void);
+
+/* Call after esp_wifi_start and before esp_wifi_connect */
+void link_apply_tx_power(void);
+
+/*
+ * @brief Record how the connection attempt went and pick the setting for the next wake
+ *
+ * @param connected Whether the station got an IP.
+ * @param assoc_ms Time from esp_wifi_start to got IP, or to giving up.
+ * @param retries Reconnection attempts used.
+ */
+void link_record_result(bool connected, int assoc_ms, int retries);
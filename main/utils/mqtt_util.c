@@ -13,18 +13,66 @@
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
+#include "freertos/event_groups.h"
 
 #include "lwip/sockets.h"
 #include "lwip/dns.h"
 #include "lwip/netdb.h"
 
 #include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_mac.h"
 #include "mqtt_client.h"
 
+#include "mqtt_util.h"
+#include "config_util.h"
+#include "dlog_util.h"
+#include "diag_util.h"
+#include "ota_util.h"
+
 static const char *TAG = "MQTT";
 
 esp_mqtt_client_handle_t client;
 
+static EventGroupHandle_t mqtt_event_group;
+static StaticEventGroup_t mqtt_event_group_buf;
+
+#if CONFIG_PM_ENABLE
+/* Publishing is CPU bound (encoding, TCP/IP), run it at full clock and go back to idle quickly */
+static esp_pm_lock_handle_t publish_pm_lock;
+#endif
+
+#if CONFIG_MQTT_PROTOCOL_5
+/* Topic of alias index + 1, the broker learns an alias from the first publish of each connection */
+static char alias_topics[MQTT_TOPIC_ALIAS_MAX][40];
+static bool alias_sent[MQTT_TOPIC_ALIAS_MAX];
+/* Set on a reconnect that happened while the app task held alias_mutex */
+static volatile bool alias_stale;
+/* Publish properties last set by the app task */
+static esp_mqtt5_publish_property_config_t app_property;
+static portMUX_TYPE app_property_lock = portMUX_INITIALIZER_UNLOCKED;
+/* Held across setting the publish properties, the publish and the alias state */
+static SemaphoreHandle_t alias_mutex;
+static StaticSemaphore_t alias_mutex_buf;
+#endif
+
+struct tracked_publish {
+    int msg_id;
+    bool acked;
+};
+
+/* Written by the app task when publishing and by the MQTT task on PUBACK */
+static struct tracked_publish tracked[MQTT_TRACK_MAX];
+static int tracked_count;
+static portMUX_TYPE tracked_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static char device_id[MQTT_DEVICE_ID_LEN + 1];
+static char config_topic[40];
+static char status_topic[40];
+static char cmd_topic[40];
+static char dlog_topic[40];
+static char diag_topic[40];
+
 static void log_error_if_nonzero(const char *message, int error_code)
 {
     if (error_code != 0) {
@@ -32,6 +80,215 @@ static void log_error_if_nonzero(const char *message, int error_code)
     }
 }
 
+#if CONFIG_MQTT_PROTOCOL_5
+static int topic_alias(const char* topic)
+{
+    for (int i = 0; i < MQTT_TOPIC_ALIAS_MAX; i++) {
+        if (alias_topics[i][0] == '\0' && strlen(topic) < sizeof(alias_topics[i])) {
+            strcpy(alias_topics[i], topic);
+        }
+        if (strcmp(alias_topics[i], topic) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * The publish properties are client state set apart from the publish. Both are made under
+ * alias_mutex. The event handler runs with the client locked, so it cannot wait for the
+ * mutex: when the app task holds it, the app task is between its calls and the handler
+ * publishes without an alias and puts back the properties the app task set.
+ */
+static int publish_unaliased(const char* topic, const char* data, int len, int qos)
+{
+    esp_mqtt5_publish_property_config_t property = {0};
+    esp_mqtt5_publish_property_config_t restore;
+
+    esp_mqtt5_client_set_publish_property(client, &property);
+    int msg_id = esp_mqtt_client_publish(client, topic, data, len, qos, 0);
+    portENTER_CRITICAL(&app_property_lock);
+    restore = app_property;
+    portEXIT_CRITICAL(&app_property_lock);
+    esp_mqtt5_client_set_publish_property(client, &restore);
+    return msg_id;
+}
+
+static int publish_aliased(const char* topic, const char* data, int len, int qos, bool from_event)
+{
+    if (xSemaphoreTake(alias_mutex, from_event ? 0 : portMAX_DELAY) != pdTRUE) {
+        return publish_unaliased(topic, data, len, qos);
+    }
+    if (alias_stale) {
+        memset(alias_sent, 0, sizeof(alias_sent));
+        alias_stale = false;
+    }
+
+    /*
+     * Once the broker knows the alias the topic name is sent empty. Only for QoS 0, a QoS 1
+     * publish can be resent from the outbox on a later connection that does not know it, so
+     * it keeps the full topic and the alias property would only add bytes.
+     */
+    esp_mqtt5_publish_property_config_t property = {
+        .topic_alias = qos == 0 ? topic_alias(topic) : 0,
+    };
+    int alias = property.topic_alias;
+    bool elide = alias && alias_sent[alias - 1];
+
+    if (!from_event) {
+        portENTER_CRITICAL(&app_property_lock);
+        app_property = property;
+        portEXIT_CRITICAL(&app_property_lock);
+    }
+    esp_mqtt5_client_set_publish_property(client, &property);
+    int msg_id = esp_mqtt_client_publish(client, elide ? "" : topic, data, len, qos, 0);
+    if (msg_id < 0 && alias) {
+        /* The broker allows fewer aliases than we use */
+        property.topic_alias = 0;
+        if (!from_event) {
+            portENTER_CRITICAL(&app_property_lock);
+            app_property = property;
+            portEXIT_CRITICAL(&app_property_lock);
+        }
+        esp_mqtt5_client_set_publish_property(client, &property);
+        msg_id = esp_mqtt_client_publish(client, topic, data, len, qos, 0);
+    } else if (alias) {
+        alias_sent[alias - 1] = true;
+    }
+
+    if (from_event) {
+        esp_mqtt5_client_set_publish_property(client, &app_property);
+    }
+    xSemaphoreGive(alias_mutex);
+    return msg_id;
+}
+
+static void set_connect_properties(void)
+{
+    esp_mqtt5_connection_property_config_t property = {
+        .session_expiry_interval = MQTT_SESSION_EXPIRY_SEC,
+    };
+    esp_mqtt5_user_property_item_t items[] = {
+        {"device", mqtt_device_id()},
+        {"schema", MQTT_RECORD_SCHEMA},
+    };
+
+    esp_mqtt5_client_set_user_property(&property.user_property, items, sizeof(items) / sizeof(items[0]));
+    esp_mqtt5_client_set_connect_property(client, &property);
+    esp_mqtt5_client_delete_user_property(property.user_property);
+}
+#else
+static int publish_aliased(const char* topic, const char* data, int len, int qos, bool from_event)
+{
+    return esp_mqtt_client_publish(client, topic, data, len, qos, 0);
+}
+#endif
+
+/* The PUBACK can be handled before the publishing task records the id, in any order the entry ends up acked */
+static void track_publish(int msg_id, bool acked)
+{
+    int i;
+
+    portENTER_CRITICAL(&tracked_lock);
+    for (i = 0; i < tracked_count && tracked[i].msg_id != msg_id; i++) {
+    }
+    if (i == MQTT_TRACK_MAX) {
+        /* Only a long running gateway fills the table, the acked entries make room */
+        int kept = 0;
+        for (int j = 0; j < tracked_count; j++) {
+            if (!tracked[j].acked) {
+                tracked[kept++] = tracked[j];
+            }
+        }
+        tracked_count = kept;
+        i = kept;
+    }
+    if (i == tracked_count && tracked_count < MQTT_TRACK_MAX) {
+        tracked[i].msg_id = msg_id;
+        tracked[i].acked = false;
+        tracked_count++;
+    }
+    if (i < tracked_count && acked) {
+        tracked[i].acked = true;
+    }
+    portEXIT_CRITICAL(&tracked_lock);
+}
+
+static int tracked_pending(void)
+{
+    int pending = 0;
+
+    portENTER_CRITICAL(&tracked_lock);
+    for (int i = 0; i < tracked_count; i++) {
+        pending += !tracked[i].acked;
+    }
+    portEXIT_CRITICAL(&tracked_lock);
+    return pending;
+}
+
+static int publish(const char* topic, const char* data, int len, int qos)
+{
+    return publish_aliased(topic, data, len, qos, false);
+}
+
+static int publish_from_event(const char* topic, const char* data, int len, int qos)
+{
+    return publish_aliased(topic, data, len, qos, true);
+}
+
+static int upload_dlog(bool from_event)
+{
+    int size;
+    const void* buf = dlog_buffer(&size);
+
+    int msg_id = publish_aliased(dlog_topic, buf, size, 1, from_event);
+    if (msg_id >= 0) {
+        dlog_clear();
+    }
+    return msg_id;
+}
+
+static void handle_config_update(const char* data, int len)
+{
+    char status[64];
+
+    /* Empty retained message means the config was cleared on the broker */
+    if (len > 0) {
+        sensor_config_apply(&sensor_cfg, data, len, status, sizeof(status));
+        ESP_LOGI(TAG, "%s", status);
+        publish_from_event(status_topic, status, 0, 1);
+    }
+    xEventGroupSetBits(mqtt_event_group, MQTT_CONFIG_BIT);
+}
+
+static void handle_command(const char* data, int len)
+{
+    char cmd[OTA_URL_MAX_LEN + 160];
+    char* save_ptr;
+
+    if (len <= 0 || len >= sizeof(cmd)) {
+        ESP_LOGW(TAG, "Command too long");
+        return;
+    }
+    memcpy(cmd, data, len);
+    cmd[len] = '\0';
+
+    char* name = strtok_r(cmd, " ", &save_ptr);
+    if (name != NULL && strcmp(name, "dlog") == 0) {
+        upload_dlog(true);
+    } else if (name != NULL && strcmp(name, "ota") == 0) {
+        /* ota <seq> <url> <sha256> <hmac>, only recorded here, the download runs after the uplink */
+        char* seq = strtok_r(NULL, " ", &save_ptr);
+        char* url = strtok_r(NULL, " ", &save_ptr);
+        char* sha256 = strtok_r(NULL, " ", &save_ptr);
+        char* tag = strtok_r(NULL, " ", &save_ptr);
+        esp_err_t err = ota_request(seq, url, sha256, tag);
+        publish_from_event(status_topic, err == ESP_OK ? "ota accepted" : "ota rejected", 0, 1);
+    } else {
+        ESP_LOGW(TAG, "Unknown command %s", cmd);
+    }
+}
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
     //ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=" PRId32, base, event_id);// Can't make this line work
@@ -40,11 +297,26 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     int msg_id;
     switch ((esp_mqtt_event_id_t)event_id) {
     case MQTT_EVENT_CONNECTED:
-        //msg_id = esp_mqtt_client_subscribe(client, "hello", 0);
         ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+#if CONFIG_MQTT_PROTOCOL_5
+        /* Aliases only live as long as the network connection */
+        if (xSemaphoreTake(alias_mutex, 0) == pdTRUE) {
+            memset(alias_sent, 0, sizeof(alias_sent));
+            xSemaphoreGive(alias_mutex);
+        } else {
+            alias_stale = true;
+        }
+#endif
+        /* Retained config updates are delivered right after the subscription */
+        msg_id = esp_mqtt_client_subscribe(client, config_topic, 1);
+        ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", config_topic, msg_id);
+        msg_id = esp_mqtt_client_subscribe(client, cmd_topic, 1);
+        ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", cmd_topic, msg_id);
+        xEventGroupSetBits(mqtt_event_group, MQTT_CONNECTED_BIT);
         break;
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        xEventGroupClearBits(mqtt_event_group, MQTT_CONNECTED_BIT);
         break;
     case MQTT_EVENT_SUBSCRIBED:
         ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -53,12 +325,19 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
         break;
     case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        DLOGD("MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        track_publish(event->msg_id, true);
+        xEventGroupSetBits(mqtt_event_group, MQTT_PUBACK_BIT);
         break;
     case MQTT_EVENT_DATA:
         ESP_LOGI(TAG, "MQTT_EVENT_DATA");
         printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
         printf("DATA=%.*s\r\n", event->data_len, event->data);
+        if (event->topic_len == strlen(config_topic) && strncmp(event->topic, config_topic, event->topic_len) == 0) {
+            handle_config_update(event->data, event->data_len);
+        } else if (event->topic_len == strlen(cmd_topic) && strncmp(event->topic, cmd_topic, event->topic_len) == 0) {
+            handle_command(event->data, event->data_len);
+        }
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
@@ -76,18 +355,143 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     }
 }
 
+const char* mqtt_device_id(void)
+{
+    if (device_id[0] == '\0') {
+        uint8_t mac[6];
+        esp_read_mac(mac, ESP_MAC_WIFI_STA);
+        sprintf(device_id, MACSTR, MAC2STR(mac));
+    }
+    return device_id;
+}
+
 void mqtt_client_init(void)
 {
+    mqtt_event_group = xEventGroupCreateStatic(&mqtt_event_group_buf);
+    tracked_count = 0;
+#if CONFIG_PM_ENABLE
+    if (publish_pm_lock == NULL) {
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "mqtt_publish", &publish_pm_lock));
+    }
+#endif
+    snprintf(config_topic, sizeof(config_topic), MQTT_CONFIG_TOPIC_FMT, mqtt_device_id());
+    snprintf(status_topic, sizeof(status_topic), MQTT_STATUS_TOPIC_FMT, mqtt_device_id());
+    snprintf(cmd_topic, sizeof(cmd_topic), MQTT_CMD_TOPIC_FMT, mqtt_device_id());
+    snprintf(dlog_topic, sizeof(dlog_topic), MQTT_DLOG_TOPIC_FMT, mqtt_device_id());
+    snprintf(diag_topic, sizeof(diag_topic), MQTT_DIAG_TOPIC_FMT, mqtt_device_id());
+
     esp_mqtt_client_config_t mqtt_cfg = {
         .broker.address.uri = "mqtt://52.47.198.222:1883",
+        .credentials.client_id = mqtt_device_id(),
+#if CONFIG_MQTT_PROTOCOL_5
+        .session.protocol_ver = MQTT_PROTOCOL_V_5,
+#endif
+        .buffer.size = CONFIG_UPLINK_MQTT_BUFFER_SIZE,
+        .buffer.out_size = CONFIG_UPLINK_MQTT_OUT_BUFFER_SIZE,
+        .task.stack_size = CONFIG_UPLINK_MQTT_TASK_STACK_SIZE,
     };
 
     client = esp_mqtt_client_init(&mqtt_cfg);
+#if CONFIG_MQTT_PROTOCOL_5
+    if (alias_mutex == NULL) {
+        alias_mutex = xSemaphoreCreateMutexStatic(&alias_mutex_buf);
+    }
+    /* The status topic is published from the event handler, give it its alias before connecting */
+    topic_alias(status_topic);
+    set_connect_properties();
+#endif
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(client);
 }
 
-void mqtt_send_data(const char * topic, const char * data)
+int mqtt_send_data(const char * topic, const char * data)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(publish_pm_lock);
+#endif
+    int msg_id = publish(topic, data, 0, 1);
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(publish_pm_lock);
+#endif
+    if (msg_id >= 0) {
+        track_publish(msg_id, false);
+    }
+    return msg_id;
+}
+
+int mqtt_upload_dlog(void)
 {
-    esp_mqtt_client_publish(client, topic, data, 0, 1, 0);
+    return upload_dlog(false);
+}
+
+int mqtt_send_diag(void)
+{
+    static char diag[1024];
+    int len = diag_format(diag, sizeof(diag));
+    if (len == 0) {
+        return -1;
+    }
+
+    int msg_id = publish(diag_topic, diag, len, 0);
+    if (msg_id >= 0) {
+        diag_published();
+    }
+    return msg_id;
+}
+
+bool mqtt_wait_connected(int timeout_ms)
+{
+    EventBits_t bits = xEventGroupWaitBits(mqtt_event_group, MQTT_CONNECTED_BIT, pdFALSE, pdTRUE, timeout_ms / portTICK_PERIOD_MS);
+    return (bits & MQTT_CONNECTED_BIT) != 0;
+}
+
+bool mqtt_wait_config(int timeout_ms)
+{
+    EventBits_t bits = xEventGroupWaitBits(mqtt_event_group, MQTT_CONFIG_BIT, pdFALSE, pdTRUE, timeout_ms / portTICK_PERIOD_MS);
+    return (bits & MQTT_CONFIG_BIT) != 0;
+}
+
+bool mqtt_flush(int timeout_ms)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+
+    for (;;) {
+        /* QoS 1 publishes of other modules (dlog, status) are only seen through the outbox */
+        int pending = tracked_pending();
+        if (pending == 0 && esp_mqtt_client_get_outbox_size(client) == 0) {
+            return true;
+        }
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            DLOGW("Flush timed out, %d publishes not acked", pending);
+            return false;
+        }
+        TickType_t wait = timeout - elapsed;
+        if (wait > pdMS_TO_TICKS(MQTT_FLUSH_POLL_MS)) {
+            wait = pdMS_TO_TICKS(MQTT_FLUSH_POLL_MS);
+        }
+        xEventGroupWaitBits(mqtt_event_group, MQTT_PUBACK_BIT, pdTRUE, pdFALSE, wait);
+    }
+}
+
+void mqtt_stop(void)
+{
+    /* Sends DISCONNECT first when connected, the broker then drops the will and the session cleanly */
+    esp_mqtt_client_stop(client);
+}
+
+bool mqtt_delivered(int msg_id)
+{
+    bool acked = false;
+
+    portENTER_CRITICAL(&tracked_lock);
+    for (int i = 0; i < tracked_count; i++) {
+        if (tracked[i].msg_id == msg_id) {
+            acked = tracked[i].acked;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&tracked_lock);
+    return acked;
 }
\ No newline at end of file
@@ -1,5 +1,43 @@
 #pragma once
 
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+#define MQTT_CONFIG_TOPIC_FMT   "sensor/%s/config"
+#define MQTT_STATUS_TOPIC_FMT   "sensor/%s/status"
+#define MQTT_CMD_TOPIC_FMT      "sensor/%s/cmd"
+#define MQTT_DLOG_TOPIC_FMT     "sensor/%s/dlog"
+#define MQTT_DIAG_TOPIC_FMT     "sensor/%s/diag"
+
+#define MQTT_CONNECTED_BIT      BIT0
+#define MQTT_CONFIG_BIT         BIT1
+#define MQTT_PUBACK_BIT         BIT2
+
+/* Publishes of mqtt_send_data whose PUBACK is tracked, beyond that they count as undelivered */
+#define MQTT_TRACK_MAX          48
+/* Outbox check interval of mqtt_flush, a PUBACK ends the wait earlier */
+#define MQTT_FLUSH_POLL_MS      50
+
+/* Device id, the station MAC as "xx:xx:xx:xx:xx:xx" */
+#define MQTT_DEVICE_ID_LEN      17
+
+/* Version of the reading record format */
+#define MQTT_RECORD_SCHEMA      "1"
+
+#if CONFIG_UPLINK_TRANSPORT_ESPNOW
+/* The gateway prefixes every record with the MAC of the node it came from */
+#define MQTT_RECORD_HAS_ID      0
+#elif CONFIG_MQTT_PROTOCOL_5
+/* The device id and schema are CONNECT user properties, sent once per session instead of in every record */
+#define MQTT_RECORD_HAS_ID      0
+#else
+#define MQTT_RECORD_HAS_ID      1
+#endif
+/* Topics that get a topic alias, the first QoS 0 ones published in a session */
+#define MQTT_TOPIC_ALIAS_MAX    4
+/* Clean start every wake, the broker can drop the session as soon as the connection closes */
+#define MQTT_SESSION_EXPIRY_SEC 0
+
 /*
  * @brief Event handler registered to receive MQTT events
  *
@@ -13,4 +51,28 @@
 
 void mqtt_client_init(void);
 
-void mqtt_send_data(const char * topic, const char * data);
\ No newline at end of file
+/* Returns the message id, or -1 if the message could not be queued */
+int mqtt_send_data(const char * topic, const char * data);
+
+/* Returns the station MAC formatted as aa:bb:cc:dd:ee:ff, used as the device id in topics */
+const char* mqtt_device_id(void);
+
+/* Publishes the deferred log buffer and clears it once queued */
+int mqtt_upload_dlog(void);
+
+/* Publishes heap, stack and task runtime diagnostics */
+int mqtt_send_diag(void);
+
+bool mqtt_wait_connected(int timeout_ms);
+
+/* Waits for the retained config message that the broker sends right after subscribing */
+bool mqtt_wait_config(int timeout_ms);
+
+/* Waits until every publish of mqtt_send_data is acked and the outbox is empty, false on timeout */
+bool mqtt_flush(int timeout_ms);
+
+/* Sends DISCONNECT and stops the client task */
+void mqtt_stop(void);
+
+/* Whether the broker acked the publish mqtt_send_data returned msg_id for, until the next mqtt_client_init */
+bool mqtt_delivered(int msg_id);
\ No newline at end of file
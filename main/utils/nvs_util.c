@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "esp_err.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
@@ -101,16 +102,21 @@ esp_err_t set_saved_config(struct sensor_config* sensor)
     err = open_nvs("saved_params", &my_handle);
 
     if (err != ESP_OK) return err;
-    
-    size_t required_size = sizeof(struct sensor_config);
 
-    err = nvs_set_blob(my_handle, "saved_config", sensor, required_size);
+    uint8_t blob[sizeof(struct saved_config_header) + sizeof(struct sensor_config)];
+    struct saved_config_header header = {
+        .magic = SAVED_CONFIG_MAGIC,
+        .version = SAVED_CONFIG_VERSION,
+    };
+    memcpy(blob, &header, sizeof(header));
+    memcpy(blob + sizeof(header), sensor, sizeof(*sensor));
 
-    if (err != ESP_OK) return err;
+    err = nvs_set_blob(my_handle, "saved_config", blob, sizeof(blob));
 
-    // Commit
-    err = nvs_commit(my_handle);
-    if (err != ESP_OK) return err;
+    if (err == ESP_OK) {
+        // Commit
+        err = nvs_commit(my_handle);
+    }
 
     // Close
     nvs_close(my_handle);
@@ -128,26 +134,39 @@ esp_err_t get_saved_config(struct sensor_config* sensor)
 
     if (err != ESP_OK) return err;
 
+    static uint8_t blob[SAVED_CONFIG_MAX_LEN];
+    size_t required_size = sizeof(blob);
+    err = nvs_get_blob(my_handle, "saved_config", blob, &required_size);
+    nvs_close(my_handle);
 
-    size_t required_size = 0;  // value will default to 0, if not set yet in NVS
-    err = nvs_get_blob(my_handle, "saved_config", NULL, &required_size);
-
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) return err;
-
-
-    if (required_size == 0) {
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
         ESP_LOGE(TAG, "There is no saved configuration!");
         return err;
-    } else {
-
-        err = nvs_get_blob(my_handle, "saved_config", sensor, &required_size);
+    } else if (err != ESP_OK) {
+        return err;
+    }
 
-        if (err != ESP_OK) {
-            return err;
+    struct saved_config_header header;
+    const uint8_t* fields = blob;
+    size_t fields_len = required_size;
+    int version = 1;
+    if (required_size >= sizeof(header)) {
+        memcpy(&header, blob, sizeof(header));
+        if (header.magic == SAVED_CONFIG_MAGIC) {
+            version = header.version;
+            fields += sizeof(header);
+            fields_len -= sizeof(header);
         }
+    }
 
-        return err;
+    /* Only the common prefix is taken, fields the blob does not have keep the values already in sensor */
+    memcpy(sensor, fields, fields_len < sizeof(*sensor) ? fields_len : sizeof(*sensor));
+    if (version != SAVED_CONFIG_VERSION || fields_len != sizeof(*sensor)) {
+        ESP_LOGW(TAG, "Migrating saved configuration v%d of %u bytes to v%d of %u", version, (unsigned)fields_len,
+                    SAVED_CONFIG_VERSION, (unsigned)sizeof(*sensor));
+        set_saved_config(sensor);
     }
+    return ESP_OK;
 }
 
 esp_err_t set_saved_readings(int* temp, float* ph, int size) 
@@ -1,20 +1,52 @@
 
 #pragma once
 
+#include <stdint.h>
 #include "nvs_flash.h"
 #include "esp_wifi_types.h"
 
+#define MAX_SAVED_READINGS 32
+
+/*
+ * The saved config blob is a saved_config_header followed by struct sensor_config.
+ * Fields are only ever appended to the struct: a blob of another version keeps its
+ * common prefix and the rest stays at the defaults. Blobs saved before the header
+ * existed start with readings, which never matches the magic.
+ */
+#define SAVED_CONFIG_MAGIC      0xC0F6
+#define SAVED_CONFIG_VERSION    2
+#define SAVED_CONFIG_MAX_LEN    256
+
+struct saved_config_header
+{
+    uint16_t magic;
+    uint16_t version;
+};
+
 struct sensor_config
 {
     //Number of readings on each day
     int readings;
-    //Number of readings done on this day
+    //Unused, the live counters are in RTC memory (counter_util), kept for the saved blob prefix
     int current_readings;
     //Number of times the sensor wakes up to check alarms before 
     //registering a reading
     int wb_reading;
-    //Number of times the sensor has woken up before reading
+    //Unused, see current_readings
     int current_wb_readings;
+    //Seconds spent in deep sleep between wake ups
+    int sleep_interval;
+    //Minimum change from the last registered reading that counts as an alarm
+    float ph_deadband;
+    int temp_deadband;
+    int hum_deadband;
+    int infiltration_deadband;
+    //Number of stored readings that triggers an uplink
+    int batch_low;
+    //Maximum number of stored readings before the oldest ones are dropped
+    int batch_high;
+    //Wake ups between diagnostics publishes, 0 disables them
+    int diag_interval;
 };
 
 
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "esp_crt_bundle.h"
+#include "esp_delta_ota.h"
+#include "nvs_flash.h"
+#include "mbedtls/md.h"
+
+#include "ota_util.h"
+#include "nvs_util.h"
+
+static const char *TAG = "OTA_UTIL";
+
+static char ota_url[OTA_URL_MAX_LEN];
+static uint8_t ota_sha256[32];
+
+static const esp_partition_t *source_partition;
+static esp_ota_handle_t ota_handle;
+
+static esp_err_t read_source(uint8_t *buf_p, size_t size, int src_offset)
+{
+    if (size <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_partition_read(source_partition, src_offset, buf_p, size);
+}
+
+static esp_err_t write_target(const uint8_t *buf_p, size_t size)
+{
+    if (size <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_ota_write(ota_handle, buf_p, size);
+}
+
+static bool parse_hex(const char* hex, uint8_t* out, int len)
+{
+    if (strlen(hex) != (size_t)(2 * len) || strspn(hex, "0123456789abcdefABCDEF") != (size_t)(2 * len)) {
+        return false;
+    }
+    for (int i = 0; i < len; i++) {
+        unsigned int byte;
+        sscanf(&hex[i * 2], "%2x", &byte);
+        out[i] = byte;
+    }
+    return true;
+}
+
+esp_err_t ota_pair(const uint8_t* data, int len)
+{
+    char text[80];
+    uint8_t k[OTA_KEY_LEN];
+
+    if (len <= 0 || len >= (int)sizeof(text)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    memcpy(text, data, len);
+    text[len] = '\0';
+    if (strncmp(text, "otakey ", 7) != 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    const char* hex = text + 7;
+    bool remove = strcmp(hex, "none") == 0;
+    if (!remove && !parse_hex(hex, k, OTA_KEY_LEN)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    if (remove) {
+        err = nvs_erase_key(my_handle, OTA_KEY_KEY);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    } else {
+        err = nvs_set_blob(my_handle, OTA_KEY_KEY, k, sizeof(k));
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(my_handle);
+    }
+    nvs_close(my_handle);
+
+    ESP_LOGI(TAG, "Update key %s", remove ? "removed" : "saved");
+    return err;
+}
+
+/* HMAC over the station MAC and the command text, the MAC binds a command to one node */
+static void command_tag(const uint8_t* key, const char* text, uint8_t* tag)
+{
+    uint8_t mac[6];
+    mbedtls_md_context_t md;
+
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    mbedtls_md_init(&md);
+    mbedtls_md_setup(&md, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+    mbedtls_md_hmac_starts(&md, key, OTA_KEY_LEN);
+    mbedtls_md_hmac_update(&md, mac, sizeof(mac));
+    mbedtls_md_hmac_update(&md, (const uint8_t*)text, strlen(text));
+    mbedtls_md_hmac_finish(&md, tag);
+    mbedtls_md_free(&md);
+}
+
+esp_err_t ota_request(const char* seq, const char* url, const char* sha256, const char* tag)
+{
+#if CONFIG_SPLIT_IMAGES
+    /* Patches are made against one running image and the next update slot would be the timer wake image */
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+    uint8_t key[OTA_KEY_LEN];
+    uint8_t expected[32];
+    uint8_t received[32];
+    char text[OTA_URL_MAX_LEN + 96];
+    char* end;
+
+    if (seq == NULL || url == NULL || sha256 == NULL || tag == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(url) >= OTA_URL_MAX_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    /* Nine digits always fit the saved uint32_t */
+    unsigned long number = strtoul(seq, &end, 10);
+    if (*seq == '\0' || *end != '\0' || strlen(seq) > 9
+        || !parse_hex(sha256, ota_sha256, sizeof(ota_sha256)) || !parse_hex(tag, received, sizeof(received))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    size_t key_len = sizeof(key);
+    err = nvs_get_blob(my_handle, OTA_KEY_KEY, key, &key_len);
+    if (err != ESP_OK || key_len != sizeof(key)) {
+        ESP_LOGW(TAG, "No update key paired, command refused");
+        nvs_close(my_handle);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    snprintf(text, sizeof(text), "ota %s %s %s", seq, url, sha256);
+    command_tag(key, text, expected);
+    uint8_t diff = 0;
+    for (int i = 0; i < (int)sizeof(expected); i++) {
+        diff |= expected[i] ^ received[i];
+    }
+    if (diff != 0) {
+        ESP_LOGW(TAG, "Update command with a bad tag");
+        nvs_close(my_handle);
+        return ESP_ERR_INVALID_MAC;
+    }
+
+    uint32_t last = 0;
+    nvs_get_u32(my_handle, OTA_SEQ_KEY, &last);
+    if (number <= last) {
+        ESP_LOGW(TAG, "Update command %lu replayed, last was %lu", number, (unsigned long)last);
+        nvs_close(my_handle);
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* Used up before the download so a failed update cannot be replayed either */
+    err = nvs_set_u32(my_handle, OTA_SEQ_KEY, number);
+    if (err == ESP_OK) {
+        err = nvs_commit(my_handle);
+    }
+    nvs_close(my_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    strlcpy(ota_url, url, sizeof(ota_url));
+    ESP_LOGI(TAG, "Update %lu requested from %s", number, ota_url);
+    return ESP_OK;
+}
+
+bool ota_requested(void)
+{
+    return ota_url[0] != '\0';
+}
+
+static esp_err_t stream_patch(esp_http_client_handle_t http, esp_delta_ota_handle_t patcher)
+{
+    static uint8_t chunk[OTA_CHUNK_SIZE];
+    esp_err_t err = esp_http_client_open(http, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    esp_http_client_fetch_headers(http);
+    if (esp_http_client_get_status_code(http) != 200) {
+        ESP_LOGE(TAG, "HTTP status %d", esp_http_client_get_status_code(http));
+        return ESP_FAIL;
+    }
+
+    int total = 0;
+    int len;
+    while ((len = esp_http_client_read(http, (char*)chunk, sizeof(chunk))) > 0) {
+        err = esp_delta_ota_feed_patch(patcher, chunk, len);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Patch failed at byte %d: %s", total, esp_err_to_name(err));
+            return err;
+        }
+        total += len;
+    }
+    if (len < 0 || !esp_http_client_is_complete_data_received(http)) {
+        ESP_LOGE(TAG, "Download interrupted after %d bytes", total);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Patch of %d bytes applied", total);
+    return ESP_OK;
+}
+
+static esp_err_t verify_target(const esp_partition_t* target)
+{
+    uint8_t sha256[32];
+
+    esp_err_t err = esp_partition_get_sha256(target, sha256);
+    if (err == ESP_OK && memcmp(sha256, ota_sha256, sizeof(sha256)) != 0) {
+        ESP_LOGE(TAG, "Patched image does not match the expected SHA-256");
+        err = ESP_ERR_INVALID_CRC;
+    }
+    return err;
+}
+
+esp_err_t ota_apply(void)
+{
+    esp_err_t err;
+
+    source_partition = esp_ota_get_running_partition();
+    const esp_partition_t *target = esp_ota_get_next_update_partition(NULL);
+    if (target == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_http_client_config_t http_cfg = {
+        .url = ota_url,
+        .timeout_ms = OTA_HTTP_TIMEOUT_MS,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+    };
+    esp_http_client_handle_t http = esp_http_client_init(&http_cfg);
+    if (http == NULL) {
+        return ESP_FAIL;
+    }
+
+    err = esp_ota_begin(target, OTA_SIZE_UNKNOWN, &ota_handle);
+    if (err != ESP_OK) {
+        esp_http_client_cleanup(http);
+        return err;
+    }
+
+    esp_delta_ota_cfg_t cfg = {
+        .read_cb = read_source,
+        .write_cb = write_target,
+    };
+    esp_delta_ota_handle_t patcher = esp_delta_ota_init(&cfg);
+    if (patcher == NULL) {
+        err = ESP_FAIL;
+    } else {
+        err = stream_patch(http, patcher);
+        if (err == ESP_OK) {
+            err = esp_delta_ota_finalize(patcher);
+        }
+        esp_delta_ota_deinit(patcher);
+    }
+    esp_http_client_close(http);
+    esp_http_client_cleanup(http);
+
+    if (err != ESP_OK) {
+        esp_ota_abort(ota_handle);
+        ota_url[0] = '\0';
+        return err;
+    }
+
+    /* esp_ota_end checks the image header, segments and appended hash */
+    err = esp_ota_end(ota_handle);
+    if (err == ESP_OK) {
+        err = verify_target(target);
+    }
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(target);
+    }
+
+    ota_url[0] = '\0';
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Update written to %s", target->label);
+    } else {
+        ESP_LOGE(TAG, "Update rejected: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+bool ota_pending_verify(void)
+{
+    esp_ota_img_states_t state;
+
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) != ESP_OK) {
+        return false;
+    }
+    return state == ESP_OTA_IMG_PENDING_VERIFY;
+}
+
+void ota_confirm(void)
+{
+    if (ota_pending_verify()) {
+        ESP_LOGI(TAG, "New image confirmed");
+        esp_ota_mark_app_valid_cancel_rollback();
+    }
+}
+
+void ota_reject(void)
+{
+    if (ota_pending_verify()) {
+        ESP_LOGE(TAG, "New image failed its first uplink, rolling back");
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define OTA_URL_MAX_LEN         128
+//Patch bytes fed to the patcher at a time, bounds the RAM used by the download
+#define OTA_CHUNK_SIZE          1024
+#define OTA_HTTP_TIMEOUT_MS     10000
+//NVS keys of the command key and of the last accepted command sequence number
+#define OTA_KEY_KEY             "ota_key"
+#define OTA_KEY_LEN             32
+#define OTA_SEQ_KEY             "ota_seq"
+
+/*
+ * Delta firmware updates: a detools patch against the running image is streamed over
+ * HTTP(S), applied into the inactive OTA slot and verified. The new image confirms itself
+ * after its first successful uplink, otherwise the bootloader rolls it back.
+ */
+
+/*
+ * @brief Save the command key sent as BluFi custom data: "otakey <64 hex digits>"
+ *
+ * Update commands are refused until a key is saved, "otakey none" removes it.
+ *
+ * @return ESP_ERR_NOT_SUPPORTED when the data is not an OTA key.
+ */
+esp_err_t ota_pair(const uint8_t* data, int len);
+
+/*
+ * @brief Request an update, applied by ota_apply() once the uplink is done
+ *
+ * The command is authenticated with HMAC-SHA256 under the paired key over the station MAC
+ * followed by "ota <seq> <url> <sha256>". The sequence number has to be above the last
+ * accepted one so a captured command cannot be replayed.
+ *
+ * @param seq Command sequence number, decimal.
+ * @param url Patch URL.
+ * @param sha256 Expected SHA-256 of the patched image as 64 hex characters.
+ * @param tag HMAC as 64 hex characters.
+ */
+esp_err_t ota_request(const char* seq, const char* url, const char* sha256, const char* tag);
+bool ota_requested(void);
+esp_err_t ota_apply(void);
+
+/* True on the first boot of a new image, until ota_confirm() or ota_reject() */
+bool ota_pending_verify(void);
+void ota_confirm(void);
+void ota_reject(void);
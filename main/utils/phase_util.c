@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+
+#include "phase_util.h"
+
+#if CONFIG_PHASE_PROFILE
+static const char* phase_name;
+static int64_t phase_start_us;
+static uint32_t phase_start_cycles;
+
+void phase_mark(const char* name)
+{
+    int64_t now_us = esp_timer_get_time();
+    uint32_t now_cycles = esp_cpu_get_cycle_count();
+
+    if (phase_name != NULL) {
+        /* Heap in use at its lowest free point since boot, a phase that raises it set a new peak */
+        size_t heap_peak = heap_caps_get_total_size(MALLOC_CAP_8BIT) - heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+        printf("PHASE %s %lld %lu %u\n", phase_name, now_us - phase_start_us, (unsigned long)(now_cycles - phase_start_cycles),
+                (unsigned)heap_peak);
+    }
+
+    phase_name = name;
+    phase_start_us = now_us;
+    phase_start_cycles = now_cycles;
+}
+#endif
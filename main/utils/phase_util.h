@@ -0,0 +1,15 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+/*
+ * PHASE("name") ends the running phase, printing its duration, CPU cycle count and the heap
+ * peak so far, and starts the next one. PHASE(NULL) only ends the running phase. Compiled out
+ * without CONFIG_PHASE_PROFILE.
+ */
+#if CONFIG_PHASE_PROFILE
+void phase_mark(const char* name);
+#define PHASE(name)     phase_mark(name)
+#else
+#define PHASE(name)
+#endif
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+
+#include "pipeline_util.h"
+
+#define PIPE_BLOCKS         CONFIG_PIPELINE_BLOCKS
+//Above the main task, so sampling is not held up while it waits on the network
+#define PIPE_TASK_PRIORITY  3
+
+static struct pipe_block blocks[PIPE_BLOCKS];
+
+/* Queues of block pointers, the free one is the pool */
+static QueueHandle_t free_queue;
+static QueueHandle_t encode_queue;
+static QueueHandle_t send_queue;
+static StaticQueue_t free_queue_buf;
+static StaticQueue_t encode_queue_buf;
+static StaticQueue_t send_queue_buf;
+static uint8_t free_queue_storage[PIPE_BLOCKS * sizeof(struct pipe_block*)];
+static uint8_t encode_queue_storage[PIPE_BLOCKS * sizeof(struct pipe_block*)];
+static uint8_t send_queue_storage[PIPE_BLOCKS * sizeof(struct pipe_block*)];
+
+static TaskHandle_t sample_task;
+static StaticTask_t sample_task_buf;
+static StaticTask_t encode_task_buf;
+static StackType_t sample_stack[CONFIG_PIPELINE_STACK_SIZE];
+static StackType_t encode_stack[CONFIG_PIPELINE_STACK_SIZE];
+
+static pipe_encode_fn encoder;
+static struct pipe_metrics metrics;
+
+static struct pipe_block* block_get(void)
+{
+    struct pipe_block* block;
+
+    xQueueReceive(free_queue, &block, portMAX_DELAY);
+    int used = PIPE_BLOCKS - (int)uxQueueMessagesWaiting(free_queue);
+    if (used > metrics.pool_peak) {
+        metrics.pool_peak = used;
+    }
+    return block;
+}
+
+static void sample_stage(void* arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        struct pipe_block* block = block_get();
+        block->start_us = esp_timer_get_time();
+        sensors_init();
+        sensors_read(&block->reading);
+        block->sampled_us = esp_timer_get_time();
+        xQueueSend(encode_queue, &block, portMAX_DELAY);
+    }
+}
+
+static void encode_stage(void* arg)
+{
+    struct pipe_block* block;
+
+    for (;;) {
+        xQueueReceive(encode_queue, &block, portMAX_DELAY);
+        block->len = encoder(&block->reading, block->data, sizeof(block->data));
+        block->encoded_us = esp_timer_get_time();
+        xQueueSend(send_queue, &block, portMAX_DELAY);
+    }
+}
+
+void pipeline_start(pipe_encode_fn encode)
+{
+    encoder = encode;
+
+    /* The SIM build runs several cycles in one boot, the tasks and queues stay */
+    if (sample_task == NULL) {
+        free_queue = xQueueCreateStatic(PIPE_BLOCKS, sizeof(struct pipe_block*), free_queue_storage, &free_queue_buf);
+        encode_queue = xQueueCreateStatic(PIPE_BLOCKS, sizeof(struct pipe_block*), encode_queue_storage, &encode_queue_buf);
+        send_queue = xQueueCreateStatic(PIPE_BLOCKS, sizeof(struct pipe_block*), send_queue_storage, &send_queue_buf);
+        for (int i = 0; i < PIPE_BLOCKS; i++) {
+            struct pipe_block* block = &blocks[i];
+            xQueueSend(free_queue, &block, 0);
+        }
+        xTaskCreateStatic(encode_stage, "pipe_encode", CONFIG_PIPELINE_STACK_SIZE, NULL, PIPE_TASK_PRIORITY,
+                encode_stack, &encode_task_buf);
+        sample_task = xTaskCreateStatic(sample_stage, "pipe_sample", CONFIG_PIPELINE_STACK_SIZE, NULL,
+                PIPE_TASK_PRIORITY, sample_stack, &sample_task_buf);
+    }
+    xTaskNotifyGive(sample_task);
+}
+
+struct pipe_block* pipeline_take(int timeout_ms)
+{
+    struct pipe_block* block;
+
+    if (xQueueReceive(send_queue, &block, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return NULL;
+    }
+    block->taken_us = esp_timer_get_time();
+    return block;
+}
+
+void pipeline_release(struct pipe_block* block)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    metrics.sample_us = block->sampled_us - block->start_us;
+    metrics.encode_us = block->encoded_us - block->sampled_us;
+    metrics.queue_us = block->taken_us - block->encoded_us;
+    metrics.uplink_us = now_us - block->taken_us;
+    printf("PIPE %d %d %d %d %d/%d\n", metrics.sample_us, metrics.encode_us, metrics.queue_us, metrics.uplink_us,
+            metrics.pool_peak, PIPE_BLOCKS);
+
+    xQueueSend(free_queue, &block, 0);
+}
+
+const struct pipe_metrics* pipeline_metrics(void)
+{
+    return &metrics;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "sensor_util.h"
+#include "uplink_queue.h"
+
+/*
+ * Sample -> encode -> uplink pipeline of a wake. The sample and encode stages run in their
+ * own tasks and hand blocks of a fixed pool to the next stage over queues, the uplink stage
+ * takes them on the caller's task. A block is owned by one stage at a time and the record
+ * is encoded straight into the block that is published, nothing is allocated per wake.
+ */
+
+/*
+ * @brief Encoder run by the encode stage
+ *
+ * @return Length of the record written to buf, 0 when the reading produced no record.
+ */
+typedef int (*pipe_encode_fn)(const struct sensor_reading* reading, char* buf, size_t len);
+
+struct pipe_block {
+    struct sensor_reading reading;
+    int64_t start_us;
+    int64_t sampled_us;
+    int64_t encoded_us;
+    int64_t taken_us;
+    //Record length, 0 when the reading only went into the aggregate window
+    int len;
+    char data[UPLINK_ENTRY_LEN];
+};
+
+/* Stage latencies of the last block released, in us */
+struct pipe_metrics {
+    int sample_us;
+    int encode_us;
+    //Encoded until taken by the uplink stage
+    int queue_us;
+    int uplink_us;
+    //Most blocks out of the pool at once
+    int pool_peak;
+};
+
+/* Creates the pool, the queues and the stage tasks on the first call, then starts sampling one reading */
+void pipeline_start(pipe_encode_fn encode);
+
+/* Next encoded block, NULL on timeout */
+struct pipe_block* pipeline_take(int timeout_ms);
+
+/* Hands the block back to the pool and prints the PIPE metrics line */
+void pipeline_release(struct pipe_block* block);
+
+const struct pipe_metrics* pipeline_metrics(void);
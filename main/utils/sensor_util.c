@@ -3,65 +3,144 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "soc/soc_caps.h"
 #include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
 #include "esp_adc/adc_oneshot.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
 #include "driver/gpio.h"
 
+#include "sensor_util.h"
+#include "dlog_util.h"
+#if CONFIG_SENSOR_HUM_TEMP
 #include "dht11.h"
+#endif
 
 const static char *TAG = "SENSORS";
 
-#define PH_SENSOR_CHANNEL               ADC_CHANNEL_1
-#define PH_SENSOR_POWER_GPIO            GPIO_NUM_8
-#define INFILTRATION_SENSOR_CHANNEL     ADC_CHANNEL_3
-#define INFILTRATION_GPIO               GPIO_NUM_3
-#define HUM_TEMP_SENSOR_GPIO            GPIO_NUM_5 
-#define HUM_TEMP_SENSOR_POWER_GPIO      GPIO_NUM_6 
-#define WATER_LEVEL_GPIO                GPIO_NUM_7 
-
-
+#if CONFIG_SENSOR_PH
+#define PH_SENSOR_CHANNEL               CONFIG_SENSOR_PH_ADC_CHANNEL
+#define PH_SENSOR_POWER_GPIO            CONFIG_SENSOR_PH_POWER_GPIO
+#endif
+#if CONFIG_SENSOR_INFILTRATION
+#define INFILTRATION_SENSOR_CHANNEL     CONFIG_SENSOR_INFILTRATION_ADC_CHANNEL
+#define INFILTRATION_GPIO               CONFIG_SENSOR_INFILTRATION_GPIO
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+#define HUM_TEMP_SENSOR_GPIO            CONFIG_SENSOR_HUM_TEMP_GPIO
+#define HUM_TEMP_SENSOR_POWER_GPIO      CONFIG_SENSOR_HUM_TEMP_POWER_GPIO
+#endif
+#if CONFIG_SENSOR_WATER_LEVEL
+#define WATER_LEVEL_GPIO                CONFIG_SENSOR_WATER_LEVEL_GPIO
+#endif
+#if CONFIG_BATTERY_MONITOR
+#define BATTERY_CHANNEL                 CONFIG_BATTERY_ADC_CHANNEL
+//Conversions averaged per measurement
+#define BATTERY_SAMPLES                 8
+
+#if (CONFIG_SENSOR_PH && BATTERY_CHANNEL == CONFIG_SENSOR_PH_ADC_CHANNEL) || \
+    (CONFIG_SENSOR_INFILTRATION && BATTERY_CHANNEL == CONFIG_SENSOR_INFILTRATION_ADC_CHANNEL)
+#error "The battery divider needs an ADC1 channel of its own"
+#endif
+#endif
+
+static unsigned selected = SENSOR_BITS_ALL;
+
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+#define CAPTURE_RATE_HZ                 CONFIG_SENSOR_INFILTRATION_CAPTURE_RATE_HZ
+#define CAPTURE_WINDOW_MS               CONFIG_SENSOR_INFILTRATION_CAPTURE_WINDOW_MS
+#define CAPTURE_SAMPLES                 (CAPTURE_RATE_HZ * CAPTURE_WINDOW_MS / 1000)
+//The settling value is the mean of the last tenth of the window
+#define CAPTURE_SETTLE_SAMPLES          (CAPTURE_SAMPLES / 10 > 0 ? CAPTURE_SAMPLES / 10 : 1)
+
+static esp_timer_handle_t capture_timer;
+static SemaphoreHandle_t capture_done;
+static StaticSemaphore_t capture_done_buf;
+static int16_t* capture_buf;
+#if CONFIG_STATIC_ALLOCATION
+static int16_t capture_storage[CAPTURE_SAMPLES];
+#endif
+static volatile int capture_count;
+#endif
+
+#if CONFIG_SENSOR_HUM_TEMP
+#define HUM_TEMP_READ_TIMEOUT_MS        (CONFIG_SENSOR_HUM_TEMP_WARMUP_MS + (DHT11_MAX_RETRIES + 1) * DHT11_RETRY_DELAY_MS)
+
+static SemaphoreHandle_t hum_temp_done;
+static StaticSemaphore_t hum_temp_done_buf;
+static struct dht11_reading hum_temp_result;
+static bool hum_temp_started;
+#endif
+
+#if SENSOR_ADC_USED
 static int sensor_raw[2];
 static int voltage[2];
 static bool cali_done;
 adc_cali_handle_t sensor_cali_handle;
 adc_oneshot_unit_handle_t sensor_handle;
 
+#if CONFIG_PM_ENABLE
+/* Keeps the APB clock at its maximum while the ADC converts */
+static esp_pm_lock_handle_t adc_pm_lock;
+#endif
+
+static esp_err_t sensor_adc_read(adc_channel_t channel, int* raw)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(adc_pm_lock);
+#endif
+    esp_err_t err = adc_oneshot_read(sensor_handle, channel, raw);
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(adc_pm_lock);
+#endif
+    return err;
+}
+
+#if !CONFIG_SIM_STUB_BACKENDS
 /*---------------------------------------------------------------
         ADC Calibration
 ---------------------------------------------------------------*/
+/* Curve fitting where the chip has it (esp32c3), line fitting otherwise (esp32) */
 static bool sensors_calibration_init(adc_unit_t unit, adc_atten_t atten, adc_cali_handle_t *out_handle)
 {
     adc_cali_handle_t handle = NULL;
-    esp_err_t ret;
-    bool calibrated = false;
-
-    if (!calibrated) {
-        ESP_LOGI(TAG, "calibration scheme version is %s", "Curve Fitting");
-        adc_cali_curve_fitting_config_t cali_config = {
-            .unit_id = unit,
-            .atten = atten,
-            .bitwidth = ADC_BITWIDTH_DEFAULT,
-        };
-        ret = adc_cali_create_scheme_curve_fitting(&cali_config, &handle);
-        if (ret == ESP_OK) {
-            calibrated = true;
-        }
-    }
+    esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    ESP_LOGI(TAG, "calibration scheme version is %s", "Curve Fitting");
+    adc_cali_curve_fitting_config_t cali_config = {
+        .unit_id = unit,
+        .atten = atten,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    ret = adc_cali_create_scheme_curve_fitting(&cali_config, &handle);
+#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+    ESP_LOGI(TAG, "calibration scheme version is %s", "Line Fitting");
+    adc_cali_line_fitting_config_t cali_config = {
+        .unit_id = unit,
+        .atten = atten,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    ret = adc_cali_create_scheme_line_fitting(&cali_config, &handle);
+#endif
 
     *out_handle = handle;
     if (ret == ESP_OK) {
         ESP_LOGI(TAG, "Calibration Success");
-    } else if (ret == ESP_ERR_NOT_SUPPORTED || !calibrated) {
+    } else if (ret == ESP_ERR_NOT_SUPPORTED) {
         ESP_LOGW(TAG, "eFuse not burnt, skip software calibration");
     } else {
         ESP_LOGE(TAG, "Invalid arg or no memory");
     }
 
-    return calibrated;
+    return ret == ESP_OK;
 }
+#endif
+
+#endif
 
 /*static void sensor_calibration_deinit(adc_cali_handle_t handle)
 {
@@ -73,8 +152,59 @@ static bool sensors_calibration_init(adc_unit_t unit, adc_atten_t atten, adc_cal
         ADC Initiation
 ---------------------------------------------------------------*/
 
+#if CONFIG_SIM_STUB_BACKENDS
+void sensors_select(unsigned sensors)
+{
+    selected = sensors;
+}
+
+/* Fixed readings and no warm-ups, the QEMU build has no sensors attached */
 void sensors_init(void)
 {
+}
+
+void sensors_read(struct sensor_reading* reading)
+{
+    reading->sensors = selected;
+#if CONFIG_SENSOR_PH
+    reading->ph = 7.0;
+#endif
+#if CONFIG_SENSOR_INFILTRATION
+    reading->infiltration = 30;
+#endif
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+    reading->infiltration_slope = 12.5;
+    reading->infiltration_ttt_ms = CONFIG_SENSOR_INFILTRATION_CAPTURE_WINDOW_MS;
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+    reading->temp = 20;
+    reading->hum = 50;
+#endif
+#if CONFIG_SENSOR_WATER_LEVEL
+    reading->water_level = false;
+#endif
+}
+
+#if CONFIG_BATTERY_MONITOR
+int battery_read_mv(void)
+{
+    return 3900;
+}
+#endif
+#else
+#if SENSOR_ADC_USED
+/* Once per boot, the battery is measured before the sensors are powered */
+static void sensors_adc_init(void)
+{
+    if (sensor_handle != NULL) {
+        return;
+    }
+#if CONFIG_PM_ENABLE
+    if (adc_pm_lock == NULL) {
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "sensor_adc", &adc_pm_lock));
+    }
+#endif
+
     //-------------ADC1 Init---------------//
     adc_oneshot_unit_init_cfg_t init_config1 = {
         .unit_id = ADC_UNIT_1,
@@ -86,52 +216,269 @@ void sensors_init(void)
         .bitwidth = ADC_BITWIDTH_DEFAULT,
         .atten = ADC_ATTEN_DB_11,
     };
+#if CONFIG_SENSOR_PH
     ESP_ERROR_CHECK(adc_oneshot_config_channel(sensor_handle, PH_SENSOR_CHANNEL, &config));
+#endif
+#if CONFIG_SENSOR_INFILTRATION
     ESP_ERROR_CHECK(adc_oneshot_config_channel(sensor_handle, INFILTRATION_SENSOR_CHANNEL, &config));
+#endif
+#if CONFIG_BATTERY_MONITOR
+    ESP_ERROR_CHECK(adc_oneshot_config_channel(sensor_handle, BATTERY_CHANNEL, &config));
+#endif
 
     //-------------ADC1 Calibration Init---------------//
     sensor_cali_handle = NULL;
     cali_done = sensors_calibration_init(ADC_UNIT_1, ADC_ATTEN_DB_11, &sensor_cali_handle);
-    
+}
+#endif
 
-    gpio_set_direction(PH_SENSOR_POWER_GPIO, GPIO_MODE_OUTPUT);
-    gpio_set_level(PH_SENSOR_POWER_GPIO, 1);
-    ESP_LOGI(TAG, "pH Sensor Initiated");
-    vTaskDelay(20000 / portTICK_PERIOD_MS);
-    gpio_set_level(PH_SENSOR_POWER_GPIO, 0);
-    ESP_LOGI(TAG, "pH Sensor Terminated");
+void sensors_select(unsigned sensors)
+{
+    selected = sensors;
+}
 
+void sensors_init(void)
+{
+#if SENSOR_ADC_USED
+    sensors_adc_init();
+#endif
+
+#if CONFIG_SENSOR_HUM_TEMP
+    if (selected & SENSOR_BIT_HUM_TEMP) {
+        /* Powered before the blocking pH warm-up so its settle time runs meanwhile,
+           the read only waits for what is left of it */
+        gpio_set_direction(HUM_TEMP_SENSOR_POWER_GPIO, GPIO_MODE_OUTPUT);
+        gpio_sleep_sel_dis(HUM_TEMP_SENSOR_POWER_GPIO);
+        gpio_sleep_sel_dis(HUM_TEMP_SENSOR_GPIO);
+        gpio_set_level(HUM_TEMP_SENSOR_POWER_GPIO, 1);
+        DHT11_init(HUM_TEMP_SENSOR_GPIO, CONFIG_SENSOR_HUM_TEMP_WARMUP_MS);
+        ESP_LOGI(TAG, "Temp and Hum Sensor Initiated");
+    }
+#endif
+
+#if CONFIG_SENSOR_PH
+    if (selected & SENSOR_BIT_PH) {
+        gpio_set_direction(PH_SENSOR_POWER_GPIO, GPIO_MODE_OUTPUT);
+        /* Keep driving the pin while the warm-up goes into automatic light sleep */
+        gpio_sleep_sel_dis(PH_SENSOR_POWER_GPIO);
+        gpio_set_level(PH_SENSOR_POWER_GPIO, 1);
+        ESP_LOGI(TAG, "pH Sensor Initiated");
+        vTaskDelay(CONFIG_SENSOR_PH_WARMUP_MS / portTICK_PERIOD_MS);
+        gpio_set_level(PH_SENSOR_POWER_GPIO, 0);
+        ESP_LOGI(TAG, "pH Sensor Terminated");
+    }
+#endif
+}
 
-    gpio_set_direction(HUM_TEMP_SENSOR_POWER_GPIO, GPIO_MODE_OUTPUT);
-    gpio_set_level(HUM_TEMP_SENSOR_POWER_GPIO, 1);
-    ESP_LOGI(TAG, "Temp and Hum Sensor Initiated");
-    vTaskDelay(20000 / portTICK_PERIOD_MS);
-    gpio_set_level(HUM_TEMP_SENSOR_POWER_GPIO, 0);
-    ESP_LOGI(TAG, "Temp and Hum Sensor Terminated");
+void sensors_read(struct sensor_reading* reading)
+{
+    reading->sensors = selected;
+#if CONFIG_SENSOR_HUM_TEMP
+    /* Started first so the DHT11 transaction overlaps the other reads */
+    if (selected & SENSOR_BIT_HUM_TEMP) {
+        hum_temp_sensor_start();
+    }
+#endif
+#if CONFIG_SENSOR_PH
+    if (selected & SENSOR_BIT_PH) {
+        int code, volt;
+        reading->ph = ph_sensor_read(&code, &volt);
+    }
+#endif
+#if CONFIG_SENSOR_INFILTRATION
+    if (selected & SENSOR_BIT_INFILTRATION) {
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+        reading->infiltration = infiltration_capture(&reading->infiltration_slope, &reading->infiltration_ttt_ms);
+#else
+        reading->infiltration = infiltration_read();
+#endif
+    }
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+    if (selected & SENSOR_BIT_HUM_TEMP) {
+        hum_temp_sensor_read(&reading->temp, &reading->hum);
+    }
+#endif
+#if CONFIG_SENSOR_WATER_LEVEL
+    if (selected & SENSOR_BIT_WATER_LEVEL) {
+        reading->water_level = water_level_read();
+    }
+#endif
+}
 
-    
+#if CONFIG_BATTERY_MONITOR
+int battery_read_mv(void)
+{
+    int raw, sum = 0, mv;
+
+    sensors_adc_init();
+    if (!cali_done) {
+        return -1;
+    }
+    for (int i = 0; i < BATTERY_SAMPLES; i++) {
+        if (sensor_adc_read(BATTERY_CHANNEL, &raw) != ESP_OK) {
+            return -1;
+        }
+        sum += raw;
+    }
+    if (adc_cali_raw_to_voltage(sensor_cali_handle, sum / BATTERY_SAMPLES, &mv) != ESP_OK) {
+        return -1;
+    }
+    return mv * CONFIG_BATTERY_DIVIDER_PERMILLE / 1000;
 }
+#endif
+#endif
 
-int infiltration_read(void)
+int sensors_format(const struct sensor_reading* reading, char* buf, size_t len)
+{
+    int n = 0;
+
+#if CONFIG_SENSOR_PH
+    if (reading->sensors & SENSOR_BIT_PH) {
+        n += snprintf(buf + n, len - n, " ph=%.1f", reading->ph);
+    }
+#endif
+#if CONFIG_SENSOR_INFILTRATION
+    if (reading->sensors & SENSOR_BIT_INFILTRATION) {
+        n += snprintf(buf + n, len - n, " inf=%d", reading->infiltration);
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+        n += snprintf(buf + n, len - n, " isl=%.2f itt=%d", reading->infiltration_slope, reading->infiltration_ttt_ms);
+#endif
+    }
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+    if (reading->sensors & SENSOR_BIT_HUM_TEMP) {
+        n += snprintf(buf + n, len - n, " t=%d h=%d", reading->temp, reading->hum);
+    }
+#endif
+#if CONFIG_SENSOR_WATER_LEVEL
+    if (reading->sensors & SENSOR_BIT_WATER_LEVEL) {
+        n += snprintf(buf + n, len - n, " wl=%d", reading->water_level);
+    }
+#endif
+    return n;
+}
+
+#if CONFIG_SENSOR_INFILTRATION
+static int infiltration_percent(int raw)
 {
     voltage[1] = 0;
+    if (cali_done) {
+        ESP_ERROR_CHECK(adc_cali_raw_to_voltage(sensor_cali_handle, raw, &voltage[1]));
+    }
+    return ((voltage[1]*100)/3300);
+}
 
+int infiltration_read(void)
+{
     gpio_set_direction(INFILTRATION_GPIO, GPIO_MODE_OUTPUT);
     gpio_set_level(INFILTRATION_GPIO, 1);
 
-    ESP_ERROR_CHECK(adc_oneshot_read(sensor_handle, INFILTRATION_SENSOR_CHANNEL, &sensor_raw[1]));
-    ESP_LOGI(TAG, "ADC%d Channel[%d] Raw Data: %d", ADC_UNIT_1 + 1, INFILTRATION_SENSOR_CHANNEL, sensor_raw[1]);
+    ESP_ERROR_CHECK(sensor_adc_read(INFILTRATION_SENSOR_CHANNEL, &sensor_raw[1]));
+    DLOGD("ADC%d Channel[%d] Raw Data: %d", ADC_UNIT_1 + 1, INFILTRATION_SENSOR_CHANNEL, sensor_raw[1]);
 
-    if (cali_done) {
-        ESP_ERROR_CHECK(adc_cali_raw_to_voltage(sensor_cali_handle, sensor_raw[1], &voltage[1]));
-        ESP_LOGI(TAG, "ADC%d Channel[%d] Cali Voltage: %d mV", ADC_UNIT_1 + 1, INFILTRATION_SENSOR_CHANNEL, voltage[1]);
+    int percent = infiltration_percent(sensor_raw[1]);
+    DLOGI("ADC%d Channel[%d] Cali Voltage: %d mV", ADC_UNIT_1 + 1, INFILTRATION_SENSOR_CHANNEL, voltage[1]);
+
+    gpio_set_level(INFILTRATION_GPIO, 0);
+
+    return percent;
+}
+#endif
+
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+/* Runs in the esp_timer task, a failed conversion repeats the previous sample to keep the time base */
+static void capture_tick(void* arg)
+{
+    int raw;
+
+    if (capture_count >= CAPTURE_SAMPLES) {
+        return;
+    }
+    if (sensor_adc_read(INFILTRATION_SENSOR_CHANNEL, &raw) != ESP_OK) {
+        raw = capture_count > 0 ? capture_buf[capture_count - 1] : 0;
+    }
+    capture_buf[capture_count++] = raw;
+    if (capture_count == CAPTURE_SAMPLES) {
+        xSemaphoreGive(capture_done);
+    }
+}
+
+int infiltration_capture(float* slope, int* ttt_ms)
+{
+    const int fit_samples = CAPTURE_SAMPLES / 4 > 1 ? CAPTURE_SAMPLES / 4 : 2;
+    float sum_t = 0, sum_y = 0, sum_tt = 0, sum_ty = 0;
+    int settle_sum = 0;
+
+    *slope = 0;
+    *ttt_ms = CAPTURE_WINDOW_MS;
+
+    if (capture_timer == NULL) {
+        const esp_timer_create_args_t args = {
+            .callback = capture_tick,
+            .name = "inf_capture",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &capture_timer));
+        capture_done = xSemaphoreCreateBinaryStatic(&capture_done_buf);
+    }
+
+#if CONFIG_STATIC_ALLOCATION
+    capture_buf = capture_storage;
+#else
+    capture_buf = malloc(CAPTURE_SAMPLES * sizeof(int16_t));
+    if (capture_buf == NULL) {
+        ESP_LOGE(TAG, "No memory for the infiltration capture, single sample taken");
+        return infiltration_read();
     }
+#endif
+    capture_count = 0;
 
+    gpio_set_direction(INFILTRATION_GPIO, GPIO_MODE_OUTPUT);
+    gpio_sleep_sel_dis(INFILTRATION_GPIO);
+    gpio_set_level(INFILTRATION_GPIO, 1);
+    ESP_ERROR_CHECK(esp_timer_start_periodic(capture_timer, 1000000 / CAPTURE_RATE_HZ));
+    if (xSemaphoreTake(capture_done, (CAPTURE_WINDOW_MS + 500) / portTICK_PERIOD_MS) != pdTRUE) {
+        ESP_LOGW(TAG, "Infiltration capture timed out after %d samples", capture_count);
+    }
+    esp_timer_stop(capture_timer);
     gpio_set_level(INFILTRATION_GPIO, 0);
 
-    return ((voltage[1]*100)/3300);
+    int samples = capture_count;
+    for (int i = 0; i < samples; i++) {
+        int percent = infiltration_percent(capture_buf[i]);
+
+        if (*ttt_ms == CAPTURE_WINDOW_MS && percent >= CONFIG_SENSOR_INFILTRATION_CAPTURE_THRESHOLD) {
+            *ttt_ms = i * 1000 / CAPTURE_RATE_HZ;
+        }
+        if (i < fit_samples) {
+            float t = (float)i / CAPTURE_RATE_HZ;
+            sum_t += t;
+            sum_y += percent;
+            sum_tt += t * t;
+            sum_ty += t * percent;
+        }
+        if (i >= samples - CAPTURE_SETTLE_SAMPLES) {
+            settle_sum += percent;
+        }
+    }
+#if !CONFIG_STATIC_ALLOCATION
+    free(capture_buf);
+#endif
+    capture_buf = NULL;
+
+    int n = samples < fit_samples ? samples : fit_samples;
+    float denom = n * sum_tt - sum_t * sum_t;
+    if (n >= 2 && denom > 0) {
+        *slope = (n * sum_ty - sum_t * sum_y) / denom;
+    }
+
+    int settle_n = samples < CAPTURE_SETTLE_SAMPLES ? samples : CAPTURE_SETTLE_SAMPLES;
+    DLOGI("Infiltration capture: %d samples, threshold at %d ms", samples, *ttt_ms);
+    return settle_n > 0 ? settle_sum / settle_n : 0;
 }
+#endif
 
+#if CONFIG_SENSOR_PH
 float ph_sensor_read(int* code, int*volt)
 {
     gpio_set_direction(PH_SENSOR_POWER_GPIO, GPIO_MODE_OUTPUT);
@@ -139,7 +486,7 @@ float ph_sensor_read(int* code, int*volt)
 
     float ph=0;
 
-    ESP_ERROR_CHECK(adc_oneshot_read(sensor_handle, PH_SENSOR_CHANNEL, &sensor_raw[0]));
+    ESP_ERROR_CHECK(sensor_adc_read(PH_SENSOR_CHANNEL, &sensor_raw[0]));
     //ESP_LOGI(TAG, "ADC%d Channel[%d] Raw Data: %d", ADC_UNIT_1 + 1, PH_SENSOR_CHANNEL, sensor_raw[0]);
     
     if (cali_done) {
@@ -157,21 +504,55 @@ float ph_sensor_read(int* code, int*volt)
 
     return ph;
 }
+#endif
 
-void hum_temp_sensor_read(int* temp, int* hum)
+#if CONFIG_SENSOR_HUM_TEMP
+static void hum_temp_callback(struct dht11_reading reading, void* arg)
+{
+    hum_temp_result = reading;
+    xSemaphoreGive(hum_temp_done);
+}
+
+void hum_temp_sensor_start(void)
 {
+    if (hum_temp_done == NULL) {
+        hum_temp_done = xSemaphoreCreateBinaryStatic(&hum_temp_done_buf);
+    }
+
     //gpio_set_direction(HUM_TEMP_SENSOR_GPIO, GPIO_MODE_INPUT_OUTPUT);
     gpio_set_pull_mode(HUM_TEMP_SENSOR_GPIO, GPIO_PULLUP_ONLY);
 
-    DHT11_init(HUM_TEMP_SENSOR_GPIO);
+    hum_temp_started = DHT11_start_read(hum_temp_callback, NULL) == DHT11_OK;
+    if (!hum_temp_started) {
+        ESP_LOGE(TAG, "Temp and Hum read could not be started");
+    }
+}
 
-    *temp = DHT11_read().temperature;
-    *hum = DHT11_read().humidity;
+void hum_temp_sensor_read(int* temp, int* hum)
+{
+    if (!hum_temp_started) {
+        hum_temp_sensor_start();
+    }
 
-    gpio_set_pull_mode(HUM_TEMP_SENSOR_GPIO, GPIO_FLOATING);
+    if (hum_temp_started && xSemaphoreTake(hum_temp_done, HUM_TEMP_READ_TIMEOUT_MS / portTICK_PERIOD_MS) == pdTRUE) {
+        *temp = hum_temp_result.temperature;
+        *hum = hum_temp_result.humidity;
+        if (hum_temp_result.status != DHT11_OK) {
+            ESP_LOGW(TAG, "Temp and Hum read failed: %d", hum_temp_result.status);
+        }
+    } else {
+        *temp = -1;
+        *hum = -1;
+    }
+    hum_temp_started = false;
 
+    gpio_set_pull_mode(HUM_TEMP_SENSOR_GPIO, GPIO_FLOATING);
+    gpio_set_level(HUM_TEMP_SENSOR_POWER_GPIO, 0);
+    ESP_LOGI(TAG, "Temp and Hum Sensor Terminated");
 }
+#endif
 
+#if CONFIG_SENSOR_WATER_LEVEL
 bool water_level_read(void)
 {
     bool detected;
@@ -185,4 +566,5 @@ bool water_level_read(void)
     gpio_set_pull_mode(WATER_LEVEL_GPIO, GPIO_FLOATING);
 
     return detected;
-}
\ No newline at end of file
+}
+#endif
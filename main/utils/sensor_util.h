@@ -1,7 +1,71 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+
+#define SENSOR_ADC_USED (CONFIG_SENSOR_PH || CONFIG_SENSOR_INFILTRATION || CONFIG_BATTERY_MONITOR)
+
+/* Sensors of a reading, see sensors_select() */
+#define SENSOR_BIT_PH           (1 << 0)
+#define SENSOR_BIT_INFILTRATION (1 << 1)
+#define SENSOR_BIT_HUM_TEMP     (1 << 2)
+#define SENSOR_BIT_WATER_LEVEL  (1 << 3)
+#define SENSOR_BITS_ALL         0xf
+
+/* Only the fields of the sensors enabled in menuconfig exist */
+struct sensor_reading
+{
+    //SENSOR_BIT_* of the sensors read, the fields of the others are not set
+    unsigned sensors;
+#if CONFIG_SENSOR_PH
+    float ph;
+#endif
+#if CONFIG_SENSOR_INFILTRATION
+    int infiltration;
+#endif
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+    //Least squares slope over the first quarter of the capture, in %/s
+    float infiltration_slope;
+    //Time to reach the threshold, the window length when it was not reached
+    int infiltration_ttt_ms;
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+    int temp;
+    int hum;
+#endif
+#if CONFIG_SENSOR_WATER_LEVEL
+    bool water_level;
+#endif
+};
+
+/* Sensors the next sensors_init() and sensors_read() power up and read, all of them by default */
+void sensors_select(unsigned sensors);
 void sensors_init(void);
+void sensors_read(struct sensor_reading* reading);
+
+/* Appends " key=value" for every enabled sensor, returns the number of characters written */
+int sensors_format(const struct sensor_reading* reading, char* buf, size_t len);
+
+#if CONFIG_SENSOR_INFILTRATION
 int infiltration_read(void);
+#endif
+#if CONFIG_SENSOR_INFILTRATION_CAPTURE
+/* Samples the curve at the configured rate, returns the settling value and fills the other features */
+int infiltration_capture(float* slope, int* ttt_ms);
+#endif
+#if CONFIG_SENSOR_PH
 float ph_sensor_read(int* code, int*volt);
+#endif
+#if CONFIG_SENSOR_HUM_TEMP
+/* Starts the DHT11 read in the background, hum_temp_sensor_read() waits for it */
+void hum_temp_sensor_start(void);
 void hum_temp_sensor_read(int* temp, int* hum);
-bool water_level_read(void);
\ No newline at end of file
+#endif
+#if CONFIG_SENSOR_WATER_LEVEL
+bool water_level_read(void);
+#endif
+#if CONFIG_BATTERY_MONITOR
+/* Battery voltage behind the divider in mV, -1 when it could not be measured */
+int battery_read_mv(void);
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Wi-Fi and MQTT stand-ins for CONFIG_SIM_STUB_BACKENDS builds, linked instead of
+ * wifi_util.c, mqtt_util.c and the BluFi sources. Publishes are printed on the console.
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include "esp_mac.h"
+#include "esp_timer.h"
+
+#include "wifi_util.h"
+#include "mqtt_util.h"
+
+static char device_id[MQTT_DEVICE_ID_LEN + 1];
+static bool first_publish_done;
+
+void initialise_wifi(void)
+{
+}
+
+bool wifi_wait_connected(int timeout_ms)
+{
+    return true;
+}
+
+int wifi_get_retry_count(void)
+{
+    return 0;
+}
+
+void wifi_stop(void)
+{
+}
+
+const char* mqtt_device_id(void)
+{
+    if (device_id[0] == '\0') {
+        uint8_t mac[6];
+        esp_read_mac(mac, ESP_MAC_WIFI_STA);
+        sprintf(device_id, MACSTR, MAC2STR(mac));
+    }
+    return device_id;
+}
+
+void mqtt_client_init(void)
+{
+}
+
+bool mqtt_wait_connected(int timeout_ms)
+{
+    return true;
+}
+
+bool mqtt_wait_config(int timeout_ms)
+{
+    return false;
+}
+
+int mqtt_send_data(const char * topic, const char * data)
+{
+    if (!first_publish_done) {
+        first_publish_done = true;
+        printf("BOOT_TO_PUBLISH %lld\n", esp_timer_get_time());
+    }
+    printf("SIM PUBLISH %s %s\n", topic, data);
+    return 0;
+}
+
+bool mqtt_flush(int timeout_ms)
+{
+    return true;
+}
+
+void mqtt_stop(void)
+{
+}
+
+bool mqtt_delivered(int msg_id)
+{
+    return true;
+}
+
+int mqtt_upload_dlog(void)
+{
+    return 0;
+}
+
+int mqtt_send_diag(void)
+{
+    return 0;
+}
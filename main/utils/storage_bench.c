@@ -0,0 +1,784 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_pm.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#if CONFIG_SPI_FLASH_ENABLE_COUNTERS
+#include "esp_spi_flash_counters.h"
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 1, 0)
+#define esp_flash_counters_t    spi_flash_counters_t
+#define esp_flash_get_counters  spi_flash_get_counters
+#endif
+#define BENCH_FLASH_COUNTERS    1
+#else
+#define BENCH_FLASH_COUNTERS    0
+#endif
+/* joltwallet/littlefs is only pulled in for benchmark builds, see main/idf_component.yml */
+#if __has_include("esp_littlefs.h")
+#include "esp_littlefs.h"
+#define BENCH_LITTLEFS      1
+#else
+#define BENCH_LITTLEFS      0
+#endif
+
+#include "storage_bench.h"
+
+static const char *TAG = "STORAGE_BENCH";
+
+#define BENCH_MAGIC         0x53424e43
+#define BENCH_ITERATIONS    CONFIG_STORAGE_BENCH_ITERATIONS
+#define BENCH_NVS_PART      "bench_nvs"
+#define BENCH_LOG_PART      "bench_log"
+#define BENCH_LFS_PART      "bench_lfs"
+#define BENCH_LFS_PATH      "/bench"
+
+/* Same fields as the wake counters of counter_util.c */
+struct bench_counter {
+    uint32_t wakes;
+    int32_t wb_readings;
+    int32_t readings;
+    uint32_t crc;
+};
+
+struct bench_backend {
+    const char* name;
+    //Erases the storage of the backend and mounts it empty
+    esp_err_t (*format)(void);
+    //Mounts what an earlier boot left and finds the counters and the backlog
+    esp_err_t (*mount)(void);
+    esp_err_t (*counter_write)(const struct bench_counter* c);
+    esp_err_t (*counter_read)(struct bench_counter* c);
+    esp_err_t (*append)(const char* record);
+    //Reads the backlog oldest first and removes it, returns the number of records or -1
+    int (*drain)(char (*records)[BENCH_RECORD_LEN]);
+};
+
+enum bench_pattern {
+    PAT_COUNTER_READ,
+    PAT_COUNTER_WRITE,
+    PAT_APPEND,
+    PAT_DRAIN,
+    PAT_RECOVER,
+    PAT_COUNT,
+};
+
+static const char* const pattern_names[PAT_COUNT] = {
+    "counter_read", "counter_write", "append", "drain", "recover",
+};
+
+struct flash_usage {
+    uint32_t write_bytes;
+    uint32_t erase_ops;
+    uint32_t erase_bytes;
+};
+
+struct bench_stat {
+    uint32_t ops;
+    uint32_t errors;
+    uint32_t mean_us;
+    uint32_t p95_us;
+    uint32_t max_us;
+    struct flash_usage flash;
+};
+
+/* Latencies of the running pattern, summed up into a bench_stat once the backend is done */
+struct pattern_run {
+    uint32_t samples[BENCH_ITERATIONS];
+    int count;
+    uint32_t errors;
+    struct flash_usage flash;
+};
+
+static struct pattern_run runs[PAT_COUNT];
+static int64_t op_start_us;
+static struct flash_usage op_start_flash;
+static char drained[BENCH_QUEUE_LEN][BENCH_RECORD_LEN];
+
+static uint32_t counter_crc(const struct bench_counter* c)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)c, offsetof(struct bench_counter, crc));
+}
+
+/* Drops the oldest record of a full backlog, like uplink_queue_push() */
+static void backlog_push(char (*records)[BENCH_RECORD_LEN], int* count, const char* record)
+{
+    if (*count == BENCH_QUEUE_LEN) {
+        memmove(records[0], records[1], (BENCH_QUEUE_LEN - 1) * BENCH_RECORD_LEN);
+        (*count)--;
+    }
+    strlcpy(records[(*count)++], record, BENCH_RECORD_LEN);
+}
+
+/* NVS blobs, the way nvs_util.c and uplink_queue_persist() store everything */
+struct nvs_backlog {
+    int count;
+    char records[BENCH_QUEUE_LEN][BENCH_RECORD_LEN];
+};
+
+static nvs_handle_t nvs_bench;
+static struct nvs_backlog nvs_backlog;
+
+static esp_err_t nvs_save_backlog(void)
+{
+    /* Only the used slots, the blob grows with the backlog */
+    size_t size = offsetof(struct nvs_backlog, records) + nvs_backlog.count * BENCH_RECORD_LEN;
+    esp_err_t err = nvs_set_blob(nvs_bench, "backlog", &nvs_backlog, size);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_bench);
+    }
+    return err;
+}
+
+static esp_err_t nvs_bench_mount(void)
+{
+    esp_err_t err = nvs_flash_init_partition(BENCH_NVS_PART);
+    if (err != ESP_OK) return err;
+
+    err = nvs_open_from_partition(BENCH_NVS_PART, "bench", NVS_READWRITE, &nvs_bench);
+    if (err != ESP_OK) return err;
+
+    size_t size = sizeof(nvs_backlog);
+    if (nvs_get_blob(nvs_bench, "backlog", &nvs_backlog, &size) != ESP_OK) {
+        nvs_backlog.count = 0;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t nvs_bench_format(void)
+{
+    //Not initialised yet on the first run, the error does not matter
+    nvs_flash_deinit_partition(BENCH_NVS_PART);
+    esp_err_t err = nvs_flash_erase_partition(BENCH_NVS_PART);
+    if (err != ESP_OK) return err;
+    return nvs_bench_mount();
+}
+
+static esp_err_t nvs_bench_counter_write(const struct bench_counter* c)
+{
+    esp_err_t err = nvs_set_blob(nvs_bench, "counters", c, sizeof(*c));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_bench);
+    }
+    return err;
+}
+
+static esp_err_t nvs_bench_counter_read(struct bench_counter* c)
+{
+    size_t size = sizeof(*c);
+    esp_err_t err = nvs_get_blob(nvs_bench, "counters", c, &size);
+    if (err != ESP_OK) return err;
+    return size == sizeof(*c) && c->crc == counter_crc(c) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+static esp_err_t nvs_bench_append(const char* record)
+{
+    backlog_push(nvs_backlog.records, &nvs_backlog.count, record);
+    return nvs_save_backlog();
+}
+
+static int nvs_bench_drain(char (*records)[BENCH_RECORD_LEN])
+{
+    int n = nvs_backlog.count;
+
+    memcpy(records, nvs_backlog.records, n * BENCH_RECORD_LEN);
+    nvs_backlog.count = 0;
+    return nvs_save_backlog() == ESP_OK ? n : -1;
+}
+
+/* RTC memory, survives deep sleep but not a power loss */
+struct rtc_store {
+    uint32_t magic;
+    struct bench_counter counter;
+    int count;
+    char records[BENCH_QUEUE_LEN][BENCH_RECORD_LEN];
+};
+
+static RTC_DATA_ATTR struct rtc_store rtc_store;
+
+static esp_err_t rtc_bench_format(void)
+{
+    memset(&rtc_store, 0, sizeof(rtc_store));
+    rtc_store.magic = BENCH_MAGIC;
+    return ESP_OK;
+}
+
+static esp_err_t rtc_bench_mount(void)
+{
+    return rtc_store.magic == BENCH_MAGIC ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static esp_err_t rtc_bench_counter_write(const struct bench_counter* c)
+{
+    rtc_store.counter = *c;
+    return ESP_OK;
+}
+
+static esp_err_t rtc_bench_counter_read(struct bench_counter* c)
+{
+    *c = rtc_store.counter;
+    return c->crc == counter_crc(c) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+static esp_err_t rtc_bench_append(const char* record)
+{
+    backlog_push(rtc_store.records, &rtc_store.count, record);
+    return ESP_OK;
+}
+
+static int rtc_bench_drain(char (*records)[BENCH_RECORD_LEN])
+{
+    int n = rtc_store.count;
+
+    memcpy(records, rtc_store.records, n * BENCH_RECORD_LEN);
+    rtc_store.count = 0;
+    return n;
+}
+
+/*
+ * Append-only log in a raw partition. Entries never straddle a sector and a sector is
+ * erased when the head enters it, so the partition wears evenly. Drained records are
+ * marked by clearing their state word, which flash allows without an erase.
+ */
+#define LOG_SECTOR      4096
+#define LOG_ALIGN       16
+#define LOG_FREE        0xFFFFFFFF
+#define LOG_CONSUMED    0
+#define LOG_NONE        UINT32_MAX
+
+enum log_type {
+    LOG_COUNTER = 1,
+    LOG_RECORD = 2,
+};
+
+struct log_header {
+    //LOG_FREE until the record is drained
+    uint32_t state;
+    //LOG_FREE on erased flash, ends the entries of a sector
+    uint32_t seq;
+    uint16_t type;
+    uint16_t len;
+    //Over seq, type, len and the payload
+    uint32_t crc;
+};
+
+static const esp_partition_t* log_part;
+static uint32_t log_head;
+static uint32_t log_seq;
+static uint32_t log_counter_off;
+//Offsets of the undrained records, oldest first
+static uint32_t log_backlog[BENCH_QUEUE_LEN];
+static int log_backlog_count;
+static uint8_t log_sector_buf[LOG_SECTOR];
+
+static uint32_t log_entry_size(int len)
+{
+    return (sizeof(struct log_header) + len + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1);
+}
+
+static uint32_t log_crc(const struct log_header* h, const void* payload)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&h->seq, offsetof(struct log_header, crc) - offsetof(struct log_header, seq));
+    return esp_rom_crc32_le(crc, payload, h->len);
+}
+
+static esp_err_t log_mark_consumed(uint32_t offset)
+{
+    uint32_t state = LOG_CONSUMED;
+    return esp_partition_write(log_part, offset, &state, sizeof(state));
+}
+
+static esp_err_t log_read(uint32_t offset, enum log_type type, void* payload, int max_len)
+{
+    struct log_header h;
+
+    esp_err_t err = esp_partition_read(log_part, offset, &h, sizeof(h));
+    if (err != ESP_OK) return err;
+    if (h.type != type || h.len > max_len) return ESP_ERR_INVALID_CRC;
+
+    err = esp_partition_read(log_part, offset + sizeof(h), payload, h.len);
+    if (err != ESP_OK) return err;
+    return h.crc == log_crc(&h, payload) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+/* Forgets the entries of a sector about to be erased, only the oldest sector is ever reused */
+static void log_drop_sector(uint32_t sector)
+{
+    int kept = 0;
+
+    if (log_counter_off / LOG_SECTOR == sector / LOG_SECTOR) {
+        log_counter_off = LOG_NONE;
+    }
+    for (int i = 0; i < log_backlog_count; i++) {
+        if (log_backlog[i] / LOG_SECTOR != sector / LOG_SECTOR) {
+            log_backlog[kept++] = log_backlog[i];
+        }
+    }
+    log_backlog_count = kept;
+}
+
+static esp_err_t log_write(enum log_type type, const void* payload, int len, uint32_t* offset)
+{
+    uint8_t entry[sizeof(struct log_header) + BENCH_RECORD_LEN];
+    struct log_header* h = (struct log_header*)entry;
+    uint32_t size = log_entry_size(len);
+    esp_err_t err;
+
+    if (log_head % LOG_SECTOR + size > LOG_SECTOR) {
+        log_head = (log_head / LOG_SECTOR + 1) * LOG_SECTOR;
+    }
+    if (log_head >= log_part->size) {
+        log_head = 0;
+    }
+    if (log_head % LOG_SECTOR == 0) {
+        uint32_t seq;
+        err = esp_partition_read(log_part, log_head + offsetof(struct log_header, seq), &seq, sizeof(seq));
+        if (err != ESP_OK) return err;
+        if (seq != LOG_FREE) {
+            log_drop_sector(log_head);
+            err = esp_partition_erase_range(log_part, log_head, LOG_SECTOR);
+            if (err != ESP_OK) return err;
+        }
+    }
+
+    h->state = LOG_FREE;
+    h->seq = log_seq++;
+    h->type = type;
+    h->len = len;
+    memcpy(entry + sizeof(*h), payload, len);
+    h->crc = log_crc(h, payload);
+    err = esp_partition_write(log_part, log_head, entry, sizeof(*h) + len);
+    *offset = log_head;
+    log_head += size;
+    return err;
+}
+
+/* Sorted by sequence number, the newest BENCH_QUEUE_LEN records are kept */
+static void log_backlog_insert(uint32_t* seqs, uint32_t offset, uint32_t seq)
+{
+    if (log_backlog_count == BENCH_QUEUE_LEN) {
+        if (seq < seqs[0]) {
+            return;
+        }
+        memmove(&seqs[0], &seqs[1], (BENCH_QUEUE_LEN - 1) * sizeof(seqs[0]));
+        memmove(&log_backlog[0], &log_backlog[1], (BENCH_QUEUE_LEN - 1) * sizeof(log_backlog[0]));
+        log_backlog_count--;
+    }
+    int i = log_backlog_count++;
+    for (; i > 0 && seqs[i - 1] > seq; i--) {
+        seqs[i] = seqs[i - 1];
+        log_backlog[i] = log_backlog[i - 1];
+    }
+    seqs[i] = seq;
+    log_backlog[i] = offset;
+}
+
+static esp_err_t log_bench_mount(void)
+{
+    uint32_t newest_seq = 0;
+    uint32_t counter_seq = 0;
+    uint32_t backlog_seq[BENCH_QUEUE_LEN];
+    bool found = false;
+
+    log_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, BENCH_LOG_PART);
+    if (log_part == NULL) return ESP_ERR_NOT_FOUND;
+
+    log_head = 0;
+    log_seq = 0;
+    log_counter_off = LOG_NONE;
+    log_backlog_count = 0;
+
+    /* Recovery scans every sector, the newest entry gives the head */
+    for (uint32_t sector = 0; sector < log_part->size; sector += LOG_SECTOR) {
+        esp_err_t err = esp_partition_read(log_part, sector, log_sector_buf, LOG_SECTOR);
+        if (err != ESP_OK) return err;
+
+        for (uint32_t off = 0; off + sizeof(struct log_header) <= LOG_SECTOR;) {
+            struct log_header h;
+            memcpy(&h, log_sector_buf + off, sizeof(h));
+            if (h.seq == LOG_FREE || h.len > BENCH_RECORD_LEN) {
+                break;
+            }
+            if (!found || h.seq > newest_seq) {
+                found = true;
+                newest_seq = h.seq;
+                log_head = sector + off + log_entry_size(h.len);
+            }
+            if (h.type == LOG_COUNTER && (log_counter_off == LOG_NONE || h.seq > counter_seq)) {
+                log_counter_off = sector + off;
+                counter_seq = h.seq;
+            } else if (h.type == LOG_RECORD && h.state != LOG_CONSUMED) {
+                log_backlog_insert(backlog_seq, sector + off, h.seq);
+            }
+            off += log_entry_size(h.len);
+        }
+    }
+    if (found) {
+        log_seq = newest_seq + 1;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t log_bench_format(void)
+{
+    log_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, BENCH_LOG_PART);
+    if (log_part == NULL) return ESP_ERR_NOT_FOUND;
+
+    esp_err_t err = esp_partition_erase_range(log_part, 0, log_part->size);
+    if (err != ESP_OK) return err;
+    return log_bench_mount();
+}
+
+static esp_err_t log_bench_counter_write(const struct bench_counter* c)
+{
+    return log_write(LOG_COUNTER, c, sizeof(*c), &log_counter_off);
+}
+
+static esp_err_t log_bench_counter_read(struct bench_counter* c)
+{
+    if (log_counter_off == LOG_NONE) return ESP_ERR_NOT_FOUND;
+
+    esp_err_t err = log_read(log_counter_off, LOG_COUNTER, c, sizeof(*c));
+    if (err != ESP_OK) return err;
+    return c->crc == counter_crc(c) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+static esp_err_t log_bench_append(const char* record)
+{
+    uint32_t offset;
+
+    if (log_backlog_count == BENCH_QUEUE_LEN) {
+        log_mark_consumed(log_backlog[0]);
+        memmove(&log_backlog[0], &log_backlog[1], (BENCH_QUEUE_LEN - 1) * sizeof(log_backlog[0]));
+        log_backlog_count--;
+    }
+    esp_err_t err = log_write(LOG_RECORD, record, strlen(record) + 1, &offset);
+    if (err == ESP_OK) {
+        log_backlog[log_backlog_count++] = offset;
+    }
+    return err;
+}
+
+static int log_bench_drain(char (*records)[BENCH_RECORD_LEN])
+{
+    int n = log_backlog_count;
+
+    for (int i = 0; i < n; i++) {
+        if (log_read(log_backlog[i], LOG_RECORD, records[i], BENCH_RECORD_LEN) != ESP_OK) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (log_mark_consumed(log_backlog[i]) != ESP_OK) {
+            return -1;
+        }
+    }
+    log_backlog_count = 0;
+    return n;
+}
+
+#if BENCH_LITTLEFS
+/* LittleFS, counters rewritten in their own file and records appended as lines */
+#define LFS_COUNTERS    BENCH_LFS_PATH "/counters"
+#define LFS_BACKLOG     BENCH_LFS_PATH "/backlog"
+
+static bool lfs_mounted;
+
+static esp_err_t lfs_bench_mount(void)
+{
+    esp_vfs_littlefs_conf_t conf = {
+        .base_path = BENCH_LFS_PATH,
+        .partition_label = BENCH_LFS_PART,
+        .format_if_mount_failed = false,
+    };
+    esp_err_t err = esp_vfs_littlefs_register(&conf);
+    lfs_mounted = err == ESP_OK;
+    return err;
+}
+
+static esp_err_t lfs_bench_format(void)
+{
+    if (lfs_mounted) {
+        esp_vfs_littlefs_unregister(BENCH_LFS_PART);
+        lfs_mounted = false;
+    }
+    esp_err_t err = esp_littlefs_format(BENCH_LFS_PART);
+    if (err != ESP_OK) return err;
+    return lfs_bench_mount();
+}
+
+static esp_err_t lfs_bench_counter_write(const struct bench_counter* c)
+{
+    FILE* f = fopen(LFS_COUNTERS, "wb");
+    if (f == NULL) return ESP_FAIL;
+
+    size_t n = fwrite(c, sizeof(*c), 1, f);
+    //Close commits the file
+    return fclose(f) == 0 && n == 1 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t lfs_bench_counter_read(struct bench_counter* c)
+{
+    FILE* f = fopen(LFS_COUNTERS, "rb");
+    if (f == NULL) return ESP_ERR_NOT_FOUND;
+
+    size_t n = fread(c, sizeof(*c), 1, f);
+    fclose(f);
+    if (n != 1) return ESP_FAIL;
+    return c->crc == counter_crc(c) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+static esp_err_t lfs_bench_append(const char* record)
+{
+    FILE* f = fopen(LFS_BACKLOG, "a");
+    if (f == NULL) return ESP_FAIL;
+
+    int err = fputs(record, f) < 0 || fputc('\n', f) == EOF;
+    return fclose(f) == 0 && !err ? ESP_OK : ESP_FAIL;
+}
+
+static int lfs_bench_drain(char (*records)[BENCH_RECORD_LEN])
+{
+    int n = 0;
+
+    FILE* f = fopen(LFS_BACKLOG, "r");
+    if (f == NULL) return 0;
+
+    while (n < BENCH_QUEUE_LEN && fgets(records[n], BENCH_RECORD_LEN, f) != NULL) {
+        records[n][strcspn(records[n], "\n")] = '\0';
+        n++;
+    }
+    fclose(f);
+    return remove(LFS_BACKLOG) == 0 ? n : -1;
+}
+#endif
+
+static const struct bench_backend backends[] = {
+    {"nvs", nvs_bench_format, nvs_bench_mount, nvs_bench_counter_write, nvs_bench_counter_read,
+        nvs_bench_append, nvs_bench_drain},
+    {"rtc", rtc_bench_format, rtc_bench_mount, rtc_bench_counter_write, rtc_bench_counter_read,
+        rtc_bench_append, rtc_bench_drain},
+    {"raw_log", log_bench_format, log_bench_mount, log_bench_counter_write, log_bench_counter_read,
+        log_bench_append, log_bench_drain},
+#if BENCH_LITTLEFS
+    {"littlefs", lfs_bench_format, lfs_bench_mount, lfs_bench_counter_write, lfs_bench_counter_read,
+        lfs_bench_append, lfs_bench_drain},
+#endif
+};
+
+#define BENCH_BACKENDS  ((int)(sizeof(backends) / sizeof(backends[0])))
+
+/* Kept over the deep sleep between the patterns and the recovery */
+struct bench_state {
+    uint32_t magic;
+    //Last counters written and backlog left, what every backend has to recover
+    struct bench_counter expected;
+    int pending;
+    struct bench_stat stats[BENCH_BACKENDS][PAT_COUNT];
+};
+
+static RTC_DATA_ATTR struct bench_state state;
+
+static void flash_usage_now(struct flash_usage* usage)
+{
+#if BENCH_FLASH_COUNTERS
+    const esp_flash_counters_t* counters = esp_flash_get_counters();
+    usage->write_bytes = counters->write.bytes;
+    usage->erase_ops = counters->erase.count;
+    usage->erase_bytes = counters->erase.bytes;
+#else
+    memset(usage, 0, sizeof(*usage));
+#endif
+}
+
+static void op_begin(void)
+{
+    flash_usage_now(&op_start_flash);
+    op_start_us = esp_timer_get_time();
+}
+
+static void op_end(enum bench_pattern pattern, bool ok)
+{
+    int64_t us = esp_timer_get_time() - op_start_us;
+    struct pattern_run* run = &runs[pattern];
+    struct flash_usage now;
+
+    flash_usage_now(&now);
+    if (run->count < BENCH_ITERATIONS) {
+        run->samples[run->count++] = us;
+    }
+    run->errors += !ok;
+    run->flash.write_bytes += now.write_bytes - op_start_flash.write_bytes;
+    run->flash.erase_ops += now.erase_ops - op_start_flash.erase_ops;
+    run->flash.erase_bytes += now.erase_bytes - op_start_flash.erase_bytes;
+}
+
+static int compare_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void stat_finish(enum bench_pattern pattern, struct bench_stat* stat)
+{
+    struct pattern_run* run = &runs[pattern];
+    uint64_t total = 0;
+
+    memset(stat, 0, sizeof(*stat));
+    stat->ops = run->count;
+    stat->errors = run->errors;
+    stat->flash = run->flash;
+    if (run->count == 0) {
+        return;
+    }
+    qsort(run->samples, run->count, sizeof(run->samples[0]), compare_u32);
+    for (int i = 0; i < run->count; i++) {
+        total += run->samples[i];
+    }
+    stat->mean_us = total / run->count;
+    stat->p95_us = run->samples[run->count * 95 / 100];
+    stat->max_us = run->samples[run->count - 1];
+}
+
+static void format_record(char* buf, int i)
+{
+    /* A record as the sensor cycle queues it, ten minutes apart */
+    snprintf(buf, BENCH_RECORD_LEN, "34:85:18:00:00:01 1 %lld 40 ph=6.91/6.9/7.0/0.00 inf=%d.0/40/60/30.1"
+            " t=21.0/21/21/0.0 h=55.0/54/56/0.7 wl=0.0", 1700000000000LL + i * 600000LL, 40 + i % 20);
+}
+
+static void bench_counter_at(struct bench_counter* c, int i)
+{
+    c->wakes = i + 1;
+    c->wb_readings = i % 3;
+    c->readings = i;
+    c->crc = counter_crc(c);
+}
+
+/* One wake per iteration: read and update the counters, queue a reading, drain a full backlog */
+static void run_patterns(const struct bench_backend* b, struct bench_stat* stats)
+{
+    struct bench_counter c;
+    struct bench_counter read;
+    char record[BENCH_RECORD_LEN];
+
+    memset(runs, 0, sizeof(runs));
+    if (b->format() != ESP_OK) {
+        ESP_LOGE(TAG, "Could not format %s", b->name);
+        runs[PAT_COUNTER_WRITE].errors = 1;
+        stat_finish(PAT_COUNTER_WRITE, &stats[PAT_COUNTER_WRITE]);
+        return;
+    }
+
+    bench_counter_at(&c, 0);
+    b->counter_write(&c);
+    for (int i = 1; i <= BENCH_ITERATIONS; i++) {
+        op_begin();
+        esp_err_t err = b->counter_read(&read);
+        op_end(PAT_COUNTER_READ, err == ESP_OK && memcmp(&read, &c, sizeof(c)) == 0);
+
+        bench_counter_at(&c, i);
+        op_begin();
+        op_end(PAT_COUNTER_WRITE, b->counter_write(&c) == ESP_OK);
+
+        format_record(record, i);
+        op_begin();
+        op_end(PAT_APPEND, b->append(record) == ESP_OK);
+
+        if (i % BENCH_QUEUE_LEN == 0) {
+            op_begin();
+            int n = b->drain(drained);
+            op_end(PAT_DRAIN, n == BENCH_QUEUE_LEN && strcmp(drained[n - 1], record) == 0);
+        }
+    }
+
+    /* Leave a backlog for the recovery on the next boot */
+    b->drain(drained);
+    for (int i = 0; i < BENCH_QUEUE_LEN / 2; i++) {
+        format_record(record, BENCH_ITERATIONS + 1 + i);
+        b->append(record);
+    }
+    state.expected = c;
+    state.pending = BENCH_QUEUE_LEN / 2;
+
+    for (int p = 0; p < PAT_RECOVER; p++) {
+        stat_finish(p, &stats[p]);
+    }
+}
+
+static void run_recovery(const struct bench_backend* b, struct bench_stat* stat)
+{
+    struct bench_counter c;
+
+    memset(runs, 0, sizeof(runs));
+    op_begin();
+    bool ok = b->mount() == ESP_OK && b->counter_read(&c) == ESP_OK;
+    op_end(PAT_RECOVER, ok);
+
+    /* Not timed, the backlog is read by the uplink and not by the boot */
+    if (ok && (memcmp(&c, &state.expected, sizeof(c)) != 0 || b->drain(drained) != state.pending)) {
+        runs[PAT_RECOVER].errors++;
+    }
+    stat_finish(PAT_RECOVER, stat);
+}
+
+static void print_report(void)
+{
+    printf("STORAGE_BENCH {\"iterations\":%d,\"queue_len\":%d,\"record_len\":%d,\"flash_counters\":%s,"
+            "\"littlefs\":%s,\"backends\":{", BENCH_ITERATIONS, BENCH_QUEUE_LEN, BENCH_RECORD_LEN,
+            BENCH_FLASH_COUNTERS ? "true" : "false", BENCH_LITTLEFS ? "true" : "false");
+    for (int b = 0; b < BENCH_BACKENDS; b++) {
+        printf("%s\"%s\":{", b ? "," : "", backends[b].name);
+        for (int p = 0; p < PAT_COUNT; p++) {
+            const struct bench_stat* s = &state.stats[b][p];
+            printf("%s\"%s\":{\"ops\":%lu,\"errors\":%lu,\"mean_us\":%lu,\"p95_us\":%lu,\"max_us\":%lu,"
+                    "\"write_bytes\":%lu,\"erase_ops\":%lu,\"erase_bytes\":%lu}", p ? "," : "", pattern_names[p],
+                    (unsigned long)s->ops, (unsigned long)s->errors, (unsigned long)s->mean_us,
+                    (unsigned long)s->p95_us, (unsigned long)s->max_us, (unsigned long)s->flash.write_bytes,
+                    (unsigned long)s->flash.erase_ops, (unsigned long)s->flash.erase_bytes);
+        }
+        printf("}");
+    }
+    printf("}}\n");
+}
+
+bool storage_bench_run(void)
+{
+#if CONFIG_PM_ENABLE
+    /* Latencies at a fixed clock, not at whatever frequency scaling picked */
+    esp_pm_lock_handle_t pm_lock;
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "bench", &pm_lock));
+    esp_pm_lock_acquire(pm_lock);
+#endif
+    bool done = state.magic == BENCH_MAGIC;
+
+    if (!done) {
+        memset(&state, 0, sizeof(state));
+        for (int b = 0; b < BENCH_BACKENDS; b++) {
+            ESP_LOGI(TAG, "Running %d wakes on %s", BENCH_ITERATIONS, backends[b].name);
+            run_patterns(&backends[b], state.stats[b]);
+        }
+        state.magic = BENCH_MAGIC;
+    } else {
+        for (int b = 0; b < BENCH_BACKENDS; b++) {
+            run_recovery(&backends[b], &state.stats[b][PAT_RECOVER]);
+        }
+        print_report();
+        state.magic = 0;
+    }
+
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(pm_lock);
+    esp_pm_lock_delete(pm_lock);
+#endif
+    return done;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "uplink_queue.h"
+
+/* Backlog drained every BENCH_QUEUE_LEN appends, like an uplink at batch_high */
+#define BENCH_QUEUE_LEN     8
+#define BENCH_RECORD_LEN    UPLINK_ENTRY_LEN
+//Deep sleep between the patterns and the recovery measurement
+#define BENCH_SLEEP_US      (1 * 1000000)
+
+/*
+ * Persistence backends (NVS blobs, RTC memory, an append-only log in a raw partition and
+ * LittleFS) compared on the access patterns of the firmware: reading and updating the wake
+ * counters, appending a reading and draining the backlog. Each runs on its own partition
+ * of partitions_bench.csv. Latencies come from esp_timer, written bytes and erases from
+ * the SPI flash counters.
+ *
+ * The first boot formats every backend and runs the patterns. The timer wake that follows
+ * measures how long each backend takes to mount and recover its counters and backlog, then
+ * prints the report as one "STORAGE_BENCH {json}" line, see tools/storage_report.py.
+ */
+
+/* Runs the step of this boot, false when it has to be called again after a deep sleep */
+bool storage_bench_run(void);
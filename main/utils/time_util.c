@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_rtc_time.h"
+#include "esp_netif_sntp.h"
+#include "nvs_flash.h"
+
+#include "time_util.h"
+#include "nvs_util.h"
+
+static const char *TAG = "TIME_UTIL";
+
+#define TIME_MAGIC  0x54494d45
+
+struct time_state {
+    uint32_t magic;
+    bool synced;
+    //Wall clock and RTC time at the last sync, in us
+    int64_t sync_wall_us;
+    uint64_t sync_rtc_us;
+    //Measured RTC drift, positive when the RTC runs fast
+    float drift_ppm;
+    bool drift_known;
+    int wakes_since_sync;
+};
+
+static RTC_DATA_ATTR struct time_state clk;
+
+static esp_err_t load_drift(float* drift_ppm)
+{
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    size_t required_size = sizeof(float);
+    err = nvs_get_blob(my_handle, "time_drift", drift_ppm, &required_size);
+    nvs_close(my_handle);
+    return err;
+}
+
+void time_init(void)
+{
+    if (clk.magic == TIME_MAGIC) {
+        clk.wakes_since_sync++;
+        return;
+    }
+
+    /* RTC time restarted, only the drift estimate can be recovered */
+    memset(&clk, 0, sizeof(clk));
+    clk.magic = TIME_MAGIC;
+    if (load_drift(&clk.drift_ppm) == ESP_OK) {
+        clk.drift_known = true;
+        ESP_LOGI(TAG, "Restored RTC drift %.1f ppm", clk.drift_ppm);
+    }
+}
+
+static int64_t elapsed_us(uint64_t rtc_us)
+{
+    int64_t raw = rtc_us - clk.sync_rtc_us;
+    return raw - (int64_t)(raw * (clk.drift_ppm / 1e6));
+}
+
+static int uncertainty_ms(uint64_t rtc_us)
+{
+    int ppm = clk.drift_known ? TIME_RESIDUAL_DRIFT_PPM : TIME_UNKNOWN_DRIFT_PPM;
+    return TIME_SYNC_UNCERTAINTY_MS + (int)((rtc_us - clk.sync_rtc_us) / 1000 * ppm / 1000000);
+}
+
+bool time_sync_needed(void)
+{
+    return !clk.synced || clk.wakes_since_sync >= TIME_SYNC_EVERY
+        || uncertainty_ms(esp_rtc_get_time_us()) > TIME_MAX_UNCERTAINTY_MS;
+}
+
+#if CONFIG_SIM_STUB_BACKENDS
+/* No network in the QEMU build, the clock stays unsynced */
+esp_err_t time_sync(int timeout_ms)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+#else
+/* Written by the SNTP callback, read once esp_netif_sntp_sync_wait() returned */
+static struct timeval sntp_time;
+static uint64_t sntp_rtc_us;
+
+static esp_err_t save_drift(float drift_ppm)
+{
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    err = nvs_set_blob(my_handle, "time_drift", &drift_ppm, sizeof(float));
+    if (err == ESP_OK) {
+        err = nvs_commit(my_handle);
+    }
+    nvs_close(my_handle);
+    return err;
+}
+
+/* The RTC is read with the time it is paired with, not after the wait wakes up */
+static void time_sync_notification_cb(struct timeval *tv)
+{
+    sntp_rtc_us = esp_rtc_get_time_us();
+    sntp_time = *tv;
+}
+
+esp_err_t time_sync(int timeout_ms)
+{
+    esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG(TIME_SNTP_SERVER);
+    config.sync_cb = time_sync_notification_cb;
+
+    esp_err_t err = esp_netif_sntp_init(&config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "SNTP not started: %s", esp_err_to_name(err));
+        return err;
+    }
+    err = esp_netif_sntp_sync_wait(pdMS_TO_TICKS(timeout_ms));
+    esp_netif_sntp_deinit();
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "SNTP sync timed out");
+        return ESP_ERR_TIMEOUT;
+    }
+    uint64_t rtc_us = sntp_rtc_us;
+
+    int64_t wall_us = (int64_t)sntp_time.tv_sec * 1000000 + sntp_time.tv_usec;
+
+    if (clk.synced) {
+        /* Compare the prediction with the real time to refine the drift estimate */
+        int64_t raw_elapsed = rtc_us - clk.sync_rtc_us;
+        int64_t error_us = (clk.sync_wall_us + elapsed_us(rtc_us)) - wall_us;
+
+        if (raw_elapsed > 0) {
+            float measured = clk.drift_ppm + (float)error_us * 1e6 / raw_elapsed;
+            clk.drift_ppm = clk.drift_known ? (clk.drift_ppm + measured) / 2 : measured;
+            clk.drift_known = true;
+            save_drift(clk.drift_ppm);
+            ESP_LOGI(TAG, "Clock error %lld ms over %lld s, drift %.1f ppm",
+                        error_us / 1000, raw_elapsed / 1000000, clk.drift_ppm);
+        }
+    }
+
+    clk.sync_wall_us = wall_us;
+    clk.sync_rtc_us = rtc_us;
+    clk.synced = true;
+    clk.wakes_since_sync = 0;
+    return ESP_OK;
+}
+#endif
+
+bool time_now(int64_t* epoch_ms, int* uncertainty)
+{
+    uint64_t rtc_us = esp_rtc_get_time_us();
+
+    if (!clk.synced) {
+        *epoch_ms = 0;
+        *uncertainty = -1;
+        return false;
+    }
+
+    *epoch_ms = (clk.sync_wall_us + elapsed_us(rtc_us)) / 1000;
+    *uncertainty = uncertainty_ms(rtc_us);
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#define TIME_SNTP_SERVER            CONFIG_TIME_SNTP_SERVER
+//Resync at least every this many wakes
+#define TIME_SYNC_EVERY             96
+//Resync earlier once the estimated error goes over this bound
+#define TIME_MAX_UNCERTAINTY_MS     2000
+//Error assumed right after a sync, covers the network delay
+#define TIME_SYNC_UNCERTAINTY_MS    50
+//Residual drift assumed before and after the drift has been estimated, in ppm
+#define TIME_UNKNOWN_DRIFT_PPM      50000
+#define TIME_RESIDUAL_DRIFT_PPM     500
+
+/*
+ * Wall clock time is kept as the time of the last SNTP sync plus the RTC time elapsed since,
+ * corrected by the drift of the RTC clock measured between syncs. The drift estimate is saved
+ * to NVS so it is not lost on a power on reset.
+ */
+void time_init(void);
+bool time_sync_needed(void);
+
+/* Runs SNTP once, call with the station connected */
+esp_err_t time_sync(int timeout_ms);
+
+/*
+ * @brief Current wall clock time
+ *
+ * @param epoch_ms Milliseconds since the Unix epoch, 0 if the clock was never synced.
+ * @param uncertainty_ms Estimated error of epoch_ms.
+ *
+ * @return true if the clock was synced.
+ */
+bool time_now(int64_t* epoch_ms, int* uncertainty_ms);
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_random.h"
+#include "nvs_flash.h"
+
+#include "uplink_queue.h"
+#include "nvs_util.h"
+#include "dlog_util.h"
+#if CONFIG_STORAGE_BENCHMARK
+#include "storage_bench.h"
+#endif
+
+static const char *TAG = "UPLINK_QUEUE";
+
+#define UPLINK_QUEUE_MAGIC  0x51554555
+
+struct uplink_queue {
+    uint32_t magic;
+    int head;
+    int count;
+    //Set when the NVS copy holds entries that were not sent yet
+    bool persisted;
+    char entries[UPLINK_QUEUE_LEN][UPLINK_ENTRY_LEN];
+};
+
+struct uplink_backoff {
+    uint32_t magic;
+    struct wake_backoff state;
+};
+
+/*
+ * RTC fast memory of the esp32c3 holds the RTC data, bss and noinit sections, less the
+ * region the bootloader keeps at its end for the partition of deep sleep wakes.
+ */
+#define RTC_FAST_MEM_SIZE       8192
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+#define RTC_BOOTLOADER_RESERVE  (CONFIG_BOOTLOADER_RESERVE_RTC_SIZE + CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE)
+#elif CONFIG_BOOTLOADER_RESERVE_RTC_MEM
+#define RTC_BOOTLOADER_RESERVE  CONFIG_BOOTLOADER_RESERVE_RTC_SIZE
+#else
+#define RTC_BOOTLOADER_RESERVE  0
+#endif
+//Clock, counters, aggregate window, link, diag, energy and transport state, about 300 bytes
+#define RTC_OTHER_STATE_MAX     512
+#if CONFIG_STORAGE_BENCHMARK
+//Records of the RTC backend of storage_bench.c and its own state
+#define RTC_BENCH_MAX           (64 + BENCH_QUEUE_LEN * BENCH_RECORD_LEN)
+#else
+#define RTC_BENCH_MAX           0
+#endif
+
+_Static_assert(sizeof(struct uplink_queue) + sizeof(struct uplink_backoff) + DLOG_RING_BYTES + RTC_OTHER_STATE_MAX +
+               RTC_BENCH_MAX <= RTC_FAST_MEM_SIZE - RTC_BOOTLOADER_RESERVE,
+               "RTC state does not fit RTC fast memory, lower CONFIG_UPLINK_QUEUE_LEN");
+
+static RTC_DATA_ATTR struct uplink_queue queue;
+static RTC_DATA_ATTR struct uplink_backoff backoff;
+
+/* Message ids of the readings from head on that the last replay sent, only valid during this wake */
+static int sent_ids[UPLINK_QUEUE_LEN];
+static int sent_count;
+
+static esp_err_t load_queue(void)
+{
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    size_t required_size = sizeof(struct uplink_queue);
+    err = nvs_get_blob(my_handle, "uplink_q", &queue, &required_size);
+    nvs_close(my_handle);
+
+    if (err != ESP_OK || required_size != sizeof(struct uplink_queue)) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+void uplink_queue_init(void)
+{
+    if (queue.magic == UPLINK_QUEUE_MAGIC) {
+        return;
+    }
+
+    /* RTC memory was lost (power on reset), recover whatever failed uplinks were saved */
+    if (load_queue() != ESP_OK || queue.magic != UPLINK_QUEUE_MAGIC) {
+        memset(&queue, 0, sizeof(queue));
+        queue.magic = UPLINK_QUEUE_MAGIC;
+    }
+    ESP_LOGI(TAG, "Restored %d queued readings", queue.count);
+
+    memset(&backoff, 0, sizeof(backoff));
+    backoff.magic = UPLINK_QUEUE_MAGIC;
+}
+
+void uplink_queue_push(const char* message, int batch_high)
+{
+    int limit = wake_queue_limit(batch_high, UPLINK_QUEUE_LEN);
+
+    while (queue.count >= limit) {
+        /* Full, drop the oldest reading */
+        queue.head = (queue.head + 1) % UPLINK_QUEUE_LEN;
+        queue.count--;
+        ESP_LOGW(TAG, "Queue full, oldest reading dropped");
+    }
+
+    int tail = (queue.head + queue.count) % UPLINK_QUEUE_LEN;
+    strlcpy(queue.entries[tail], message, UPLINK_ENTRY_LEN);
+    queue.count++;
+}
+
+int uplink_queue_count(void)
+{
+    return queue.count;
+}
+
+esp_err_t uplink_queue_persist(void)
+{
+    nvs_handle_t my_handle;
+    esp_err_t err = open_nvs("saved_params", &my_handle);
+    if (err != ESP_OK) return err;
+
+    queue.persisted = queue.count > 0;
+    err = nvs_set_blob(my_handle, "uplink_q", &queue, sizeof(struct uplink_queue));
+    if (err == ESP_OK) {
+        err = nvs_commit(my_handle);
+    }
+    nvs_close(my_handle);
+    return err;
+}
+
+bool uplink_queue_replay(int (*send)(const char* topic, const char* data), const char* topic)
+{
+    sent_count = 0;
+    while (sent_count < queue.count) {
+        int msg_id = send(topic, queue.entries[(queue.head + sent_count) % UPLINK_QUEUE_LEN]);
+        if (msg_id < 0) {
+            ESP_LOGW(TAG, "Replay stopped, %d readings left", queue.count - sent_count);
+            return false;
+        }
+        sent_ids[sent_count++] = msg_id;
+    }
+    return true;
+}
+
+int uplink_queue_settle(bool (*delivered)(int msg_id))
+{
+    int kept = 0;
+
+    /* Compact in place, an entry only ever moves towards the head */
+    for (int i = 0; i < queue.count; i++) {
+        int src = (queue.head + i) % UPLINK_QUEUE_LEN;
+        if (i < sent_count && (delivered == NULL || delivered(sent_ids[i]))) {
+            continue;
+        }
+        int dst = (queue.head + kept) % UPLINK_QUEUE_LEN;
+        if (dst != src) {
+            memcpy(queue.entries[dst], queue.entries[src], UPLINK_ENTRY_LEN);
+        }
+        kept++;
+    }
+    if (kept != queue.count) {
+        ESP_LOGI(TAG, "%d readings delivered, %d left", queue.count - kept, kept);
+    }
+    queue.count = kept;
+    sent_count = 0;
+
+    /* Clear the NVS copy so a later power on reset does not send the readings twice */
+    if (queue.count == 0 && queue.persisted) {
+        uplink_queue_persist();
+    }
+    return queue.count;
+}
+
+enum wake_action uplink_policy(int pending, int batch_low, bool verify_image)
+{
+    enum wake_action action = wake_policy_decide(queue.count + pending, batch_low, verify_image, &backoff.state);
+    if (action == WAKE_BACK_OFF) {
+        ESP_LOGI(TAG, "Backing off, %d wakes left", backoff.state.skip_wakes);
+    }
+    return action;
+}
+
+void uplink_backoff_failure(void)
+{
+    wake_backoff_failure(&backoff.state, esp_random());
+    ESP_LOGI(TAG, "Uplink failure %d, next attempt in %d wakes", backoff.state.failures, backoff.state.skip_wakes);
+}
+
+void uplink_backoff_success(void)
+{
+    wake_backoff_success(&backoff.state);
+}
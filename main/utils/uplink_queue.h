@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "aggregate_util.h"
+#include "energy_util.h"
+#include "mqtt_util.h"
+#include "wake_policy.h"
+
+#define UPLINK_QUEUE_LEN        CONFIG_UPLINK_QUEUE_LEN
+
+/* "<id> " in front of the record when the protocol does not carry the device id otherwise */
+#if MQTT_RECORD_HAS_ID
+#define UPLINK_RECORD_ID_MAX    (MQTT_DEVICE_ID_LEN + 1)
+#else
+#define UPLINK_RECORD_ID_MAX    0
+#endif
+//"<count> <epoch_ms> <uncertainty_ms>", 10 + 13 + 10 digits
+#define UPLINK_RECORD_HEADER_MAX    35
+/* Longest record of the enabled sensors and the battery monitor, longer ones are dropped by the encoder */
+#define UPLINK_RECORD_MAX       (UPLINK_RECORD_ID_MAX + UPLINK_RECORD_HEADER_MAX + AGGREGATE_FORMAT_MAX + \
+                                 ENERGY_FORMAT_MAX)
+/* NUL terminated, rounded up to whole words for RTC memory */
+#define UPLINK_ENTRY_LEN        ((UPLINK_RECORD_MAX + 1 + 3) & ~3)
+
+/*
+ * Readings waiting for an uplink are kept in RTC memory so they survive deep sleep,
+ * and are written to NVS only when an uplink fails so they also survive a power loss.
+ */
+void uplink_queue_init(void);
+/* Drops the oldest readings beyond the batch_high limit */
+void uplink_queue_push(const char* message, int batch_high);
+int uplink_queue_count(void);
+esp_err_t uplink_queue_persist(void);
+
+/*
+ * @brief Send the queued readings oldest first
+ *
+ * The readings stay queued until uplink_queue_settle() learns which of them were delivered.
+ *
+ * @param send Publish function, returns the message id or a negative value on failure.
+ * @param topic Topic passed to the publish function.
+ *
+ * @return true if the whole queue was sent.
+ */
+bool uplink_queue_replay(int (*send)(const char* topic, const char* data), const char* topic);
+
+/*
+ * @brief Drop the readings of the last replay that were delivered
+ *
+ * Undelivered readings keep their place ahead of the ones not sent yet and go out on the next uplink.
+ *
+ * @param delivered Called with the message id of each sent reading, NULL when sending already meant delivery.
+ *
+ * @return Number of readings still queued.
+ */
+int uplink_queue_settle(bool (*delivered)(int msg_id));
+
+/*
+ * Whether this wake uplinks, with the backoff state kept across deep sleeps (wake_policy.h).
+ * pending counts readings this wake will queue that are not pushed yet.
+ */
+enum wake_action uplink_policy(int pending, int batch_low, bool verify_image);
+void uplink_backoff_failure(void);
+void uplink_backoff_success(void);
@@ -0,0 +1,75 @@
+#include "wake_policy.h"
+
+enum wake_action wake_policy_decide(int queued, int batch_low, bool verify_image, struct wake_backoff* backoff)
+{
+    if (verify_image) {
+        return WAKE_UPLINK;
+    }
+    if (queued < batch_low) {
+        return WAKE_SAMPLE_ONLY;
+    }
+    if (backoff->skip_wakes > 0) {
+        backoff->skip_wakes--;
+        return WAKE_BACK_OFF;
+    }
+    return WAKE_UPLINK;
+}
+
+void wake_backoff_failure(struct wake_backoff* backoff, uint32_t random)
+{
+    if (backoff->failures < 31) {
+        backoff->failures++;
+    }
+
+    int window = 1 << (backoff->failures < 7 ? backoff->failures : 7);
+    if (window > WAKE_BACKOFF_MAX_WAKES) {
+        window = WAKE_BACKOFF_MAX_WAKES;
+    }
+
+    /* Half the window is fixed and half is random so nodes behind the same AP spread out */
+    backoff->skip_wakes = window / 2 + random % (window / 2 + 1);
+}
+
+void wake_backoff_success(struct wake_backoff* backoff)
+{
+    backoff->failures = 0;
+    backoff->skip_wakes = 0;
+}
+
+int wake_queue_limit(int batch_high, int capacity)
+{
+    if (batch_high <= 0 || batch_high > capacity) {
+        return capacity;
+    }
+    return batch_high;
+}
+
+enum energy_tier energy_tier_next(enum energy_tier tier, int vbat_mv, const struct energy_thresholds* thresholds)
+{
+    while (tier < ENERGY_TIERS - 1 && vbat_mv < thresholds->enter_mv[tier + 1]) {
+        tier++;
+    }
+    while (tier > ENERGY_NORMAL && vbat_mv >= thresholds->enter_mv[tier] + thresholds->hysteresis_mv) {
+        tier--;
+    }
+    return tier;
+}
+
+int energy_tier_sleep(enum energy_tier tier, int sleep_interval)
+{
+    if (sleep_interval >= ENERGY_SLEEP_MAX_SEC >> tier) {
+        return sleep_interval > ENERGY_SLEEP_MAX_SEC ? sleep_interval : ENERGY_SLEEP_MAX_SEC;
+    }
+    return sleep_interval << tier;
+}
+
+int energy_tier_batch(enum energy_tier tier, int batch_low, int queue_limit)
+{
+    if (tier == ENERGY_ALARM_ONLY) {
+        return queue_limit + 1;
+    }
+    if (batch_low >= queue_limit >> tier) {
+        return batch_low > queue_limit ? batch_low : queue_limit;
+    }
+    return batch_low << tier;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Uplink decisions of the wake cycle. Kept free of ESP-IDF calls so tools/wakesim.c
+ * runs the same code on the host against a virtual clock.
+ */
+
+/* Backoff window cap, in wake cycles */
+#define WAKE_BACKOFF_MAX_WAKES  64
+
+struct wake_backoff {
+    int failures;
+    //Wake cycles left before the next connection attempt
+    int skip_wakes;
+};
+
+enum wake_action {
+    //Not enough readings queued yet, sample and sleep
+    WAKE_SAMPLE_ONLY,
+    //Uplinks failed recently, sample and sleep
+    WAKE_BACK_OFF,
+    WAKE_UPLINK,
+};
+
+/* verify_image forces an uplink so a freshly updated image can confirm itself */
+enum wake_action wake_policy_decide(int queued, int batch_low, bool verify_image, struct wake_backoff* backoff);
+
+/* Exponential backoff counted in wakes, half of the window is fixed and half comes from random */
+void wake_backoff_failure(struct wake_backoff* backoff, uint32_t random);
+void wake_backoff_success(struct wake_backoff* backoff);
+
+/* Readings kept before the oldest is dropped, batch_high bounded by the queue capacity */
+int wake_queue_limit(int batch_high, int capacity);
+
+/* Energy tiers, each one degrades further as the battery voltage drops */
+enum energy_tier {
+    ENERGY_NORMAL,
+    //Longer sleep and larger batches
+    ENERGY_SAVE,
+    //Longer still, and the non-critical sensors are left out
+    ENERGY_LOW,
+    //Routine windows stay queued, only a deadband alarm uplinks
+    ENERGY_ALARM_ONLY,
+    ENERGY_TIERS
+};
+
+/* Longest sleep interval a tier stretches to, in s */
+#define ENERGY_SLEEP_MAX_SEC    (6 * 3600)
+
+struct energy_thresholds {
+    //Voltage below which each tier is entered, in mV, the ENERGY_NORMAL entry is unused
+    int enter_mv[ENERGY_TIERS];
+    //A tier is left once the voltage is this far above its entry level
+    int hysteresis_mv;
+};
+
+/* Moves down as many tiers as the voltage calls for, up only past the hysteresis */
+enum energy_tier energy_tier_next(enum energy_tier tier, int vbat_mv, const struct energy_thresholds* thresholds);
+
+/* Sleep interval doubled per tier, up to ENERGY_SLEEP_MAX_SEC */
+int energy_tier_sleep(enum energy_tier tier, int sleep_interval);
+
+/* batch_low doubled per tier and bounded by queue_limit, past queue_limit in ENERGY_ALARM_ONLY */
+int energy_tier_batch(enum energy_tier tier, int batch_low, int queue_limit);
@@ -9,39 +9,76 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_pm.h"
 
+#if CONFIG_BT_ENABLED
 #include "esp_blufi_api.h"
+#endif
 
 #include "wifi_util.h"
 #include "blufi_util.h"
 #include "nvs_util.h"
+#include "link_util.h"
 
 static uint8_t wifi_retry = 0;
 
 /* FreeRTOS event group to signal when we are connected & ready to make a request */
 static EventGroupHandle_t wifi_event_group;
+static StaticEventGroup_t wifi_event_group_buf;
 
 /* The event group allows multiple bits for each event,
    but we only care about one event - are we connected
    to the AP with an IP? */
 const int CONNECTED_BIT = BIT0;
 
+/* Set when the station gave up after WIFI_CONNECTION_MAXIMUM_RETRY attempts */
+const int FAIL_BIT = BIT1;
+
 /* store the station info to send back to phone */
+#if CONFIG_BT_ENABLED
 extern struct wifi_info wifi_inf;
+#else
+/* No BluFi in this image (timer wake image of a split build), nothing is reported */
+struct wifi_info wifi_inf;
+#endif
 
 /* store the wifi configuration*/
 wifi_config_t wifi_config;
 
+#if CONFIG_PM_ENABLE
+/* Held from the start of a connection until it got an IP or gave up,
+   association and DHCP are not worth delaying with light sleep */
+static esp_pm_lock_handle_t connect_pm_lock;
+static bool connect_pm_locked;
+
+static void connect_pm_lock_set(bool locked)
+{
+    if (connect_pm_lock == NULL || locked == connect_pm_locked) {
+        return;
+    }
+    if (locked) {
+        esp_pm_lock_acquire(connect_pm_lock);
+    } else {
+        esp_pm_lock_release(connect_pm_lock);
+    }
+    connect_pm_locked = locked;
+}
+#else
+#define connect_pm_lock_set(locked)
+#endif
+
 void ip_event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
-    wifi_mode_t mode;
-
     switch (event_id) {
     case IP_EVENT_STA_GOT_IP: {
+        xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
+        connect_pm_lock_set(false);
+        wifi_inf.sta_got_ip = true;
+#if CONFIG_BT_ENABLED
         esp_blufi_extra_info_t info;
+        wifi_mode_t mode;
 
-        xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
         esp_wifi_get_mode(&mode);
 
         memset(&info, 0, sizeof(esp_blufi_extra_info_t));
@@ -49,12 +86,12 @@ void ip_event_handler(void* arg, esp_event_base_t event_base,
         info.sta_bssid_set = true;
         info.sta_ssid = wifi_inf.sta_ssid;
         info.sta_ssid_len = wifi_inf.sta_ssid_len;
-        wifi_inf.sta_got_ip = true;
         if (wifi_inf.ble_is_connected == true) {
             esp_blufi_send_wifi_conn_report(mode, ESP_BLUFI_STA_CONN_SUCCESS, softap_get_current_connection_number(), &info);
         } else {
             BLUFI_INFO("BLUFI BLE is not connected yet\n");
         }
+#endif
         break;
     }
     default:
@@ -72,6 +109,7 @@ void wifi_event_handler(void* arg, esp_event_base_t event_base,
 
     switch (event_id) {
     case WIFI_EVENT_STA_START:
+        link_apply_tx_power();
         wifi_connect();
         break;
     case WIFI_EVENT_STA_CONNECTED:
@@ -89,6 +127,8 @@ void wifi_event_handler(void* arg, esp_event_base_t event_base,
             wifi_inf.sta_is_connecting = false;
             disconnected_event = (wifi_event_sta_disconnected_t*) event_data;
             record_wifi_conn_info(disconnected_event->rssi, disconnected_event->reason);
+            xEventGroupSetBits(wifi_event_group, FAIL_BIT);
+            connect_pm_lock_set(false);
         }
         /* This is a workaround as ESP32 WiFi libs don't currently
            auto-reassociate. */
@@ -121,6 +161,7 @@ void wifi_event_handler(void* arg, esp_event_base_t event_base,
             BLUFI_INFO("BLUFI BLE is not connected yet\n");
         }
         break;*/
+#if CONFIG_BT_ENABLED
     case WIFI_EVENT_SCAN_DONE: {
         uint16_t apCount = 0;
         esp_wifi_scan_get_ap_num(&apCount);
@@ -128,12 +169,26 @@ void wifi_event_handler(void* arg, esp_event_base_t event_base,
             BLUFI_INFO("Nothing AP found");
             break;
         }
+#if CONFIG_STATIC_ALLOCATION
+        /* Only the strongest access points are sent to the phone */
+        static wifi_ap_record_t ap_list[WIFI_SCAN_MAX_AP];
+        static esp_blufi_ap_record_t blufi_ap_list[WIFI_SCAN_MAX_AP];
+        if (apCount > WIFI_SCAN_MAX_AP) {
+            apCount = WIFI_SCAN_MAX_AP;
+        }
+#else
         wifi_ap_record_t *ap_list = (wifi_ap_record_t *)malloc(sizeof(wifi_ap_record_t) * apCount);
         if (!ap_list) {
             BLUFI_ERROR("malloc error, ap_list is NULL");
             break;
         }
+#endif
         ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&apCount, ap_list));
+#if CONFIG_STATIC_ALLOCATION
+        /* Records past WIFI_SCAN_MAX_AP were not fetched, release them in the driver too */
+        esp_wifi_clear_ap_list();
+#endif
+#if !CONFIG_STATIC_ALLOCATION
         esp_blufi_ap_record_t * blufi_ap_list = (esp_blufi_ap_record_t *)malloc(apCount * sizeof(esp_blufi_ap_record_t));
         if (!blufi_ap_list) {
             if (ap_list) {
@@ -142,6 +197,7 @@ void wifi_event_handler(void* arg, esp_event_base_t event_base,
             BLUFI_ERROR("malloc error, blufi_ap_list is NULL");
             break;
         }
+#endif
         for (int i = 0; i < apCount; ++i)
         {
             blufi_ap_list[i].rssi = ap_list[i].rssi;
@@ -155,10 +211,14 @@ void wifi_event_handler(void* arg, esp_event_base_t event_base,
         }
 
         esp_wifi_scan_stop();
+#if !CONFIG_STATIC_ALLOCATION
         free(ap_list);
         free(blufi_ap_list);
+#endif
         break;
-    }/*
+    }
+#endif
+    /*
     case WIFI_EVENT_AP_STACONNECTED: {
         wifi_event_ap_staconnected_t* event = (wifi_event_ap_staconnected_t*) event_data;
         BLUFI_INFO("station "MACSTR" join, AID=%d", MAC2STR(event->mac), event->aid);
@@ -178,6 +238,7 @@ void wifi_event_handler(void* arg, esp_event_base_t event_base,
 
 void record_wifi_conn_info(int rssi, uint8_t reason)
 {
+#if CONFIG_BT_ENABLED
     memset(&wifi_inf.sta_conn_info, 0, sizeof(esp_blufi_extra_info_t));
     if (wifi_inf.sta_is_connecting) {
         wifi_inf.sta_conn_info.sta_max_conn_retry_set = true;
@@ -188,11 +249,14 @@ void record_wifi_conn_info(int rssi, uint8_t reason)
         wifi_inf.sta_conn_info.sta_conn_end_reason_set = true;
         wifi_inf.sta_conn_info.sta_conn_end_reason = reason;
     }
+#endif
 }
 
 void wifi_connect(void)
 {
     wifi_retry = 0;
+    xEventGroupClearBits(wifi_event_group, FAIL_BIT);
+    connect_pm_lock_set(true);
     wifi_inf.sta_is_connecting = (esp_wifi_connect() == ESP_OK);
     record_wifi_conn_info(INVALID_RSSI, INVALID_REASON);
 }
@@ -211,6 +275,11 @@ bool wifi_reconnect(void)
     return err;
 }
 
+int wifi_get_retry_count(void)
+{
+    return wifi_retry;
+}
+
 int softap_get_current_connection_number(void)
 {
     //BLUFI_INFO("softap");
@@ -224,6 +293,19 @@ int softap_get_current_connection_number(void)
     return 0;
 }
 
+bool wifi_wait_connected(int timeout_ms)
+{
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT | FAIL_BIT, pdFALSE, pdFALSE, timeout_ms / portTICK_PERIOD_MS);
+    return (bits & CONNECTED_BIT) != 0;
+}
+
+void wifi_stop(void)
+{
+    /* The station is still marked connected here, so the disconnect event does not reconnect */
+    esp_wifi_disconnect();
+    esp_wifi_stop();
+}
+
 esp_err_t wifi_scan(void)
 {
     wifi_scan_config_t scanConf = {
@@ -239,7 +321,12 @@ esp_err_t wifi_scan(void)
 void initialise_wifi(void)
 {
     ESP_ERROR_CHECK(esp_netif_init());
-    wifi_event_group = xEventGroupCreate();
+    wifi_event_group = xEventGroupCreateStatic(&wifi_event_group_buf);
+#if CONFIG_PM_ENABLE
+    if (connect_pm_lock == NULL) {
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "wifi_connect", &connect_pm_lock));
+    }
+#endif
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
     assert(sta_netif);
@@ -249,6 +336,7 @@ void initialise_wifi(void)
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg) );
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
+    link_apply_protocol();
     record_wifi_conn_info(INVALID_RSSI, INVALID_REASON);
 
     if(get_saved_wifi(&wifi_config) == ESP_OK)
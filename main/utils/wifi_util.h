@@ -3,11 +3,17 @@
 #define WIFI_CONNECTION_MAXIMUM_RETRY 2
 #define INVALID_REASON                255
 #define INVALID_RSSI                  -128
+//Access points reported to the phone after a scan with CONFIG_STATIC_ALLOCATION
+#define WIFI_SCAN_MAX_AP              10
 
 
 void record_wifi_conn_info(int rssi, uint8_t reason);
 void wifi_connect(void);
 bool wifi_reconnect(void);
+bool wifi_wait_connected(int timeout_ms);
+/* Leaves the AP and stops the radio before deep sleep */
+void wifi_stop(void);
+int wifi_get_retry_count(void);
 int softap_get_current_connection_number(void);
 void initialise_wifi(void);
 esp_err_t wifi_scan(void);
\ No newline at end of file
@@ -0,0 +1,187 @@
+/*
+ * Runs the BLE advertising telemetry of main/utils/bleadv_proto.c on the host, a node
+ * broadcasting records to a listener through a mock advertising layer that loses each
+ * advertising event on its own. Checks that every record the listener hands out is
+ * complete, authentic and handed out once, and prints the share of records received and
+ * the airtime a record costs.
+ *
+ *     cc -O2 -I main/utils tools/bleadv_mock.c main/utils/bleadv_proto.c -o bleadv_mock
+ *     ./bleadv_mock -n 10000 -l 0.3 -r 3 -p 64
+ *
+ * Exits with 1 when a record is handed out twice, altered or with a tag that does not match,
+ * -k gives the listener another key to see the tags rejected.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "bleadv_proto.h"
+
+/* 1M PHY: preamble, access address, PDU header and CRC around each payload, 8 us a byte */
+#define AIR_OVERHEAD_BYTES  10
+//ADV_EXT_IND on each primary channel: extended header with flags, ADI and AuxPtr
+#define AIR_EXT_IND_BYTES   7
+//AUX_ADV_IND extended header: flags, AdvA and ADI
+#define AIR_AUX_HEADER_BYTES    10
+
+struct mock_key {
+    const char* key;
+};
+
+struct mock_air {
+    //First so mock_tag() reads the key from either context
+    struct mock_key node;
+    double loss;
+    //Listener, the mock delivers to it straight from advertise()
+    struct bleadv_reassembly listener;
+    const struct bleadv_ops* listener_ops;
+    int* received;
+    int records;
+    long events;
+    long airtime_us;
+    long errors;
+};
+
+static uint64_t rng_state = 1;
+
+static double uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32) / 4294967296.0;
+}
+
+/* Stand-in for the HMAC-SHA256 of the firmware, only needs to be keyed and cover every byte */
+static void mock_tag(void* ctx, uint16_t seq, const uint8_t* data, int len, uint8_t tag[BLEADV_TAG_LEN])
+{
+    const struct mock_key* key = ctx;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (const char* k = key->key; *k; k++) {
+        h = (h ^ (uint8_t)*k) * 0x100000001b3ULL;
+    }
+    h = (h ^ (seq & 0xff)) * 0x100000001b3ULL;
+    h = (h ^ (seq >> 8)) * 0x100000001b3ULL;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 0x100000001b3ULL;
+    }
+    memcpy(tag, &h, BLEADV_TAG_LEN);
+}
+
+static void listener_receive(struct mock_air* air, const uint8_t* packet, int len)
+{
+    char data[BLEADV_FRAGMENTS_MAX * BLEADV_PACKET_MAX];
+    bool authentic;
+
+    if (!bleadv_receive(&air->listener, air->listener_ops, packet, len, data, sizeof(data), &authentic)) {
+        return;
+    }
+    char* end;
+    long i = strtol(data, &end, 10);
+    if (!authentic || i < 0 || i >= air->records || *end != ' ') {
+        fprintf(stderr, "record \"%.40s\" altered or not authentic\n", data);
+        air->errors++;
+        return;
+    }
+    air->received[i]++;
+}
+
+static int mock_advertise(void* ctx, const uint8_t* packet, int len, int repeats)
+{
+    struct mock_air* air = ctx;
+
+    for (int i = 0; i < repeats; i++) {
+        air->events++;
+        air->airtime_us += 8 * (3 * (AIR_OVERHEAD_BYTES + AIR_EXT_IND_BYTES) + AIR_OVERHEAD_BYTES +
+                                AIR_AUX_HEADER_BYTES + len);
+        if (uniform() >= air->loss) {
+            listener_receive(air, packet, len);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct mock_air air = {.node = {"node key"}, .loss = 0.2};
+    struct mock_key listener_key = {"node key"};
+    int records = 1000;
+    int repeats = 3;
+    int packet_max = BLEADV_PACKET_MAX;
+    int record_len = 140;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:r:p:L:k:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            records = atoi(optarg);
+            break;
+        case 'l':
+            air.loss = atof(optarg);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'p':
+            packet_max = atoi(optarg);
+            break;
+        case 'L':
+            record_len = atoi(optarg);
+            break;
+        case 'k':
+            listener_key.key = optarg;
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 10) * 0x9E3779B97F4A7C15ULL + 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n records] [-l loss] [-r repeats] [-p packet_max] [-L record_len]"
+                    " [-k listener_key] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (records <= 0 || repeats <= 0 || record_len < 16 || record_len > 1000) {
+        return 2;
+    }
+
+    struct bleadv_ops node_ops = {.advertise = mock_advertise, .tag = mock_tag, .ctx = &air};
+    struct bleadv_ops listener_ops = {.tag = mock_tag, .ctx = &listener_key};
+    air.listener_ops = &listener_ops;
+    air.records = records;
+    air.received = calloc(records, sizeof(int));
+    //Node side sequence number, one per record like bleadv_send_data(), from a random start
+    uint16_t seq = (uint16_t)(uniform() * 65536);
+    long packets = 0;
+    int delivered = 0;
+
+    for (int i = 0; i < records; i++) {
+        char data[1024];
+        int n = snprintf(data, sizeof(data), "%d ", i);
+        for (; n < record_len; n++) {
+            data[n] = 'a' + (i + n) % 26;
+        }
+        data[n] = '\0';
+
+        int sent = bleadv_broadcast(&node_ops, seq, data, packet_max, repeats);
+        if (sent < 0) {
+            fprintf(stderr, "record %d does not fit %d packets of %d bytes\n", i, BLEADV_FRAGMENTS_MAX, packet_max);
+            return 2;
+        }
+        packets += sent;
+        seq++;
+        if (air.received[i] > 1) {
+            fprintf(stderr, "record %d handed out %d times\n", i, air.received[i]);
+            air.errors++;
+        }
+        delivered += air.received[i] > 0;
+    }
+
+    printf("records %d packets %ld (%.2f per record) events %ld received %.2f%% airtime %.0f us per record"
+           " errors %ld\n", records, packets, (double)packets / records, air.events, 100.0 * delivered / records,
+           (double)air.airtime_us / records, air.errors);
+    free(air.received);
+    return air.errors ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Host build of the BluFi crypto benchmark (CONFIG_BLUFI_CRYPTO_BENCHMARK), prints the
+ * same "BLUFI_BENCH <op> <frame bytes> <ns per frame> <kB/s>" table as the firmware.
+ *
+ *     cc -O2 tools/blufi_bench.c -lmbedcrypto -o blufi_bench && ./blufi_bench
+ *
+ * AES-CFB128 runs through the host mbedtls in software, the CRC is a bitwise copy of the
+ * ROM esp_crc16_be, so the numbers show what the accelerators and ROM tables save.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mbedtls/aes.h"
+
+static const int bench_frame_sizes[] = {16, 64, 128, 244, 512};
+#define BENCH_FRAME_COUNT   (sizeof(bench_frame_sizes) / sizeof(bench_frame_sizes[0]))
+#define BENCH_MAX_FRAME     512
+#define BENCH_ROUNDS        500
+
+static mbedtls_aes_context aes;
+static const uint8_t zero_iv[16];
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int aes_crypt(int mode, uint8_t iv8, uint8_t *data, int len)
+{
+    size_t iv_offset = 0;
+    uint8_t iv0[16];
+
+    memcpy(iv0, zero_iv, sizeof(iv0));
+    iv0[0] = iv8;
+    return mbedtls_aes_crypt_cfb128(&aes, mode, len, &iv_offset, iv0, data, data) ? -1 : len;
+}
+
+/* CRC16-CCITT big endian with inverted input and output, as esp_rom_crc16_be */
+static uint16_t crc16_be(uint16_t crc, const uint8_t *data, int len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= (uint16_t)*data++ << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return ~crc;
+}
+
+static void bench_report(const char *op, int frame_len, int64_t elapsed_us)
+{
+    long long ns_per_frame = elapsed_us * 1000 / BENCH_ROUNDS;
+    long long kbytes_per_s = elapsed_us > 0 ? (int64_t)frame_len * BENCH_ROUNDS * 1000 / elapsed_us : 0;
+    printf("BLUFI_BENCH %s %d %lld %lld\n", op, frame_len, ns_per_frame, kbytes_per_s);
+}
+
+int main(void)
+{
+    static uint8_t frame[BENCH_MAX_FRAME];
+    uint8_t key[16];
+    uint16_t crc = 0;
+
+    srand(time(NULL));
+    for (int i = 0; i < (int)sizeof(key); i++) key[i] = rand();
+    for (int i = 0; i < (int)sizeof(frame); i++) frame[i] = rand();
+
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, key, 128);
+
+    printf("BLUFI_BENCH op frame_bytes ns_per_frame kB_per_s (host software AES)\n");
+    for (int i = 0; i < (int)BENCH_FRAME_COUNT; i++) {
+        int len = bench_frame_sizes[i];
+        int64_t start = now_us();
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            aes_crypt(MBEDTLS_AES_ENCRYPT, r, frame, len);
+        }
+        bench_report("encrypt", len, now_us() - start);
+
+        start = now_us();
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            aes_crypt(MBEDTLS_AES_DECRYPT, r, frame, len);
+        }
+        bench_report("decrypt", len, now_us() - start);
+
+        start = now_us();
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            crc ^= crc16_be(0, frame, len);
+        }
+        bench_report("crc16", len, now_us() - start);
+    }
+
+    mbedtls_aes_free(&aes);
+    printf("crc %04x\n", crc);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Flag regressions in the diagnostics published on sensor/<mac>/diag.
+
+Input is one JSON message per line, for example captured with
+    mosquitto_sub -h <broker> -t 'sensor/+/diag' > diag.log
+
+Every message is compared against a baseline (by default the first message
+in the file, or --baseline). Exits with status 1 when a regression is found.
+
+    python tools/diag_check.py diag.log
+    python tools/diag_check.py --baseline baseline.json --save-baseline new.json diag.log
+"""
+
+import argparse
+import json
+import sys
+
+
+def load_messages(path):
+    messages = []
+    for line in open(path):
+        line = line.strip()
+        start = line.find("{")
+        if start < 0:
+            continue
+        try:
+            messages.append(json.loads(line[start:]))
+        except ValueError:
+            pass
+    return messages
+
+
+def worst(messages):
+    """Reduce a list of messages to the worst value seen for every metric."""
+    summary = {"heap_min": None, "largest_min": None, "stacks": {}}
+    for msg in messages:
+        heap_min = min(msg["heap_min"], msg.get("window_heap_min", msg["heap_min"]))
+        largest = min(msg["heap_largest"], msg.get("window_largest_min", msg["heap_largest"]))
+        summary["heap_min"] = heap_min if summary["heap_min"] is None else min(summary["heap_min"], heap_min)
+        summary["largest_min"] = largest if summary["largest_min"] is None else min(summary["largest_min"], largest)
+        for task in msg.get("tasks", []):
+            prev = summary["stacks"].get(task["name"])
+            summary["stacks"][task["name"]] = task["stack_hwm"] if prev is None else min(prev, task["stack_hwm"])
+    return summary
+
+
+def compare(baseline, current, heap_tolerance, stack_margin):
+    problems = []
+    if current["heap_min"] < baseline["heap_min"] * (1 - heap_tolerance):
+        problems.append("minimum free heap %d < baseline %d" % (current["heap_min"], baseline["heap_min"]))
+    if current["largest_min"] < baseline["largest_min"] * (1 - heap_tolerance):
+        problems.append("largest free block %d < baseline %d, heap is fragmenting"
+                        % (current["largest_min"], baseline["largest_min"]))
+    for name, hwm in sorted(current["stacks"].items()):
+        base = baseline["stacks"].get(name)
+        if base is not None and hwm < base - stack_margin:
+            problems.append("task %s stack high water mark %d < baseline %d" % (name, hwm, base))
+        if hwm < stack_margin:
+            problems.append("task %s has only %d bytes of stack left" % (name, hwm))
+    return problems
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", help="diagnostics messages, one JSON object per line")
+    parser.add_argument("--baseline", help="baseline written by --save-baseline")
+    parser.add_argument("--save-baseline", help="write the worst values of this log as a new baseline")
+    parser.add_argument("--heap-tolerance", type=float, default=0.1, help="allowed relative heap drop (default 0.1)")
+    parser.add_argument("--stack-margin", type=int, default=256, help="allowed stack drop in bytes (default 256)")
+    args = parser.parse_args()
+
+    messages = load_messages(args.log)
+    if not messages:
+        sys.exit("no diagnostics messages in %s" % args.log)
+
+    current = worst(messages)
+    if args.save_baseline:
+        json.dump(current, open(args.save_baseline, "w"), indent=2)
+
+    baseline = json.load(open(args.baseline)) if args.baseline else worst(messages[:1])
+    problems = compare(baseline, current, args.heap_tolerance, args.stack_margin)
+
+    print("heap_min=%d largest_min=%d tasks=%d" % (current["heap_min"], current["largest_min"], len(current["stacks"])))
+    for problem in problems:
+        print("REGRESSION: " + problem)
+    sys.exit(1 if problems else 0)
+
+
+if __name__ == "__main__":
+    main()
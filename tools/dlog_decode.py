@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Decode the deferred log ring buffer written by main/utils/dlog_util.c.
+
+The input is either the raw buffer uploaded on sensor/<mac>/dlog or a UART
+capture containing the "DLOG ..." lines printed by dlog_dump(). Format strings
+are looked up by address in the firmware ELF.
+
+    python tools/dlog_decode.py build/Power_Testing.elf dump.bin
+    python tools/dlog_decode.py build/Power_Testing.elf monitor.log
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+DLOG_MAGIC = 0x444C4F31
+# DLOG_RING_WORDS in main/utils/dlog_util.h
+DLOG_RING_WORDS = 512
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D"}
+
+
+def read_input(path):
+    data = open(path, "rb").read()
+    if struct.unpack_from("<I", data)[0] == DLOG_MAGIC:
+        return data
+    # UART capture, rebuild the buffer from the hex lines
+    hex_data = ""
+    for line in data.decode(errors="ignore").splitlines():
+        m = re.search(r"DLOG ([0-9a-f]+)\s*$", line)
+        if m:
+            hex_data += m.group(1)
+    return bytes.fromhex(hex_data)
+
+
+class StringTable:
+    def __init__(self, elf_path):
+        self.sections = []
+        elf = ELFFile(open(elf_path, "rb"))
+        for section in elf.iter_sections():
+            if section["sh_addr"] and section["sh_type"] == "SHT_PROGBITS":
+                self.sections.append((section["sh_addr"], section.data()))
+
+    def lookup(self, addr):
+        for base, data in self.sections:
+            if base <= addr < base + len(data):
+                end = data.index(b"\0", addr - base)
+                return data[addr - base:end].decode(errors="replace")
+        return None
+
+
+def c_to_python(fmt):
+    # Drop length modifiers and the PRIxx leftovers, python has no use for them
+    return re.sub(r"%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z|j|t)?([diuxXoc])", r"%\1\2", fmt)
+
+
+def decode(buf, strings):
+    magic, head, tail, fault = struct.unpack_from("<4I", buf)
+    if magic != DLOG_MAGIC:
+        sys.exit("not a dlog buffer (magic 0x%08x)" % magic)
+    words = struct.unpack_from("<%dI" % DLOG_RING_WORDS, buf, 16)
+
+    if fault:
+        print("# last reset was a fault")
+    pos = tail
+    while pos < head:
+        hdr = words[pos % DLOG_RING_WORDS]
+        level, nargs, ms = hdr & 0x7, (hdr >> 3) & 0x7, hdr >> 6
+        fmt_addr = words[(pos + 1) % DLOG_RING_WORDS]
+        args = [words[(pos + 2 + i) % DLOG_RING_WORDS] for i in range(nargs)]
+        pos += 2 + nargs
+
+        fmt = strings.lookup(fmt_addr)
+        if fmt is None:
+            text = "<unknown format 0x%08x> %s" % (fmt_addr, " ".join("0x%x" % a for a in args))
+        else:
+            # Arguments are stored as uint32, give %d its sign back
+            signed = [a - (1 << 32) if a & 0x80000000 else a for a in args]
+            try:
+                text = c_to_python(fmt) % tuple(signed)
+            except (TypeError, ValueError):
+                text = "%s %s" % (fmt, args)
+        print("%s (%d) %s" % (LEVELS.get(level, "?"), ms, text.rstrip()))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="firmware ELF the buffer was recorded with")
+    parser.add_argument("dump", help="raw buffer or UART capture")
+    args = parser.parse_args()
+
+    decode(read_input(args.dump), StringTable(args.elf))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Compare the MQTT bytes of one wake cycle between MQTT 3.1.1 and MQTT 5.
+
+Counts the CONNECT, SUBSCRIBE, PUBLISH, PUBACK and DISCONNECT packets the firmware exchanges per
+uplink, following the encodings of both specifications. The MQTT 5 path sends the
+device id and schema once as CONNECT user properties, the MQTT 3.1.1 records carry it
+in the payload. Records go out at QoS 1 with the full topic and no topic alias: the
+firmware only elides the topic of QoS 0 publishes, a QoS 1 one can be resent from the
+outbox on a connection that never saw the alias.
+
+    python tools/mqtt_overhead.py
+    python tools/mqtt_overhead.py --records 8 --payload 90
+"""
+
+import argparse
+
+DEVICE_ID = "aa:bb:cc:dd:ee:ff"
+LOG_TOPIC = "sensor/log"
+SUB_TOPICS = ["sensor/%s/config" % DEVICE_ID, "sensor/%s/cmd" % DEVICE_ID]
+
+
+def varint_len(n):
+    size = 1
+    while n > 127:
+        n >>= 7
+        size += 1
+    return size
+
+
+def packet(body_len):
+    """Fixed header (type byte and remaining length) plus the body."""
+    return 1 + varint_len(body_len) + body_len
+
+
+def string(s):
+    return 2 + len(s)
+
+
+def properties(props_len):
+    return varint_len(props_len) + props_len
+
+
+def connect(v5):
+    body = string("MQTT") + 1 + 1 + 2 + string(DEVICE_ID)
+    if v5:
+        # Session expiry interval (0x11) and two user properties (0x26)
+        props = 5 + 1 + string("device") + string(DEVICE_ID) + 1 + string("schema") + string("1")
+        body += properties(props)
+    return packet(body)
+
+
+def connack(v5):
+    # Brokers add their own properties (topic alias maximum, receive maximum), 3 bytes each at least
+    return packet(2 + (properties(6) if v5 else 0))
+
+
+def subscribe(v5):
+    total = 0
+    for topic in SUB_TOPICS:
+        body = 2 + (properties(0) if v5 else 0) + string(topic) + 1
+        total += packet(body)
+        total += packet(2 + (properties(0) if v5 else 0) + 1)
+    return total
+
+
+def publish(topic, payload_len, v5, qos):
+    packet_id = 2 if qos else 0
+    if not v5:
+        return packet(string(topic) + packet_id + payload_len)
+    # Empty property list, QoS 1 publishes carry no topic alias
+    return packet(string(topic) + packet_id + properties(0) + payload_len)
+
+
+def puback():
+    # The reason code and properties can be left out on success in MQTT 5
+    return packet(2)
+
+
+def wake(records, payload_len, v5):
+    # DISCONNECT has an empty body in both versions on a normal close
+    setup = connect(v5) + connack(v5) + subscribe(v5) + packet(0)
+    id_len = len(DEVICE_ID) + 1
+    data = 0
+    for _ in range(records):
+        payload = payload_len if v5 else payload_len + id_len
+        data += publish(LOG_TOPIC, payload, v5, qos=1) + puback()
+    return setup, data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--records", type=int, default=4, help="records replayed per uplink (batch_low)")
+    parser.add_argument("--payload", type=int, default=80, help="record length without the device id")
+    args = parser.parse_args()
+
+    print("%-10s %8s %8s %8s %10s" % ("protocol", "session", "records", "total", "per record"))
+    totals = {}
+    for name, v5 in (("3.1.1", False), ("5", True)):
+        setup, data = wake(args.records, args.payload, v5)
+        totals[name] = setup + data
+        print("%-10s %8d %8d %8d %10.1f" % (name, setup, data, setup + data, data / args.records))
+    saved = totals["3.1.1"] - totals["5"]
+    print("MQTT 5 saves %d bytes per uplink (%.1f%%)" % (saved, 100.0 * saved / totals["3.1.1"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Minimal SNTP server for checking the drift compensation in time_util.c.
+
+Point TIME_SNTP_SERVER at the machine running this script. The served time
+can be offset and made to run at a different rate than the host clock, so a
+known drift can be injected and compared with the "drift" the node logs.
+
+    python tools/ntp_standin.py --port 123 --skew-ppm 200
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+NTP_EPOCH_OFFSET = 2208988800
+
+
+def to_ntp(t):
+    seconds = int(t)
+    return seconds + NTP_EPOCH_OFFSET, int((t - seconds) * (1 << 32))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=123)
+    parser.add_argument("--offset", type=float, default=0.0, help="constant offset in seconds")
+    parser.add_argument("--skew-ppm", type=float, default=0.0, help="rate error of the served clock in ppm")
+    args = parser.parse_args()
+
+    start = time.time()
+
+    def served_time():
+        now = time.time()
+        return now + args.offset + (now - start) * args.skew_ppm / 1e6
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    print("serving SNTP on %s:%d" % (args.bind, args.port))
+
+    while True:
+        data, addr = sock.recvfrom(512)
+        if len(data) < 48:
+            continue
+        receive = served_time()
+        origin = data[40:48]
+        transmit = served_time()
+        # LI 0, version 4, mode 4 (server), stratum 1
+        packet = struct.pack("!BBbb11I", 0x24, 1, 6, -20, 0, 0, 0x4c4f434c,
+                             *to_ntp(receive), 0, 0, *to_ntp(receive), *to_ntp(transmit))
+        packet = packet[:24] + origin + packet[32:]
+        sock.sendto(packet, addr)
+        print("%s: %.3f" % (addr[0], transmit))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Build a delta patch between two firmware images and serve it over HTTP.
+
+Stands in for the update server when testing main/utils/ota_util.c end to end:
+
+    python tools/ota_serve.py old/Power_Testing.bin build/Power_Testing.bin --chip esp32c3 \
+        --key <64 hex digits> --mac aa:bb:cc:dd:ee:ff --seq 1
+
+then send the printed command on sensor/<mac>/cmd. The key is the one paired with
+"otakey <64 hex digits>" over BluFi, and the sequence number has to be above the
+last one the node accepted. The patch is generated
+with the esp_delta_ota patch generator (detools, heatshrink compression),
+which has to be installed in the IDF python environment.
+"""
+
+import argparse
+import functools
+import hashlib
+import hmac
+import http.server
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+
+
+def find_patch_gen():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    path = os.path.join(root, "managed_components", "espressif__esp_delta_ota", "tools", "esp_delta_ota_patch_gen.py")
+    if not os.path.exists(path):
+        sys.exit("esp_delta_ota not found, run idf.py reconfigure first")
+    return path
+
+
+# esp_image_header_t.hash_appended
+HASH_APPENDED_OFFSET = 23
+
+
+def image_sha256(path):
+    """What esp_partition_get_sha256() returns for the image: its appended SHA-256.
+
+    The digest covers everything before the last 32 bytes, so hashing the whole file never matches.
+    """
+    data = open(path, "rb").read()
+    if len(data) <= HASH_APPENDED_OFFSET + 32 or data[0] != 0xE9:
+        sys.exit("%s is not an app image" % path)
+    if data[HASH_APPENDED_OFFSET] != 1:
+        sys.exit("%s has no appended SHA-256, the node could not check it" % path)
+    return data[-32:].hex()
+
+
+def command(key, mac, seq, url, sha256):
+    """The update command with its tag, see ota_request() in main/utils/ota_util.c."""
+    text = "ota %d %s %s" % (seq, url, sha256)
+    tag = hmac.new(key, mac + text.encode(), hashlib.sha256).hexdigest()
+    return "%s %s" % (text, tag)
+
+
+def local_ip():
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        s.connect(("10.255.255.255", 1))
+        return s.getsockname()[0]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("base", help="image currently running on the node")
+    parser.add_argument("new", help="image to update to")
+    parser.add_argument("--chip", default="esp32c3")
+    parser.add_argument("--port", type=int, default=8070)
+    parser.add_argument("--key", required=True, help="update key paired over BluFi, 64 hex digits")
+    parser.add_argument("--mac", required=True, help="station MAC of the node, as in its topics")
+    parser.add_argument("--seq", type=int, required=True, help="command sequence number, 1 to 999999999")
+    args = parser.parse_args()
+
+    key = bytes.fromhex(args.key)
+    mac = bytes.fromhex(args.mac.replace(":", ""))
+    if len(key) != 32 or len(mac) != 6 or not 0 < args.seq <= 999999999:
+        sys.exit("bad --key, --mac or --seq")
+
+    sha256 = image_sha256(args.new)
+    out_dir = tempfile.mkdtemp(prefix="ota_")
+    patch = os.path.join(out_dir, "patch.bin")
+    subprocess.run([sys.executable, find_patch_gen(), "create_patch", "--chip", args.chip,
+                    "--base_binary", args.base, "--new_binary", args.new, "--patch_file_name", patch], check=True)
+
+    print("patch %d bytes, full image %d bytes" % (os.path.getsize(patch), os.path.getsize(args.new)))
+    url = "http://%s:%d/patch.bin" % (local_ip(), args.port)
+    print("command: %s" % command(key, mac, args.seq, url, sha256))
+
+    handler = functools.partial(http.server.SimpleHTTPRequestHandler, directory=out_dir)
+    http.server.ThreadingHTTPServer(("", args.port), handler).serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Boot the firmware in Espressif QEMU and check the wake cycle against a baseline.
+
+The image is built for esp32 with tools/qemu/sdkconfig.qemu, which stubs the
+sensors, Wi-Fi and MQTT and runs CONFIG_SIM_CYCLES timer wake cycles in a loop.
+The "PHASE", "BOOT_TO_APP_MAIN" and "BOOT_TO_PUBLISH" lines printed by the
+firmware are averaged per metric and compared with tools/qemu/baseline.json.
+QEMU runs with -icount so CPU cycle counts are deterministic. A metric of the
+baseline that the run did not print fails the check, as does a baseline value
+that was never recorded (null). Without a baseline the run records one and
+fails until it is reviewed and committed.
+
+    python tools/qemu_wake_test.py                     # fails on regressions
+    python tools/qemu_wake_test.py --update-baseline   # accept the current numbers
+"""
+
+import argparse
+import json
+import os
+import queue
+import re
+import subprocess
+import sys
+import threading
+import time
+from collections import defaultdict
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BUILD_DIR = os.path.join(ROOT, "build_qemu")
+BASELINE = os.path.join(ROOT, "tools", "qemu", "baseline.json")
+
+
+def build():
+    defaults = "%s;%s" % (os.path.join(ROOT, "sdkconfig.defaults"), os.path.join(ROOT, "tools", "qemu", "sdkconfig.qemu"))
+    subprocess.run(["idf.py", "-C", ROOT, "-B", BUILD_DIR, "-D", "IDF_TARGET=esp32",
+                    "-D", "SDKCONFIG_DEFAULTS=" + defaults, "-D", "SDKCONFIG=" + os.path.join(BUILD_DIR, "sdkconfig"),
+                    "build"], check=True)
+    flash = os.path.join(BUILD_DIR, "flash_qemu.bin")
+    subprocess.run(["esptool.py", "--chip", "esp32", "merge_bin", "--fill-flash-size", "4MB", "-o", flash,
+                    "@flash_args"], cwd=BUILD_DIR, check=True)
+    return flash
+
+
+def run_qemu(flash, timeout):
+    cmd = ["qemu-system-xtensa", "-nographic", "-machine", "esp32", "-icount", "3",
+           "-drive", "file=%s,if=mtd,format=raw" % flash]
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, errors="replace")
+    lines = queue.Queue()
+
+    def reader():
+        for line in proc.stdout:
+            lines.put(line)
+        lines.put(None)
+
+    threading.Thread(target=reader, daemon=True).start()
+    deadline = time.monotonic() + timeout
+    output = []
+    try:
+        while True:
+            left = deadline - time.monotonic()
+            if left <= 0:
+                break
+            try:
+                line = lines.get(timeout=left)
+            except queue.Empty:
+                break
+            if line is None:
+                break
+            output.append(line)
+            if line.startswith("SIM DONE"):
+                break
+    finally:
+        proc.kill()
+        proc.wait()
+    text = "".join(output)
+    if "SIM DONE" not in text:
+        sys.stdout.write(text)
+        sys.exit("firmware did not finish its simulated cycles within %d s" % timeout)
+    return text
+
+
+def parse(text):
+    samples = defaultdict(list)
+    for m in re.finditer(r"^PHASE (\S+) (\d+) (\d+)", text, re.M):
+        samples[m.group(1) + "_us"].append(int(m.group(2)))
+        samples[m.group(1) + "_cycles"].append(int(m.group(3)))
+    for name in ("BOOT_TO_APP_MAIN", "BOOT_TO_PUBLISH"):
+        m = re.search(r"^%s (\d+)" % name, text, re.M)
+        if m:
+            samples[name.lower() + "_us"].append(int(m.group(1)))
+    return {name: sum(values) / len(values) for name, values in samples.items()}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--tolerance", type=float, default=0.1, help="allowed relative increase (default 0.1)")
+    parser.add_argument("--timeout", type=int, default=120)
+    parser.add_argument("--update-baseline", action="store_true")
+    parser.add_argument("--skip-build", action="store_true")
+    args = parser.parse_args()
+
+    flash = os.path.join(BUILD_DIR, "flash_qemu.bin") if args.skip_build else build()
+    metrics = parse(run_qemu(flash, args.timeout))
+
+    if args.update_baseline or not os.path.exists(BASELINE):
+        os.makedirs(os.path.dirname(BASELINE), exist_ok=True)
+        json.dump(metrics, open(BASELINE, "w"), indent=2, sort_keys=True)
+        print("baseline written to %s" % BASELINE)
+        if not args.update_baseline:
+            sys.exit("no baseline was committed, review and commit the one recorded from this run")
+        return
+
+    baseline = json.load(open(BASELINE))
+    failed = False
+    for name in sorted(set(metrics) | set(baseline)):
+        value, base = metrics.get(name), baseline.get(name)
+        if value is None:
+            status = "MISSING"
+            failed = True
+        elif name not in baseline:
+            status = "new"
+        elif base is None:
+            status = "NO BASELINE"
+            failed = True
+        elif value > base * (1 + args.tolerance):
+            status = "REGRESSION"
+            failed = True
+        else:
+            status = "ok"
+        print("%-28s %14s %14s %s" % (name, "-" if value is None else "%.0f" % value,
+                                      "-" if base is None else "%.0f" % base, status))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""Report the RAM budget of a build per component: static, heap peak and stacks.
+
+Static RAM comes from the linker map: .data, .bss, IRAM code and RTC memory of
+every archive. The heap peak per wake phase comes from the "PHASE" lines of a
+monitor capture (CONFIG_PHASE_PROFILE). Stack sizes come from the sdkconfig of
+the build and their high water marks from the diagnostics published on
+sensor/<mac>/diag, captured as for tools/diag_check.py.
+
+Without --build-dir the default configuration and tools/ram/sdkconfig.static
+are built under build_ram/ and reported side by side.
+
+    python tools/ram_report.py
+    python tools/ram_report.py --build-dir build --log monitor.log --diag diag.log
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import subprocess
+from collections import defaultdict
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Output sections that end up in RAM, by the kind of memory they use
+RAM_SECTIONS = [
+    (re.compile(r"^\.dram0\.data|^\.dram0\.rodata|^\.noinit"), "data"),
+    (re.compile(r"^\.dram0\.bss"), "bss"),
+    (re.compile(r"^\.iram0\.(text|vectors|data|bss)"), "iram"),
+    (re.compile(r"^\.rtc"), "rtc"),
+]
+
+# Task name in the diagnostics -> sdkconfig option of its stack size, or the size for fixed stacks
+TASK_STACKS = {
+    "main": "CONFIG_ESP_MAIN_TASK_STACK_SIZE",
+    "sys_evt": "CONFIG_ESP_SYSTEM_EVENT_TASK_STACK_SIZE",
+    "esp_timer": "CONFIG_ESP_TIMER_TASK_STACK_SIZE",
+    "tiT": "CONFIG_LWIP_TCPIP_TASK_STACK_SIZE",
+    "mqtt_task": "CONFIG_UPLINK_MQTT_TASK_STACK_SIZE",
+    "IDLE": "CONFIG_FREERTOS_IDLE_TASK_STACKSIZE",
+    "Tmr Svc": "CONFIG_FREERTOS_TIMER_TASK_STACK_DEPTH",
+    "ipc0": "CONFIG_ESP_IPC_TASK_STACK_SIZE",
+    "nimble_host": "CONFIG_BT_NIMBLE_HOST_TASK_STACK_SIZE",
+    "pipe_sample": "CONFIG_PIPELINE_STACK_SIZE",
+    "pipe_encode": "CONFIG_PIPELINE_STACK_SIZE",
+    # DHT11_TASK_STACK_SIZE in main/utils/dht11.h
+    "dht11": 2048,
+}
+
+INPUT_LINE = re.compile(r"^\s+(?:\S+\s+)?0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+)$")
+
+
+def component(path):
+    m = re.search(r"lib([\w-]+)\.a\(", path)
+    if m:
+        return m.group(1)
+    return os.path.basename(path).split("(")[0]
+
+
+def static_ram(map_path):
+    """Sum the RAM input sections of the linker map per component and kind."""
+    usage = defaultdict(lambda: defaultdict(int))
+    kind = None
+    for line in open(map_path, errors="ignore"):
+        if line.startswith("."):
+            name = line.split()[0]
+            kind = next((k for pattern, k in RAM_SECTIONS if pattern.match(name)), None)
+            continue
+        if kind is None:
+            continue
+        m = INPUT_LINE.match(line.rstrip())
+        if not m or int(m.group(1), 16) == 0:
+            continue
+        size = int(m.group(2), 16)
+        if size:
+            usage[component(m.group(3))][kind] += size
+    return usage
+
+
+def sdkconfig(path):
+    options = {}
+    for line in open(path):
+        m = re.match(r"^(CONFIG_\w+)=(.*)$", line.strip())
+        if m:
+            options[m.group(1)] = m.group(2).strip('"')
+    return options
+
+
+def heap_peaks(log):
+    """Highest heap peak reached by the end of each phase, a phase that raises it set a new peak."""
+    peaks = {}
+    for m in re.finditer(r"^PHASE (\S+) \d+ \d+ (\d+)", open(log, errors="ignore").read(), re.M):
+        peaks[m.group(1)] = max(peaks.get(m.group(1), 0), int(m.group(2)))
+    return peaks
+
+
+def stacks(diag_log, options):
+    """Smallest high water mark seen per task, next to the configured stack size."""
+    hwm = {}
+    for line in open(diag_log, errors="ignore"):
+        start = line.find("{")
+        if start < 0:
+            continue
+        try:
+            msg = json.loads(line[start:])
+        except ValueError:
+            continue
+        for task in msg.get("tasks", []):
+            name = task["name"]
+            hwm[name] = min(hwm.get(name, task["stack_hwm"]), task["stack_hwm"])
+    result = {}
+    for name, free in sorted(hwm.items()):
+        size = TASK_STACKS.get(name, "")
+        if isinstance(size, str):
+            size = options.get(size)
+        result[name] = {"size": int(size) if size else None, "hwm": free,
+                        "used": int(size) - free if size else None}
+    return result
+
+
+def build(name, fragment):
+    build_dir = os.path.join(ROOT, "build_ram", name)
+    defaults = os.path.join(ROOT, "sdkconfig.defaults")
+    if fragment:
+        defaults += ";" + fragment
+    subprocess.run(["idf.py", "-C", ROOT, "-B", build_dir, "-D", "SDKCONFIG_DEFAULTS=" + defaults,
+                    "-D", "SDKCONFIG=" + os.path.join(build_dir, "sdkconfig"), "build"],
+                   check=True, stdout=subprocess.DEVNULL)
+    return build_dir
+
+
+def report(build_dir, log=None, diag=None):
+    maps = glob.glob(os.path.join(build_dir, "*.map"))
+    if not maps:
+        raise SystemExit("no linker map in %s" % build_dir)
+    options = sdkconfig(os.path.join(build_dir, "sdkconfig"))
+    usage = static_ram(maps[0])
+    result = {
+        "static": {name: dict(kinds, total=sum(kinds.values())) for name, kinds in usage.items()},
+        "static_total": sum(sum(kinds.values()) for kinds in usage.values()),
+        "static_allocation": options.get("CONFIG_STATIC_ALLOCATION") == "y",
+        "mqtt_buffers": [int(options.get("CONFIG_UPLINK_MQTT_BUFFER_SIZE", 0)),
+                         int(options.get("CONFIG_UPLINK_MQTT_OUT_BUFFER_SIZE", 0))],
+    }
+    if log:
+        result["heap_peak"] = heap_peaks(log)
+    if diag:
+        result["stacks"] = stacks(diag, options)
+    return result
+
+
+def print_report(name, r, top):
+    print("== %s (static allocation %s, MQTT buffers %d/%d)" % (
+        name, "on" if r["static_allocation"] else "off", r["mqtt_buffers"][0], r["mqtt_buffers"][1]))
+    print("%-24s %8s %8s %8s %8s %8s" % ("component", "data", "bss", "iram", "rtc", "total"))
+    ranked = sorted(r["static"].items(), key=lambda item: -item[1]["total"])
+    for comp, kinds in ranked[:top]:
+        print("%-24s %8d %8d %8d %8d %8d" % (comp, kinds.get("data", 0), kinds.get("bss", 0),
+                                             kinds.get("iram", 0), kinds.get("rtc", 0), kinds["total"]))
+    print("%-24s %44d" % ("static total", r["static_total"]))
+    for phase, peak in r.get("heap_peak", {}).items():
+        print("heap peak after %-12s %8d" % (phase, peak))
+    for task, s in r.get("stacks", {}).items():
+        print("stack %-18s size %6s used %6s free %6d" % (task, s["size"] or "?", s["used"] or "?", s["hwm"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--build-dir", help="report an existing build instead of building")
+    parser.add_argument("--log", help="monitor capture with PHASE lines")
+    parser.add_argument("--diag", help="captured diagnostics messages")
+    parser.add_argument("--top", type=int, default=20, help="components listed per build")
+    parser.add_argument("--output", default=os.path.join(ROOT, "build_ram", "report.json"))
+    args = parser.parse_args()
+
+    if args.build_dir:
+        builds = {os.path.basename(os.path.normpath(args.build_dir)): args.build_dir}
+    else:
+        builds = {"default": build("default", None),
+                  "static": build("static", os.path.join(ROOT, "tools", "ram", "sdkconfig.static"))}
+
+    reports = {}
+    for name, build_dir in builds.items():
+        reports[name] = report(build_dir, args.log, args.diag)
+        print_report(name, reports[name], args.top)
+
+    os.makedirs(os.path.dirname(args.output), exist_ok=True)
+    with open(args.output, "w") as f:
+        json.dump(reports, f, indent=2, sort_keys=True)
+    print("Report written to %s" % args.output)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Build the split images (CONFIG_SPLIT_IMAGES) and compare their size and boot time.
+
+The full provisioning image is built with tools/split/sdkconfig.full and the timer
+wake image with tools/split/sdkconfig.uplink, both on top of sdkconfig.defaults and
+partitions_split.csv. With --port the full image is flashed with the bootloader and
+partition table, and the timer wake image is written to the ota_2 slot.
+
+Both images keep their state across deep sleep in RTC memory, so every RTC_DATA_ATTR
+and RTC_NOINIT_ATTR object they share has to sit at the same address with the same
+size in both ELFs. The report fails before flashing when one moved, or when an object
+of one image overlaps a different one of the other.
+
+Boot times come from the "Boot time: N us, load L us, startup S us, image R" lines
+printed on timer wakes. Captures are grouped by the image that printed them. To
+measure the full image on timer wakes, flash it with --no-uplink and capture again.
+
+    python tools/split_report.py
+    python tools/split_report.py --port /dev/ttyUSB0
+    python tools/split_report.py --log wakes.log --log full_only.log
+"""
+
+import argparse
+import csv
+import json
+import os
+import re
+import statistics
+import subprocess
+from collections import defaultdict
+
+from elftools.elf.elffile import ELFFile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+IMAGES = ("full", "uplink")
+BOOT_LINE = re.compile(r"Boot time: (-?\d+) us, load (-?\d+) us, startup (-?\d+) us, image (\w+)")
+
+
+def idf(name):
+    build_dir = os.path.join(ROOT, "build_split", name)
+    defaults = "%s;%s" % (os.path.join(ROOT, "sdkconfig.defaults"),
+                          os.path.join(ROOT, "tools", "split", "sdkconfig." + name))
+    return ["idf.py", "-C", ROOT, "-B", build_dir, "-D", "SDKCONFIG_DEFAULTS=" + defaults,
+            "-D", "SDKCONFIG=" + os.path.join(build_dir, "sdkconfig")], build_dir
+
+
+def app_file(build_dir, key):
+    desc = json.load(open(os.path.join(build_dir, "project_description.json")))
+    return os.path.join(build_dir, desc[key])
+
+
+def app_binary(build_dir):
+    return app_file(build_dir, "app_bin")
+
+
+def rtc_objects(elf_path):
+    """Objects in the RTC data, bss and noinit sections, {(source file of a static, name): (address, size)}"""
+    objects = {}
+    with open(elf_path, "rb") as f:
+        elf = ELFFile(f)
+        rtc = {i for i, section in enumerate(elf.iter_sections()) if section.name.startswith(".rtc")}
+        source = ""
+        for sym in elf.get_section_by_name(".symtab").iter_symbols():
+            kind = sym["st_info"]["type"]
+            if kind == "STT_FILE":
+                source = sym.name
+            elif kind == "STT_OBJECT" and sym["st_shndx"] in rtc:
+                local = sym["st_info"]["bind"] == "STB_LOCAL"
+                objects[(source if local else "", sym.name)] = (sym["st_value"], sym["st_size"])
+    return objects
+
+
+def rtc_layout_problems(full, uplink):
+    problems = []
+    for key in sorted(full.keys() & uplink.keys()):
+        if full[key] != uplink[key]:
+            problems.append("%s moved: full 0x%08x+%d, uplink 0x%08x+%d" % ((":".join(filter(None, key)),) + full[key] + uplink[key]))
+    uplink_only = sorted(uplink.keys() - full.keys())
+    for key in sorted(full.keys() - uplink.keys()):
+        addr, size = full[key]
+        for other in uplink_only:
+            other_addr, other_size = uplink[other]
+            if addr < other_addr + other_size and other_addr < addr + size:
+                problems.append("%s of the full image at 0x%08x+%d overlaps %s of the uplink image at 0x%08x+%d" %
+                                (":".join(filter(None, key)), addr, size, ":".join(filter(None, other)),
+                                 other_addr, other_size))
+    return problems
+
+
+def slot_offset(name):
+    rows = (row for row in csv.reader(open(os.path.join(ROOT, "partitions_split.csv"))) if row and not row[0].startswith("#"))
+    for row in rows:
+        if row[0].strip() == name:
+            return row[3].strip()
+    raise SystemExit("no %s partition in partitions_split.csv" % name)
+
+
+def size_json(cmd):
+    """idf.py size --format json, the JSON object after whatever idf.py prints ahead of it"""
+    out = subprocess.run(cmd + ["size", "--format", "json"], check=True, capture_output=True, text=True).stdout
+    start = out.find("{")
+    if start < 0:
+        raise SystemExit("no JSON in the idf.py size output:\n" + out)
+    try:
+        return json.JSONDecoder().raw_decode(out, start)[0]
+    except json.JSONDecodeError as e:
+        raise SystemExit("idf.py size output not parsed: %s\n%s" % (e, out))
+
+
+def build(name):
+    cmd, build_dir = idf(name)
+    subprocess.run(cmd + ["build"], check=True, stdout=subprocess.DEVNULL)
+    size = size_json(cmd)
+    return {
+        "image_bytes": os.path.getsize(app_binary(build_dir)),
+        "flash_code": size.get("flash_code"),
+        "flash_rodata": size.get("flash_rodata"),
+        "dram_total": size.get("used_dram"),
+    }
+
+
+def flash(port, uplink):
+    cmd, _ = idf("full")
+    subprocess.run(cmd + ["-p", port, "flash"], check=True)
+    _, build_dir = idf("uplink")
+    if uplink:
+        subprocess.run(["esptool.py", "-p", port, "write_flash", slot_offset("ota_2"), app_binary(build_dir)], check=True)
+    else:
+        subprocess.run(["parttool.py", "-p", port, "--partition-table-file",
+                        os.path.join(ROOT, "partitions_split.csv"), "erase_partition", "--partition-name", "ota_2"],
+                       check=True)
+
+
+def boot_times(logs):
+    samples = defaultdict(lambda: defaultdict(list))
+    for log in logs:
+        for m in BOOT_LINE.finditer(open(log, errors="ignore").read()):
+            for key, value in zip(("boot_us", "load_us", "startup_us"), m.groups()[:3]):
+                samples[m.group(4)][key].append(int(value))
+    return {image: dict({key + "_median": statistics.median(values) for key, values in metrics.items()},
+                        samples=len(metrics["boot_us"]))
+            for image, metrics in samples.items()}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", help="flash both images to this serial port")
+    parser.add_argument("--no-uplink", action="store_true", help="with --port, leave ota_2 empty so the full image handles timer wakes")
+    parser.add_argument("--log", action="append", default=[], help="monitor capture with boot time lines")
+    parser.add_argument("--output", default=os.path.join(ROOT, "build_split", "report.json"))
+    args = parser.parse_args()
+
+    report = {name: build(name) for name in IMAGES}
+    problems = rtc_layout_problems(*(rtc_objects(app_file(idf(name)[1], "app_elf")) for name in IMAGES))
+    for problem in problems:
+        print("RTC layout: " + problem)
+    if problems:
+        raise SystemExit("The images do not share their RTC state, %d differences" % len(problems))
+    if args.port:
+        flash(args.port, not args.no_uplink)
+    for image, times in boot_times(args.log).items():
+        report.setdefault(image, {}).update(times)
+
+    print("%-8s %12s %10s %10s %12s %8s" % ("image", "image_bytes", "boot_us", "load_us", "startup_us", "samples"))
+    for image, r in sorted(report.items()):
+        print("%-8s %12s %10s %10s %12s %8s" % (image, r.get("image_bytes", "-"), r.get("boot_us_median", "-"),
+                                              r.get("load_us_median", "-"), r.get("startup_us_median", "-"),
+                                              r.get("samples", 0)))
+
+    os.makedirs(os.path.dirname(args.output), exist_ok=True)
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+    print("Report written to %s" % args.output)
+
+
+if __name__ == "__main__":
+    main()
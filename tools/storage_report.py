@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""Build and run the storage benchmark (CONFIG_STORAGE_BENCHMARK) and report per backend.
+
+The benchmark image is built with tools/storage/sdkconfig.bench on top of
+sdkconfig.defaults and partitions_bench.csv. With --port it is flashed, the serial
+output is read until the "STORAGE_BENCH {json}" line of the recovery boot, and the
+sensor firmware has to be flashed again afterwards. Without --port the line is taken
+from --log captures.
+
+For every backend and pattern the report lists the latencies, the bytes written and
+the erases per operation. The flash wear is projected from the erases of one wake
+(counters, one reading and a drain every queue_len wakes) spread over the partition
+of the backend, at --wakes-per-day and --endurance erase cycles per sector.
+
+    python tools/storage_report.py --port /dev/ttyUSB0
+    python tools/storage_report.py --log bench.log --wakes-per-day 144
+"""
+
+import argparse
+import csv
+import json
+import os
+import re
+import subprocess
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BUILD_DIR = os.path.join(ROOT, "build_storage")
+PARTITIONS = os.path.join(ROOT, "partitions_bench.csv")
+REPORT_LINE = re.compile(r"STORAGE_BENCH (\{.*\})")
+SECTOR = 4096
+# Partition of partitions_bench.csv each backend writes to, RTC memory does not wear
+BACKEND_PARTITIONS = {"nvs": "bench_nvs", "raw_log": "bench_log", "littlefs": "bench_lfs"}
+PATTERNS = ("counter_read", "counter_write", "append", "drain", "recover")
+
+
+def idf():
+    defaults = "%s;%s" % (os.path.join(ROOT, "sdkconfig.defaults"),
+                          os.path.join(ROOT, "tools", "storage", "sdkconfig.bench"))
+    return ["idf.py", "-C", ROOT, "-B", BUILD_DIR, "-D", "SDKCONFIG_DEFAULTS=" + defaults,
+            "-D", "SDKCONFIG=" + os.path.join(BUILD_DIR, "sdkconfig")]
+
+
+def partition_sizes():
+    sizes = {}
+    rows = (row for row in csv.reader(open(PARTITIONS)) if row and not row[0].startswith("#"))
+    for row in rows:
+        sizes[row[0].strip()] = int(row[4].strip(), 0)
+    return sizes
+
+
+def capture(port, timeout):
+    """Reset the board and read the serial output until the report line."""
+    import serial
+
+    with serial.Serial(port, 115200, timeout=1) as s:
+        s.dtr = False
+        s.rts = True
+        time.sleep(0.1)
+        s.rts = False
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            line = s.readline().decode(errors="ignore")
+            m = REPORT_LINE.search(line)
+            if m:
+                return json.loads(m.group(1))
+    raise SystemExit("no STORAGE_BENCH line within %d s" % timeout)
+
+
+def from_logs(logs):
+    report = None
+    for log in logs:
+        for m in REPORT_LINE.finditer(open(log, errors="ignore").read()):
+            report = json.loads(m.group(1))
+    if report is None:
+        raise SystemExit("no STORAGE_BENCH line in %s" % ", ".join(logs))
+    return report
+
+
+def per_op(stat, key):
+    return stat[key] / stat["ops"] if stat["ops"] else 0
+
+
+def wear(name, stats, bench, sizes, wakes_per_day, endurance):
+    """Years until the partition of the backend reaches its erase endurance."""
+    erased = (stats["counter_write"]["erase_bytes"] + stats["append"]["erase_bytes"] +
+              stats["drain"]["erase_bytes"])
+    per_wake = erased / SECTOR / bench["iterations"]
+    if name not in BACKEND_PARTITIONS or per_wake == 0:
+        return None, per_wake
+    sectors = sizes[BACKEND_PARTITIONS[name]] // SECTOR
+    return sectors * endurance / (per_wake * wakes_per_day) / 365, per_wake
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", help="flash the benchmark and read its report from this serial port")
+    parser.add_argument("--log", action="append", default=[], help="monitor capture with the STORAGE_BENCH line")
+    parser.add_argument("--timeout", type=int, default=600, help="seconds to wait for the report on --port")
+    parser.add_argument("--wakes-per-day", type=float, default=86400 / 20, help="default: 20 s sleep interval")
+    parser.add_argument("--endurance", type=int, default=100000, help="erase cycles per sector")
+    parser.add_argument("--output", default=os.path.join(BUILD_DIR, "report.json"))
+    args = parser.parse_args()
+
+    if args.port:
+        subprocess.run(idf() + ["build"], check=True, stdout=subprocess.DEVNULL)
+        subprocess.run(idf() + ["-p", args.port, "flash"], check=True)
+        bench = capture(args.port, args.timeout)
+    elif args.log:
+        bench = from_logs(args.log)
+    else:
+        parser.error("--port or --log is needed")
+
+    sizes = partition_sizes()
+    report = {"iterations": bench["iterations"], "queue_len": bench["queue_len"],
+              "flash_counters": bench["flash_counters"], "wakes_per_day": args.wakes_per_day,
+              "endurance": args.endurance, "backends": {}}
+    if not bench["flash_counters"]:
+        print("Flash counters were off, written bytes and erases are not measured")
+    if not bench["littlefs"]:
+        print("LittleFS was not in the build, joltwallet/littlefs needs component manager 2.x")
+
+    print("%-9s %-14s %6s %8s %8s %8s %10s %9s %6s" % ("backend", "pattern", "ops", "mean_us", "p95_us",
+                                                      "max_us", "bytes/op", "erases/op", "errors"))
+    for name, stats in bench["backends"].items():
+        entry = {}
+        for pattern in PATTERNS:
+            s = stats[pattern]
+            entry[pattern] = dict(s, bytes_per_op=per_op(s, "write_bytes"), erases_per_op=per_op(s, "erase_ops"))
+            print("%-9s %-14s %6d %8d %8d %8d %10.1f %9.3f %6d" % (name, pattern, s["ops"], s["mean_us"], s["p95_us"],
+                                                                 s["max_us"], entry[pattern]["bytes_per_op"],
+                                                                 entry[pattern]["erases_per_op"], s["errors"]))
+        years, per_wake = wear(name, stats, bench, sizes, args.wakes_per_day, args.endurance)
+        entry["sectors_erased_per_wake"] = per_wake
+        entry["wear_years"] = years
+        report["backends"][name] = entry
+
+    print()
+    for name, entry in report["backends"].items():
+        years = entry["wear_years"]
+        print("%-9s %.4f sectors erased per wake, %s" % (
+            name, entry["sectors_erased_per_wake"],
+            "no sector erased" if years is None else "worn out after %.1f years" % years))
+
+    os.makedirs(os.path.dirname(args.output), exist_ok=True)
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+    print("Report written to %s" % args.output)
+
+
+if __name__ == "__main__":
+    main()
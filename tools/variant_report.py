@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Build every sensor variant in tools/variants and report image size and boot time.
+
+Each variant is an sdkconfig fragment applied on top of sdkconfig.defaults and
+built in its own directory under build_variants/. Boot time comes from the
+"Boot time: N us" lines the firmware prints on timer wakes, taken from an
+optional monitor capture per variant.
+
+    python tools/variant_report.py
+    python tools/variant_report.py --boot-log ph_dht=ph_dht_monitor.log
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import statistics
+import subprocess
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def size_json(cmd):
+    """idf.py size --format json, the JSON object after whatever idf.py prints ahead of it"""
+    out = subprocess.run(cmd + ["size", "--format", "json"], check=True, capture_output=True, text=True).stdout
+    start = out.find("{")
+    if start < 0:
+        raise SystemExit("no JSON in the idf.py size output:\n" + out)
+    try:
+        return json.JSONDecoder().raw_decode(out, start)[0]
+    except json.JSONDecodeError as e:
+        raise SystemExit("idf.py size output not parsed: %s\n%s" % (e, out))
+
+
+def build(name, fragment):
+    build_dir = os.path.join(ROOT, "build_variants", name)
+    defaults = "%s;%s" % (os.path.join(ROOT, "sdkconfig.defaults"), fragment)
+    cmd = ["idf.py", "-C", ROOT, "-B", build_dir, "-D", "SDKCONFIG_DEFAULTS=" + defaults,
+           "-D", "SDKCONFIG=" + os.path.join(build_dir, "sdkconfig")]
+    subprocess.run(cmd + ["build"], check=True, stdout=subprocess.DEVNULL)
+    size = size_json(cmd)
+    image = glob.glob(os.path.join(build_dir, "*.bin"))
+    image = [b for b in image if "bootloader" not in b and "partition" not in b]
+    return {
+        "image_bytes": os.path.getsize(image[0]) if image else None,
+        "flash_code": size.get("flash_code"),
+        "flash_rodata": size.get("flash_rodata"),
+        "dram_total": size.get("used_dram"),
+    }
+
+
+def boot_time(log):
+    samples = [int(m.group(1)) for m in re.finditer(r"Boot time: (-?\d+) us", open(log, errors="ignore").read())]
+    if not samples:
+        return None
+    return {"boot_us_median": statistics.median(samples), "boot_samples": len(samples)}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--boot-log", action="append", default=[], help="variant=monitor.log")
+    parser.add_argument("--output", default=os.path.join(ROOT, "build_variants", "report.json"))
+    args = parser.parse_args()
+
+    logs = dict(item.split("=", 1) for item in args.boot_log)
+    report = {}
+    for fragment in sorted(glob.glob(os.path.join(ROOT, "tools", "variants", "*.cfg"))):
+        name = os.path.splitext(os.path.basename(fragment))[0]
+        report[name] = build(name, fragment)
+        if name in logs:
+            report[name].update(boot_time(logs[name]) or {})
+
+    print("%-24s %12s %12s %12s" % ("variant", "image", "flash_code", "boot_us"))
+    for name, entry in report.items():
+        print("%-24s %12s %12s %12s" % (name, entry["image_bytes"], entry["flash_code"],
+                                        entry.get("boot_us_median", "-")))
+
+    os.makedirs(os.path.dirname(args.output), exist_ok=True)
+    json.dump(report, open(args.output, "w"), indent=2)
+
+
+if __name__ == "__main__":
+    main()
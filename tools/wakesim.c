@@ -0,0 +1,296 @@
+/*
+ * Virtual-time simulation of the wake cycle, to compare duty-cycle policies before
+ * trying them in the field. The uplink decisions come from main/utils/wake_policy.c,
+ * the same code the firmware runs. Phase durations, currents and failure rates are
+ * modelled and can be changed with -m.
+ *
+ *     cc -O2 -I main/utils tools/wakesim.c main/utils/wake_policy.c -o wakesim
+ *     ./wakesim -d 180 "sleep=600 wb=1 batch_low=4" "sleep=300 wb=3 batch_low=8"
+ *     ./wakesim -m wifi_fail=0.2 -m battery_mah=5200 "sleep=900"
+ *
+ * Policies use the keys of the MQTT config topic: sleep, wb, batch_low, batch_high.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "wake_policy.h"
+
+/* CONFIG_UPLINK_QUEUE_LEN, default */
+#define QUEUE_CAPACITY  24
+
+struct policy {
+    char name[80];
+    int sleep_interval;
+    int wb_reading;
+    int batch_low;
+    int batch_high;
+};
+
+/* Durations in ms and currents in mA, rough ESP32-C3 figures with automatic light sleep */
+struct model {
+    double sleep_ua;
+    double boot_ms, boot_ma;
+    double sense_ms, sense_ma;
+    double wifi_ms, wifi_ma;
+    //Time spent before giving up on Wi-Fi, WIFI_WAIT_MS in main.c
+    double wifi_timeout_ms;
+    double mqtt_ms, mqtt_ma;
+    double mqtt_timeout_ms;
+    double publish_ms, publish_ma;
+    double wifi_fail;
+    double mqtt_fail;
+    //Share of the records of an uplink that are lost after the connection is up
+    double publish_fail;
+    double battery_mah;
+};
+
+static struct model model = {
+    .sleep_ua = 15,
+    .boot_ms = 250, .boot_ma = 20,
+    .sense_ms = 20300, .sense_ma = 6,
+    .wifi_ms = 1500, .wifi_ma = 80,
+    .wifi_timeout_ms = 10000,
+    .mqtt_ms = 600, .mqtt_ma = 70,
+    .mqtt_timeout_ms = 5000,
+    .publish_ms = 30, .publish_ma = 90,
+    .wifi_fail = 0.05,
+    .mqtt_fail = 0.02,
+    .publish_fail = 0.01,
+    .battery_mah = 2600,
+};
+
+static const struct {
+    const char* key;
+    double* value;
+} model_keys[] = {
+    {"sleep_ua", &model.sleep_ua},
+    {"boot_ms", &model.boot_ms}, {"boot_ma", &model.boot_ma},
+    {"sense_ms", &model.sense_ms}, {"sense_ma", &model.sense_ma},
+    {"wifi_ms", &model.wifi_ms}, {"wifi_ma", &model.wifi_ma},
+    {"wifi_timeout_ms", &model.wifi_timeout_ms},
+    {"mqtt_ms", &model.mqtt_ms}, {"mqtt_ma", &model.mqtt_ma},
+    {"mqtt_timeout_ms", &model.mqtt_timeout_ms},
+    {"publish_ms", &model.publish_ms}, {"publish_ma", &model.publish_ma},
+    {"wifi_fail", &model.wifi_fail},
+    {"mqtt_fail", &model.mqtt_fail},
+    {"publish_fail", &model.publish_fail},
+    {"battery_mah", &model.battery_mah},
+};
+
+struct result {
+    long wakes;
+    long uplinks;
+    long failed_uplinks;
+    long generated;
+    long delivered;
+    long dropped;
+    //Charge in mA*ms
+    double charge;
+    double seconds;
+};
+
+static uint64_t rng_state;
+
+static uint32_t rng(void)
+{
+    /* xorshift64*, seeded with -s so runs are repeatable */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static double uniform(void)
+{
+    return rng() / 4294967296.0;
+}
+
+static int parse_policy(const char* text, struct policy* p)
+{
+    char buf[256];
+    char* save_ptr;
+
+    /* Firmware defaults from sensor_config_default() */
+    p->sleep_interval = 20;
+    p->wb_reading = 1;
+    p->batch_low = 4;
+    p->batch_high = QUEUE_CAPACITY;
+    snprintf(p->name, sizeof(p->name), "%s", text);
+    snprintf(buf, sizeof(buf), "%s", text);
+
+    for (char* token = strtok_r(buf, " ", &save_ptr); token != NULL; token = strtok_r(NULL, " ", &save_ptr)) {
+        char* value = strchr(token, '=');
+        if (value == NULL) {
+            return -1;
+        }
+        *value++ = '\0';
+        int v = atoi(value);
+        if (strcmp(token, "sleep") == 0) {
+            p->sleep_interval = v;
+        } else if (strcmp(token, "wb") == 0) {
+            p->wb_reading = v;
+        } else if (strcmp(token, "batch_low") == 0) {
+            p->batch_low = v;
+        } else if (strcmp(token, "batch_high") == 0) {
+            p->batch_high = v;
+        } else {
+            return -1;
+        }
+    }
+    return p->sleep_interval > 0 && p->wb_reading > 0 ? 0 : -1;
+}
+
+static int set_model(const char* text)
+{
+    const char* value = strchr(text, '=');
+    if (value == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(model_keys) / sizeof(model_keys[0]); i++) {
+        if (strlen(model_keys[i].key) == (size_t)(value - text) && strncmp(model_keys[i].key, text, value - text) == 0) {
+            *model_keys[i].value = atof(value + 1);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void awake(struct result* r, double ms, double ma)
+{
+    r->charge += ms * ma;
+    r->seconds += ms / 1000;
+}
+
+static void simulate(const struct policy* p, double days, struct result* r)
+{
+    struct wake_backoff backoff = {0};
+    int queued = 0;
+    int window = 0;
+    double end = days * 86400;
+
+    memset(r, 0, sizeof(*r));
+    while (r->seconds < end) {
+        /* Deep sleep, then one timer wake as in run_sensor_cycle() */
+        r->charge += p->sleep_interval * 1000.0 * model.sleep_ua / 1000;
+        r->seconds += p->sleep_interval;
+        r->wakes++;
+
+        awake(r, model.boot_ms, model.boot_ma);
+        awake(r, model.sense_ms, model.sense_ma);
+
+        if (++window >= p->wb_reading) {
+            window = 0;
+            r->generated++;
+            if (queued >= wake_queue_limit(p->batch_high, QUEUE_CAPACITY)) {
+                r->dropped++;
+                queued--;
+            }
+            queued++;
+        }
+
+        if (wake_policy_decide(queued, p->batch_low, false, &backoff) != WAKE_UPLINK) {
+            continue;
+        }
+
+        r->uplinks++;
+        if (uniform() < model.wifi_fail) {
+            awake(r, model.wifi_timeout_ms, model.wifi_ma);
+            wake_backoff_failure(&backoff, rng());
+            r->failed_uplinks++;
+            continue;
+        }
+        awake(r, model.wifi_ms, model.wifi_ma);
+
+        if (uniform() < model.mqtt_fail) {
+            awake(r, model.mqtt_timeout_ms, model.mqtt_ma);
+            wake_backoff_failure(&backoff, rng());
+            r->failed_uplinks++;
+            continue;
+        }
+        awake(r, model.mqtt_ms, model.mqtt_ma);
+
+        /* Replay stops at the first failed publish, like uplink_queue_replay() */
+        bool replayed = true;
+        while (queued > 0) {
+            awake(r, model.publish_ms, model.publish_ma);
+            if (uniform() < model.publish_fail) {
+                replayed = false;
+                break;
+            }
+            queued--;
+            r->delivered++;
+        }
+        if (replayed) {
+            wake_backoff_success(&backoff);
+        } else {
+            wake_backoff_failure(&backoff, rng());
+            r->failed_uplinks++;
+        }
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-d days] [-s seed] [-m key=value]... \"policy\"...\nmodel keys:", prog);
+    for (size_t i = 0; i < sizeof(model_keys) / sizeof(model_keys[0]); i++) {
+        fprintf(stderr, " %s", model_keys[i].key);
+    }
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    double days = 180;
+    uint64_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:s:m:")) != -1) {
+        switch (opt) {
+        case 'd':
+            days = atof(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'm':
+            if (set_model(optarg) != 0) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+    }
+
+    printf("%-36s %8s %7s %6s %8s %7s %9s %9s\n", "policy", "wakes", "uplinks", "failed",
+            "records", "dropped", "delivery", "life_days");
+    for (int i = optind; i < argc; i++) {
+        struct policy p;
+        struct result r;
+
+        if (parse_policy(argv[i], &p) != 0) {
+            fprintf(stderr, "bad policy: %s\n", argv[i]);
+            return 2;
+        }
+        rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+        clock_t start = clock();
+        simulate(&p, days, &r);
+        double cpu_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        double avg_ma = r.charge / (r.seconds * 1000);
+        double life_days = model.battery_mah / avg_ma / 24;
+        double delivery = r.generated ? (double)r.delivered / r.generated : 0;
+        printf("%-36s %8ld %7ld %6ld %8ld %7ld %8.1f%% %9.0f  (%.3f mA avg, %.2f s)\n", p.name, r.wakes, r.uplinks,
+                r.failed_uplinks, r.generated, r.dropped, delivery * 100, life_days, avg_ma, cpu_s);
+    }
+    return 0;
+}